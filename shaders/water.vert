@@ -11,17 +11,47 @@ uniform float uHeightScale;
 uniform float uWaterSurfaceSize;
 uniform vec2 uTexelSize;
 
+// AdaptiveWaterSimulator: uHeightMap is a tile atlas and uPageTable holds, per
+// finest block, the atlas origin (xy) and level (z) of the leaf covering it.
+uniform bool uAdaptive;
+uniform usampler2D uPageTable;
+uniform int uPagesPerSide;
+uniform int uRootBlocks;
+uniform int uBlockSize;
+
+// FftOceanSimulator: horizontal (x, z) displacement in metres that sharpens the crests.
+uniform bool uDisplaced;
+uniform sampler2D uDisplacementMap;
+
 out vec3 FragPos;
 out vec2 TexCoord;
 out vec3 Normal;
 out vec4 ClipSpacePos;
 out vec3 ViewPos;
 
+float sampleHeight(vec2 texCoord) {
+    if (!uAdaptive) {
+        return texture(uHeightMap, texCoord).r;
+    }
+
+    vec2 uv = clamp(texCoord, 0.0, 1.0);
+    ivec2 pageCoord = min(ivec2(uv * float(uPagesPerSide)), ivec2(uPagesPerSide - 1));
+    uvec4 page = texelFetch(uPageTable, pageCoord, 0);
+
+    // Cell-centred position inside the leaf, then into its tile past the ghost ring.
+    float blocks = float(uRootBlocks << page.z);
+    vec2 global = uv * blocks;
+    vec2 block = min(floor(global), vec2(blocks - 1.0));
+    vec2 local = (global - block) * float(uBlockSize);
+    vec2 atlasCoord = vec2(page.xy) + 1.0 + local;
+    return texture(uHeightMap, atlasCoord / vec2(textureSize(uHeightMap, 0))).r;
+}
+
 vec3 calculateNormal(vec2 texCoord) {
-    float heightL = texture(uHeightMap, texCoord + vec2(-uTexelSize.x, 0.0)).r;
-    float heightR = texture(uHeightMap, texCoord + vec2(uTexelSize.x, 0.0)).r;
-    float heightD = texture(uHeightMap, texCoord + vec2(0.0, -uTexelSize.y)).r;
-    float heightU = texture(uHeightMap, texCoord + vec2(0.0, uTexelSize.y)).r;
+    float heightL = sampleHeight(texCoord + vec2(-uTexelSize.x, 0.0));
+    float heightR = sampleHeight(texCoord + vec2(uTexelSize.x, 0.0));
+    float heightD = sampleHeight(texCoord + vec2(0.0, -uTexelSize.y));
+    float heightU = sampleHeight(texCoord + vec2(0.0, uTexelSize.y));
 
     float dx = (heightR - heightL) * uHeightScale;
     float dz = (heightU - heightD) * uHeightScale;
@@ -34,8 +64,11 @@ vec3 calculateNormal(vec2 texCoord) {
 void main() {
     TexCoord = aTexCoord;
 
-    float height = texture(uHeightMap, TexCoord).r * uHeightScale;
+    float height = sampleHeight(TexCoord) * uHeightScale;
     vec3 displacedPos = aPos + vec3(0.0, height, 0.0);
+    if (uDisplaced) {
+        displacedPos.xz += texture(uDisplacementMap, TexCoord).rg * uHeightScale;
+    }
 
     FragPos = vec3(model * vec4(displacedPos, 1.0));
     Normal = mat3(transpose(inverse(model))) * calculateNormal(TexCoord);
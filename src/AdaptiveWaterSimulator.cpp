@@ -0,0 +1,594 @@
+#include "AdaptiveWaterSimulator.h"
+#include "WaterKernels.h"
+#include "FrameProfiler.h"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+AdaptiveWaterSimulator::AdaptiveWaterSimulator(float physicalSize, int rootBlockCount, int maxRefinement,
+                                               int threadCount) :
+    size(physicalSize),
+    rootBlocks(rootBlockCount),
+    maxLevel(maxRefinement),
+    pagesPerSide(rootBlockCount << maxRefinement),
+    kernels(&selectWaterKernels()),
+    threadPool(threadCount),
+    atlasTexture(0),
+    rng(std::random_device{}()),
+    distPos(-physicalSize / 2.0f, physicalSize / 2.0f),
+    distProb(0.0f, 1.0f) {
+
+    // Same timestep as a uniform WaterSimulator grid at the finest resolution.
+    dt_sim = 1.0f / static_cast<float>(getFinestGridN());
+
+    glGenTextures(1, &pageTableTexture);
+    glBindTexture(GL_TEXTURE_2D, pageTableTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16UI, pagesPerSide, pagesPerSide);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    pageTable.assign(static_cast<size_t>(pagesPerSide) * pagesPerSide * 4, 0);
+
+    growAtlas();
+    for (int y = 0; y < rootBlocks; ++y) {
+        for (int x = 0; x < rootBlocks; ++x) {
+            createBlock(0, x, y);
+        }
+    }
+    rebuildTopology();
+    fillAllGhosts(false);
+    uploadTiles();
+
+    std::cout << "AdaptiveWaterSim size=" << size << ", blocks " << blockSize << "x" << blockSize
+              << ", levels 0-" << maxLevel << ", finest N=" << getFinestGridN() << ", dt_sim=" << dt_sim
+              << ", threads: " << threadPool.getThreadCount() << std::endl;
+}
+
+AdaptiveWaterSimulator::~AdaptiveWaterSimulator() {
+    glDeleteTextures(1, &atlasTexture);
+    glDeleteTextures(1, &pageTableTexture);
+}
+
+AdaptiveWaterSimulator::Block* AdaptiveWaterSimulator::findBlock(int level, int x, int y) const {
+    auto it = blocks.find(blockKey(level, x, y));
+    return it == blocks.end() ? nullptr : it->second.get();
+}
+
+AdaptiveWaterSimulator::Block* AdaptiveWaterSimulator::leafAt(float worldX, float worldZ) const {
+    float normX = (worldX + size / 2.0f) / size;
+    float normZ = (worldZ + size / 2.0f) / size;
+    for (int level = maxLevel; level >= 0; --level) {
+        int n = rootBlocks << level;
+        int x = std::max(0, std::min(n - 1, static_cast<int>(std::floor(normX * n))));
+        int y = std::max(0, std::min(n - 1, static_cast<int>(std::floor(normZ * n))));
+        if (Block* block = findBlock(level, x, y)) return block;
+    }
+    return nullptr;
+}
+
+AdaptiveWaterSimulator::Block* AdaptiveWaterSimulator::createBlock(int level, int x, int y) {
+    std::unique_ptr<Block> block(new Block());
+    block->level = level;
+    block->x = x;
+    block->y = y;
+    block->current.assign(stride * stride, 0.0f);
+    block->previous.assign(stride * stride, 0.0f);
+    initializeDamping(*block);
+    assignSlot(*block);
+
+    Block* raw = block.get();
+    blocks[blockKey(level, x, y)] = std::move(block);
+    topologyChanged = true;
+    return raw;
+}
+
+void AdaptiveWaterSimulator::removeBlock(Block* block) {
+    freeSlots.push_back(glm::ivec2(block->slotX, block->slotY));
+    blocks.erase(blockKey(block->level, block->x, block->y));
+    topologyChanged = true;
+}
+
+void AdaptiveWaterSimulator::initializeDamping(Block& block) const {
+    // Same profile as WaterSolver::edgeDampingProfile, evaluated at the cell centres.
+    float h = cellSize(block.level);
+    float half = size / 2.0f;
+    auto profile = [&](int cell) {
+        float pos = -half + (static_cast<float>(cell) + 0.5f) * h;
+        float l = std::min(pos + half, half - pos);
+        return 0.95f * std::min(1.0f, l / 0.2f);
+    };
+
+    block.damping.resize(blockSize * blockSize);
+    for (int r = 0; r < blockSize; ++r) {
+        float rowDamping = profile(block.y * blockSize + r);
+        for (int c = 0; c < blockSize; ++c) {
+            block.damping[r * blockSize + c] = std::min(rowDamping, profile(block.x * blockSize + c));
+        }
+    }
+}
+
+void AdaptiveWaterSimulator::assignSlot(Block& block) {
+    if (freeSlots.empty()) growAtlas();
+    block.slotX = freeSlots.back().x;
+    block.slotY = freeSlots.back().y;
+    freeSlots.pop_back();
+    block.uploadPending = true;
+}
+
+void AdaptiveWaterSimulator::growAtlas() {
+    // The new texture is twice as wide; tiles keep their slots and are sent again.
+    int previousTiles = atlasTilesPerSide;
+    atlasTilesPerSide = previousTiles == 0 ? 8 : previousTiles * 2;
+    for (int y = atlasTilesPerSide - 1; y >= 0; --y) {
+        for (int x = atlasTilesPerSide - 1; x >= 0; --x) {
+            if (x >= previousTiles || y >= previousTiles) freeSlots.push_back(glm::ivec2(x, y));
+        }
+    }
+
+    if (atlasTexture) glDeleteTextures(1, &atlasTexture);
+    glGenTextures(1, &atlasTexture);
+    glBindTexture(GL_TEXTURE_2D, atlasTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, atlasTilesPerSide * stride, atlasTilesPerSide * stride);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    for (auto& entry : blocks) {
+        entry.second->uploadPending = true;
+    }
+}
+
+AdaptiveWaterSimulator::Face AdaptiveWaterSimulator::findFace(const Block& block, int face) const {
+    // Faces: 0 = -x, 1 = +x, 2 = -z, 3 = +z.
+    static const int dx[4] = {-1, 1, 0, 0};
+    static const int dy[4] = {0, 0, -1, 1};
+
+    Face result = {FaceBoundary, {nullptr, nullptr}};
+    int n = rootBlocks << block.level;
+    int nx = block.x + dx[face];
+    int ny = block.y + dy[face];
+    if (nx < 0 || nx >= n || ny < 0 || ny >= n) return result;
+
+    if (Block* same = findBlock(block.level, nx, ny)) {
+        result.kind = FaceSame;
+        result.neighbours[0] = same;
+    } else if (Block* coarser = block.level > 0 ? findBlock(block.level - 1, nx >> 1, ny >> 1) : nullptr) {
+        result.kind = FaceCoarser;
+        result.neighbours[0] = coarser;
+    } else {
+        // The two children of the neighbour that touch this face.
+        result.kind = FaceFiner;
+        if (dx[face] != 0) {
+            int column = 2 * nx + (dx[face] > 0 ? 0 : 1);
+            result.neighbours[0] = findBlock(block.level + 1, column, 2 * ny);
+            result.neighbours[1] = findBlock(block.level + 1, column, 2 * ny + 1);
+        } else {
+            int row = 2 * ny + (dy[face] > 0 ? 0 : 1);
+            result.neighbours[0] = findBlock(block.level + 1, 2 * nx, row);
+            result.neighbours[1] = findBlock(block.level + 1, 2 * nx + 1, row);
+        }
+    }
+    return result;
+}
+
+float AdaptiveWaterSimulator::coarseSample(const std::vector<float>& cells, int r, int c,
+                                           float offsetRow, float offsetCol) const {
+    // Linear reconstruction with minmod-limited slopes from the block's own
+    // cells. The four children of a cell (offsets +-0.25) average to the cell.
+    auto slope = [](float center, const float* lower, const float* upper) {
+        if (!lower && !upper) return 0.0f;
+        if (!lower) return *upper - center;
+        if (!upper) return center - *lower;
+        float a = center - *lower;
+        float b = *upper - center;
+        if (a * b <= 0.0f) return 0.0f;
+        return std::abs(a) < std::abs(b) ? a : b;
+    };
+
+    float center = cells[at(r, c)];
+    float slopeCol = slope(center, c > 0 ? &cells[at(r, c - 1)] : nullptr,
+                           c < blockSize - 1 ? &cells[at(r, c + 1)] : nullptr);
+    float slopeRow = slope(center, r > 0 ? &cells[at(r - 1, c)] : nullptr,
+                           r < blockSize - 1 ? &cells[at(r + 1, c)] : nullptr);
+    return center + slopeCol * offsetCol + slopeRow * offsetRow;
+}
+
+void AdaptiveWaterSimulator::refine(Block* block) {
+    // Neighbours stay within one level of each other, so a coarser neighbour is split first.
+    for (int face = 0; face < 4; ++face) {
+        Face neighbour = findFace(*block, face);
+        if (neighbour.kind == FaceCoarser) refine(neighbour.neighbours[0]);
+    }
+
+    const int half = blockSize / 2;
+    for (int qy = 0; qy < 2; ++qy) {
+        for (int qx = 0; qx < 2; ++qx) {
+            Block* child = createBlock(block->level + 1, 2 * block->x + qx, 2 * block->y + qy);
+            child->target = block->target;
+            for (int r = 0; r < blockSize; ++r) {
+                int pr = qy * half + r / 2;
+                float offsetRow = (r & 1) ? 0.25f : -0.25f;
+                for (int c = 0; c < blockSize; ++c) {
+                    int pc = qx * half + c / 2;
+                    float offsetCol = (c & 1) ? 0.25f : -0.25f;
+                    child->current[at(r, c)] = coarseSample(block->current, pr, pc, offsetRow, offsetCol);
+                    child->previous[at(r, c)] = coarseSample(block->previous, pr, pc, offsetRow, offsetCol);
+                }
+            }
+        }
+    }
+    removeBlock(block);
+}
+
+void AdaptiveWaterSimulator::merge(int level, int x, int y) {
+    Block* children[2][2];
+    for (int qy = 0; qy < 2; ++qy) {
+        for (int qx = 0; qx < 2; ++qx) {
+            children[qy][qx] = findBlock(level + 1, 2 * x + qx, 2 * y + qy);
+        }
+    }
+
+    const int half = blockSize / 2;
+    Block* parent = createBlock(level, x, y);
+    for (int r = 0; r < blockSize; ++r) {
+        for (int c = 0; c < blockSize; ++c) {
+            const Block* child = children[r / half][c / half];
+            int cr = 2 * (r % half);
+            int cc = 2 * (c % half);
+            parent->current[at(r, c)] = 0.25f * (child->current[at(cr, cc)] + child->current[at(cr, cc + 1)] +
+                                                 child->current[at(cr + 1, cc)] + child->current[at(cr + 1, cc + 1)]);
+            parent->previous[at(r, c)] = 0.25f * (child->previous[at(cr, cc)] + child->previous[at(cr, cc + 1)] +
+                                                  child->previous[at(cr + 1, cc)] + child->previous[at(cr + 1, cc + 1)]);
+        }
+    }
+    for (int qy = 0; qy < 2; ++qy) {
+        for (int qx = 0; qx < 2; ++qx) {
+            parent->target = std::max(parent->target, children[qy][qx]->target);
+            removeBlock(children[qy][qx]);
+        }
+    }
+}
+
+void AdaptiveWaterSimulator::refineTo(float worldX, float worldZ, int level) {
+    for (Block* block = leafAt(worldX, worldZ); block->level < level; block = leafAt(worldX, worldZ)) {
+        block->target = std::max(block->target, level);
+        refine(block);
+    }
+}
+
+int AdaptiveWaterSimulator::focusLevel(const Block& block) const {
+    if (focusRadius <= 0.0f) return 0;
+    float blockWidth = size / static_cast<float>(rootBlocks << block.level);
+    float x0 = -size / 2.0f + block.x * blockWidth;
+    float z0 = -size / 2.0f + block.y * blockWidth;
+    float dx = std::max(std::max(x0 - focusX, focusX - (x0 + blockWidth)), 0.0f);
+    float dz = std::max(std::max(z0 - focusZ, focusZ - (z0 + blockWidth)), 0.0f);
+    float distance = std::sqrt(dx * dx + dz * dz);
+    int drop = static_cast<int>(std::floor(std::log2(1.0f + distance / focusRadius)));
+    return std::max(0, maxLevel - drop);
+}
+
+WaterPageTable AdaptiveWaterSimulator::getPageTable() const {
+    WaterPageTable table;
+    table.texture = pageTableTexture;
+    table.pagesPerSide = pagesPerSide;
+    table.rootBlocks = rootBlocks;
+    table.blockSize = blockSize;
+    return table;
+}
+
+void AdaptiveWaterSimulator::setFocus(float worldX, float worldZ, float radius) {
+    focusX = worldX;
+    focusZ = worldZ;
+    focusRadius = radius;
+}
+
+void AdaptiveWaterSimulator::regrid() {
+    // Target levels: the focus distance, raised to the finest level for
+    // moving water and the blocks next to it so waves never leave the fine region.
+    std::vector<Block*> active;
+    for (Block* block : leaves) {
+        block->target = focusLevel(*block);
+        float amplitude = 0.0f;
+        for (int r = 0; r < blockSize; ++r) {
+            for (int c = 0; c < blockSize; ++c) {
+                float value = block->current[at(r, c)];
+                amplitude = std::max(amplitude, std::max(std::abs(value), std::abs(value - block->previous[at(r, c)])));
+            }
+        }
+        if (amplitude > activeThreshold) active.push_back(block);
+    }
+    for (Block* block : active) {
+        block->target = maxLevel;
+        for (const Face& face : block->faces) {
+            for (Block* neighbour : face.neighbours) {
+                if (neighbour) neighbour->target = maxLevel;
+            }
+        }
+    }
+
+    // Refine by key: splitting one block can split its coarser neighbours too.
+    std::vector<std::pair<unsigned long long, int>> work;
+    for (Block* block : leaves) {
+        if (block->level < block->target) work.push_back({blockKey(block->level, block->x, block->y), block->target});
+    }
+    while (!work.empty()) {
+        unsigned long long key = work.back().first;
+        int target = work.back().second;
+        work.pop_back();
+        auto it = blocks.find(key);
+        if (it == blocks.end() || it->second->level >= target) continue;
+
+        Block* block = it->second.get();
+        int level = block->level, x = block->x, y = block->y;
+        block->target = std::max(block->target, target);
+        refine(block);
+        for (int q = 0; q < 4; ++q) {
+            Block* child = findBlock(level + 1, 2 * x + (q & 1), 2 * y + (q >> 1));
+            if (child->level < target) work.push_back({blockKey(child->level, child->x, child->y), target});
+        }
+    }
+
+    // Merge one level per regrid where all four siblings want to be coarser
+    // and none of them has a finer neighbour. Every parent is checked before
+    // any is merged, so a parent merged now cannot merge again until the next regrid.
+    std::vector<glm::ivec3> parents;
+    for (auto& entry : blocks) {
+        const Block& block = *entry.second;
+        if (block.level > 0 && (block.x & 1) == 0 && (block.y & 1) == 0) {
+            parents.push_back(glm::ivec3(block.level - 1, block.x / 2, block.y / 2));
+        }
+    }
+    std::vector<glm::ivec3> merges;
+    for (const glm::ivec3& parent : parents) {
+        bool mergeable = true;
+        for (int q = 0; q < 4 && mergeable; ++q) {
+            Block* child = findBlock(parent.x + 1, 2 * parent.y + (q & 1), 2 * parent.z + (q >> 1));
+            mergeable = child && child->target <= parent.x;
+            for (int face = 0; face < 4 && mergeable; ++face) {
+                mergeable = findFace(*child, face).kind != FaceFiner;
+            }
+        }
+        if (mergeable) merges.push_back(parent);
+    }
+    for (const glm::ivec3& parent : merges) {
+        merge(parent.x, parent.y, parent.z);
+    }
+
+    if (topologyChanged) rebuildTopology();
+}
+
+void AdaptiveWaterSimulator::rebuildTopology() {
+    leaves.clear();
+    for (auto& entry : blocks) {
+        leaves.push_back(entry.second.get());
+    }
+    std::sort(leaves.begin(), leaves.end(), [](const Block* a, const Block* b) {
+        return blockKey(a->level, a->x, a->y) < blockKey(b->level, b->x, b->y);
+    });
+
+    for (Block* block : leaves) {
+        for (int face = 0; face < 4; ++face) {
+            block->faces[face] = findFace(*block, face);
+        }
+
+        // One page per finest block: tile origin in texels and the leaf level.
+        int span = 1 << (maxLevel - block->level);
+        for (int py = block->y * span; py < (block->y + 1) * span; ++py) {
+            for (int px = block->x * span; px < (block->x + 1) * span; ++px) {
+                unsigned short* page = &pageTable[(static_cast<size_t>(py) * pagesPerSide + px) * 4];
+                page[0] = static_cast<unsigned short>(block->slotX * stride);
+                page[1] = static_cast<unsigned short>(block->slotY * stride);
+                page[2] = static_cast<unsigned short>(block->level);
+                page[3] = 0;
+            }
+        }
+    }
+    topologyChanged = false;
+    pageTableDirty = true;
+}
+
+void AdaptiveWaterSimulator::fillGhosts(Block& block, bool fluxMatched, bool finerFaces) const {
+    static const int dc[4] = {-1, 1, 0, 0};
+    static const int dr[4] = {0, 0, -1, 1};
+    float* cells = block.current.data();
+
+    for (int face = 0; face < 4; ++face) {
+        const Face& neighbour = block.faces[face];
+        if ((neighbour.kind == FaceFiner) != finerFaces) continue;
+
+        // Ghost k of the face sits at first + k * step.
+        int firstRow = dr[face] == 0 ? 0 : (dr[face] < 0 ? -1 : blockSize);
+        int firstCol = dc[face] == 0 ? 0 : (dc[face] < 0 ? -1 : blockSize);
+        int first = at(firstRow, firstCol);
+        int step = dr[face] == 0 ? stride : 1;
+        if (neighbour.kind == FaceBoundary) {
+            for (int k = 0; k < blockSize; ++k) cells[first + k * step] = 0.0f;
+            continue;
+        }
+        if (neighbour.kind == FaceSame) {
+            const float* other = neighbour.neighbours[0]->current.data();
+            int offset = -(dr[face] * stride + dc[face]) * blockSize;
+            for (int k = 0; k < blockSize; ++k) cells[first + k * step] = other[first + offset + k * step];
+            continue;
+        }
+
+        for (int k = 0; k < blockSize; ++k) {
+            int lr = dr[face] == 0 ? k : firstRow;
+            int lc = dc[face] == 0 ? k : firstCol;
+            int gr = block.y * blockSize + lr;
+            int gc = block.x * blockSize + lc;
+            float& ghost = cells[at(lr, lc)];
+
+            if (neighbour.kind == FaceCoarser) {
+                const Block* other = neighbour.neighbours[0];
+                ghost = coarseSample(other->current, (gr >> 1) - other->y * blockSize, (gc >> 1) - other->x * blockSize,
+                                     (gr & 1) ? 0.25f : -0.25f, (gc & 1) ? 0.25f : -0.25f);
+            } else {
+                const Block* other = neighbour.neighbours[k < blockSize / 2 ? 0 : 1];
+                const float* fine = other->current.data();
+                int fr = 2 * gr - other->y * blockSize;
+                int fc = 2 * gc - other->x * blockSize;
+                if (!fluxMatched) {
+                    ghost = 0.25f * (fine[at(fr, fc)] + fine[at(fr, fc + 1)] + fine[at(fr + 1, fc)] + fine[at(fr + 1, fc + 1)]);
+                    continue;
+                }
+                // The coarse face flux (ghost - inner) must equal the sum of
+                // the fine face fluxes (fine - fine ghost) through the same face.
+                float flux = 0.0f;
+                if (dc[face] != 0) {
+                    int col = fc + (dc[face] > 0 ? 0 : 1);
+                    for (int row = fr; row < fr + 2; ++row) {
+                        flux += fine[at(row, col)] - fine[at(row, col - dc[face])];
+                    }
+                } else {
+                    int row = fr + (dr[face] > 0 ? 0 : 1);
+                    for (int col = fc; col < fc + 2; ++col) {
+                        flux += fine[at(row, col)] - fine[at(row - dr[face], col)];
+                    }
+                }
+                ghost = cells[at(lr - dr[face], lc - dc[face])] + flux;
+            }
+        }
+    }
+
+    // The corners are only read by the renderer's bilinear filter.
+    if (finerFaces && !fluxMatched) {
+        const int last = blockSize - 1;
+        cells[at(-1, -1)] = 0.5f * (cells[at(-1, 0)] + cells[at(0, -1)]);
+        cells[at(-1, blockSize)] = 0.5f * (cells[at(-1, last)] + cells[at(0, blockSize)]);
+        cells[at(blockSize, -1)] = 0.5f * (cells[at(blockSize, 0)] + cells[at(last, -1)]);
+        cells[at(blockSize, blockSize)] = 0.5f * (cells[at(blockSize, last)] + cells[at(last, blockSize)]);
+    }
+}
+
+void AdaptiveWaterSimulator::fillAllGhosts(bool fluxMatched) {
+    // Coarse ghosts next to finer blocks read those blocks' ghosts, so they go second.
+    int count = static_cast<int>(leaves.size());
+    threadPool.run(count, [this, fluxMatched](int i, int) { fillGhosts(*leaves[i], fluxMatched, false); });
+    threadPool.run(count, [this, fluxMatched](int i, int) { fillGhosts(*leaves[i], fluxMatched, true); });
+}
+
+void AdaptiveWaterSimulator::stepBlock(Block& block) {
+    float h = cellSize(block.level);
+    float A = (dt_sim * dt_sim) / (h * h);
+    float B = 2.0f - 4.0f * A;
+    float* prev = block.previous.data();
+    const float* cur = block.current.data();
+    for (int r = 0; r < blockSize; ++r) {
+        kernels->stencilRow(prev + at(r, 0), cur + at(r - 1, 0), cur + at(r, 0), cur + at(r + 1, 0),
+                            &block.damping[r * blockSize], blockSize, A, B);
+    }
+    block.current.swap(block.previous);
+}
+
+void AdaptiveWaterSimulator::updateSimulation(int substeps) {
+    {
+        DUCK_PROFILE_CPU("sim step");
+        std::stable_sort(queuedDisturbances.begin(), queuedDisturbances.end(),
+                         [](const QueuedDisturbance& a, const QueuedDisturbance& b) { return a.substep < b.substep; });
+        size_t next = 0;
+        for (int s = 0; s < substeps; ++s) {
+            for (; next < queuedDisturbances.size() && (queuedDisturbances[next].substep <= s || s == substeps - 1);
+                 ++next) {
+                const QueuedDisturbance& d = queuedDisturbances[next];
+                createDisturbance(d.worldX, d.worldZ, d.magnitude);
+            }
+            if (topologyChanged) rebuildTopology();
+            if (stepCount % regridInterval == 0) regrid();
+
+            fillAllGhosts(true);
+            threadPool.run(static_cast<int>(leaves.size()), [this](int i, int) { stepBlock(*leaves[i]); });
+            ++stepCount;
+        }
+        if (substeps > 0) queuedDisturbances.clear();
+    }
+    if (substeps <= 0) return;
+
+    DUCK_PROFILE_GPU("texture upload");
+    fillAllGhosts(false);
+    uploadTiles();
+}
+
+void AdaptiveWaterSimulator::uploadTiles() {
+    glBindTexture(GL_TEXTURE_2D, atlasTexture);
+    for (Block* block : leaves) {
+        bool calm = true;
+        for (float value : block->current) {
+            if (std::abs(value) > uploadEpsilon) {
+                calm = false;
+                break;
+            }
+        }
+        // Calm tiles are sent once more after they settle, then left alone.
+        if (!block->uploadPending && calm && block->uploadedCalm) continue;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, block->slotX * stride, block->slotY * stride, stride, stride,
+                        GL_RED, GL_FLOAT, block->current.data());
+        block->uploadedCalm = calm;
+        block->uploadPending = false;
+    }
+
+    if (pageTableDirty) {
+        glBindTexture(GL_TEXTURE_2D, pageTableTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, pagesPerSide, pagesPerSide, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT,
+                        pageTable.data());
+        pageTableDirty = false;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void AdaptiveWaterSimulator::createRaindrop(int substep) {
+    if (distProb(rng) < raindropProbability) {
+        createDisturbance(distPos(rng), distPos(rng), raindropMagnitude, substep);
+    }
+}
+
+void AdaptiveWaterSimulator::createDisturbance(float worldX, float worldZ, float magnitude, int substep) {
+    if (substep > 0) {
+        queuedDisturbances.push_back({worldX, worldZ, magnitude, substep});
+        return;
+    }
+    refineTo(worldX, worldZ, maxLevel);
+    if (topologyChanged) {
+        rebuildTopology();
+        fillAllGhosts(false);
+    }
+
+    Block* block = leafAt(worldX, worldZ);
+    float h = cellSize(block->level);
+    int r = static_cast<int>(std::floor((worldZ + size / 2.0f) / h)) - block->y * blockSize;
+    int c = static_cast<int>(std::floor((worldX + size / 2.0f) / h)) - block->x * blockSize;
+    r = std::max(0, std::min(blockSize - 1, r));
+    c = std::max(0, std::min(blockSize - 1, c));
+    block->current[at(r, c)] += magnitude;
+}
+
+float AdaptiveWaterSimulator::getHeightAt(float worldX, float worldZ) const {
+    const Block* block = leafAt(worldX, worldZ);
+    float h = cellSize(block->level);
+
+    // Cell-centred coordinates inside the block; the ghost ring covers the edges.
+    float c_float = (worldX + size / 2.0f) / h - 0.5f - static_cast<float>(block->x * blockSize);
+    float r_float = (worldZ + size / 2.0f) / h - 0.5f - static_cast<float>(block->y * blockSize);
+    int c0 = std::max(-1, std::min(blockSize - 1, static_cast<int>(std::floor(c_float))));
+    int r0 = std::max(-1, std::min(blockSize - 1, static_cast<int>(std::floor(r_float))));
+    float tx = std::max(0.0f, std::min(1.0f, c_float - c0));
+    float ty = std::max(0.0f, std::min(1.0f, r_float - r0));
+
+    const std::vector<float>& cells = block->current;
+    return (1 - tx) * (1 - ty) * cells[at(r0, c0)] +
+           tx * (1 - ty) * cells[at(r0, c0 + 1)] +
+           (1 - tx) * ty * cells[at(r0 + 1, c0)] +
+           tx * ty * cells[at(r0 + 1, c0 + 1)];
+}
+
+glm::vec3 AdaptiveWaterSimulator::getNormalAt(float worldX, float worldZ) const {
+    float h = cellSize(leafAt(worldX, worldZ)->level);
+    float grad_x = (getHeightAt(worldX + h, worldZ) - getHeightAt(worldX - h, worldZ)) / (2.0f * h);
+    float grad_z = (getHeightAt(worldX, worldZ + h) - getHeightAt(worldX, worldZ - h)) / (2.0f * h);
+    return glm::normalize(glm::vec3(-grad_x, 1.0f, -grad_z));
+}
@@ -0,0 +1,176 @@
+#ifndef ADAPTIVEWATERSIMULATOR_H
+#define ADAPTIVEWATERSIMULATOR_H
+
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <random>
+#include <glad.h>
+#include <glm/glm.hpp>
+#include "ThreadPool.h"
+#include "WaterSurface.h"
+
+struct WaterKernels;
+
+// Same wave equation as WaterSimulator on a block-structured quadtree. The
+// surface is covered by leaf blocks of blockSize x blockSize cells; a block on
+// level l has cells of size physicalSize / (rootBlocks * blockSize * 2^l).
+// Blocks are refined around disturbances, moving water and the focus point,
+// and merged back once the water is calm and far away, so the cell count
+// follows the detail instead of the area.
+//
+// Every level is stepped with the timestep of the finest one, which is the
+// timestep WaterSimulator uses for a grid of getFinestGridN() cells. At a
+// refinement boundary the coarse ghost cells are chosen so the coarse face
+// flux equals the sum of the two fine face fluxes, and refining and merging
+// keep cell averages, so no water is created or lost between levels.
+//
+// The renderer sees the heights through a virtual texture: every leaf owns a
+// tile with a one-cell ghost border in an R32F atlas, and an RGBA16UI page
+// table with one texel per finest block holds the tile origin and level of
+// the leaf covering it (see sampleHeight() in water.vert).
+class AdaptiveWaterSimulator : public WaterSurface {
+public:
+    AdaptiveWaterSimulator(float physicalSize = 2.0f, int rootBlocks = 2, int maxLevel = 3, int threadCount = 0);
+    ~AdaptiveWaterSimulator() override;
+
+    const char* getBackendName() const override { return "adaptive"; }
+
+    // Advances the surface by `substeps` timesteps and uploads the tiles that changed.
+    void updateSimulation(int substeps = 1) override;
+    void createRaindrop(int substep = 0) override;
+
+    // Refines the blocks around the point to the finest level first.
+    void createDisturbance(float worldX, float worldZ, float magnitude, int substep = 0) override;
+    float getHeightAt(float worldX, float worldZ) const override;
+    glm::vec3 getNormalAt(float worldX, float worldZ) const override;
+
+    // Blocks within `radius` of the point (usually the camera) are kept at the
+    // finest level; the level drops by one per doubling of the distance.
+    // A radius of zero turns the focus off.
+    void setFocus(float worldX, float worldZ, float radius) override;
+
+    // The atlas takes the place of the heightmap texture.
+    GLuint getHeightmapTextureID() const override { return atlasTexture; }
+    GLuint getPageTableTextureID() const { return pageTableTexture; }
+    WaterPageTable getPageTable() const override;
+    float getHeightmapScale() const override { return 1.0f; }
+    int getPagesPerSide() const { return pagesPerSide; }
+    int getRootBlocks() const { return rootBlocks; }
+    static int getBlockSize() { return blockSize; }
+    // Cells per side of a uniform grid at the finest level.
+    int getFinestGridN() const { return pagesPerSide * blockSize; }
+    int getGridN() const override { return getFinestGridN(); }
+
+    int getLeafCount() const { return static_cast<int>(leaves.size()); }
+    long long getCellCount() const { return static_cast<long long>(leaves.size()) * blockSize * blockSize; }
+
+private:
+    enum FaceKind {
+        FaceBoundary,
+        FaceSame,
+        FaceCoarser,
+        FaceFiner
+    };
+
+    struct Block;
+
+    // A disturbance for a later substep of the next updateSimulation() call.
+    struct QueuedDisturbance {
+        float worldX;
+        float worldZ;
+        float magnitude;
+        int substep;
+    };
+
+    // Neighbours across one face. A finer face has two blocks, one per half.
+    struct Face {
+        FaceKind kind;
+        Block* neighbours[2];
+    };
+
+    struct Block {
+        int level;
+        int x;
+        int y;
+        // (blockSize + 2)^2 cells including the ghost ring.
+        std::vector<float> current;
+        std::vector<float> previous;
+        std::vector<float> damping;
+        int target = 0;
+        int slotX = -1;
+        int slotY = -1;
+        bool uploadPending = true;
+        bool uploadedCalm = false;
+        Face faces[4];
+    };
+
+    static const int blockSize = 16;
+    static const int stride = blockSize + 2;
+
+    float size;
+    int rootBlocks;
+    int maxLevel;
+    int pagesPerSide;
+    float dt_sim;
+
+    std::unordered_map<unsigned long long, std::unique_ptr<Block>> blocks;
+    std::vector<Block*> leaves;
+    bool topologyChanged = true;
+    unsigned long long stepCount = 0;
+    std::vector<QueuedDisturbance> queuedDisturbances;
+
+    float focusX = 0.0f;
+    float focusZ = 0.0f;
+    float focusRadius = 0.0f;
+
+    const WaterKernels* kernels;
+    ThreadPool threadPool;
+
+    GLuint atlasTexture;
+    GLuint pageTableTexture;
+    int atlasTilesPerSide = 0;
+    std::vector<glm::ivec2> freeSlots;
+    std::vector<unsigned short> pageTable;
+    bool pageTableDirty = true;
+
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> distPos;
+    std::uniform_real_distribution<float> distProb;
+    const float raindropProbability = 0.05f;
+    const float raindropMagnitude = 1.1f;
+    // Blocks whose heights or velocities exceed this stay at the finest level.
+    const float activeThreshold = 1e-3f;
+    const float uploadEpsilon = 1e-5f;
+    const int regridInterval = 4;
+
+    static unsigned long long blockKey(int level, int x, int y) {
+        return (static_cast<unsigned long long>(level) << 48) | (static_cast<unsigned long long>(y) << 24) |
+               static_cast<unsigned long long>(x);
+    }
+    static int at(int r, int c) { return (r + 1) * stride + (c + 1); }
+
+    float cellSize(int level) const { return size / static_cast<float>((rootBlocks * blockSize) << level); }
+
+    Block* findBlock(int level, int x, int y) const;
+    Block* leafAt(float worldX, float worldZ) const;
+    Block* createBlock(int level, int x, int y);
+    void removeBlock(Block* block);
+    Face findFace(const Block& block, int face) const;
+    void refine(Block* block);
+    void merge(int level, int x, int y);
+    void refineTo(float worldX, float worldZ, int level);
+    void regrid();
+    void rebuildTopology();
+    int focusLevel(const Block& block) const;
+    float coarseSample(const std::vector<float>& cells, int r, int c, float offsetRow, float offsetCol) const;
+    void fillGhosts(Block& block, bool fluxMatched, bool finerFaces) const;
+    void fillAllGhosts(bool fluxMatched);
+    void stepBlock(Block& block);
+    void initializeDamping(Block& block) const;
+    void assignSlot(Block& block);
+    void growAtlas();
+    void uploadTiles();
+};
+
+#endif // ADAPTIVEWATERSIMULATOR_H
@@ -0,0 +1,411 @@
+#include "FftOceanSimulator.h"
+#include "WaterKernels.h"
+#include "FrameProfiler.h"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+static const float gravity = 9.81f;
+static const double twoPi = 6.283185307179586;
+
+FftOceanSimulator::FftOceanSimulator(int gridN, float physicalSize, int threadCount,
+                                     const OceanSpectrumParameters& parameters_, float stepSeconds_) :
+    N(16),
+    size(physicalSize),
+    parameters(parameters_),
+    stepSeconds(stepSeconds_),
+    kernels(&selectWaterKernels()),
+    threadPool(threadCount) {
+
+    while (N < gridN) N *= 2;
+    if (N != gridN) {
+        std::cout << "FftOcean: grid size " << gridN << " rounded up to " << N << std::endl;
+    }
+    if (glm::dot(parameters.windDirection, parameters.windDirection) == 0.0f) {
+        parameters.windDirection = glm::vec2(1.0f, 0.0f);
+    }
+    parameters.windDirection = glm::normalize(parameters.windDirection);
+    fieldCount = parameters.choppiness != 0.0f ? 3 : 2;
+
+    size_t cells = static_cast<size_t>(N) * N;
+    for (int f = 0; f < fieldCount; ++f) {
+        fieldRe[f].assign(cells, 0.0f);
+        fieldIm[f].assign(cells, 0.0f);
+    }
+    displacement.assign(cells * 2, 0.0f);
+    stripScratch.assign(static_cast<size_t>(threadPool.getThreadCount()) * 2 * N * columnStrip, 0.0f);
+
+    int log2N = 0;
+    while ((1 << log2N) < N) ++log2N;
+    bitReverse.resize(N);
+    for (int i = 0; i < N; ++i) {
+        int reversed = 0;
+        for (int b = 0; b < log2N; ++b) {
+            if (i & (1 << b)) reversed |= 1 << (log2N - 1 - b);
+        }
+        bitReverse[i] = reversed;
+    }
+    twiddleRe.assign(N, 0.0f);
+    twiddleIm.assign(N, 0.0f);
+    for (int span = 1; span < N; span *= 2) {
+        for (int j = 0; j < span; ++j) {
+            double angle = twoPi * 0.5 * j / span;
+            twiddleRe[span + j] = static_cast<float>(std::cos(angle));
+            twiddleIm[span + j] = static_cast<float>(std::sin(angle));
+        }
+    }
+
+    initializeSpectrum();
+
+    glGenTextures(1, &heightmapTexture);
+    glBindTexture(GL_TEXTURE_2D, heightmapTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, N, N);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    glGenTextures(1, &displacementTexture);
+    glBindTexture(GL_TEXTURE_2D, displacementTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32F, N, N);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    synthesize();
+    uploadTextures();
+
+    std::cout << "FftOcean " << N << "x" << N << ", " << size << " m patch, "
+              << (parameters.spectrum == OceanSpectrum::Phillips ? "Phillips" : "JONSWAP") << " spectrum, wind "
+              << parameters.windSpeed << " m/s, kernels: " << kernels->name << ", threads: "
+              << threadPool.getThreadCount() << std::endl;
+}
+
+FftOceanSimulator::~FftOceanSimulator() {
+    glDeleteTextures(1, &heightmapTexture);
+    glDeleteTextures(1, &displacementTexture);
+    if (normalmapTexture) glDeleteTextures(1, &normalmapTexture);
+}
+
+GLuint FftOceanSimulator::getNormalmapTextureID() {
+    if (normalmapTexture) return normalmapTexture;
+
+    glGenTextures(1, &normalmapTexture);
+    glBindTexture(GL_TEXTURE_2D, normalmapTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, N, N);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // The last synthesis left the slopes of the current time in the fields,
+    // so the map is filled from them without another FFT.
+    normalMapRequested = true;
+    normalmapData.assign(static_cast<size_t>(N) * N * 4, 0);
+    threadPool.parallelFor(0, N, [this](int rowBegin, int rowEnd) { fillNormalmap(rowBegin, rowEnd); });
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, normalmapTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, N, N, GL_RGBA, GL_UNSIGNED_BYTE, normalmapData.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return normalmapTexture;
+}
+
+float FftOceanSimulator::spectrumDensity(float kx, float kz) const {
+    float k = std::sqrt(kx * kx + kz * kz);
+    if (k == 0.0f) return 0.0f;
+    float cosine = (kx * parameters.windDirection.x + kz * parameters.windDirection.y) / k;
+    float U = parameters.windSpeed;
+
+    if (parameters.spectrum == OceanSpectrum::Phillips) {
+        // Integrates to alpha * pi * L^2 / 2; alpha gives a variance of (Hs / 4)^2 with Hs = 0.21 U^2 / g.
+        const float alpha = 2.0f * 0.0525f * 0.0525f / 3.14159265f;
+        float L = U * U / gravity;
+        float kL = k * L;
+        return alpha * std::exp(-1.0f / (kL * kL)) / (k * k * k * k) * cosine * cosine;
+    }
+
+    if (cosine <= 0.0f) return 0.0f;
+    // JONSWAP in frequency, turned into wave number with dw/dk = g / (2 w) for deep water.
+    float F = parameters.fetch;
+    float alpha = 0.076f * std::pow(U * U / (F * gravity), 0.22f);
+    float peak = 22.0f * std::pow(gravity * gravity / (U * F), 1.0f / 3.0f);
+    float w = std::sqrt(gravity * k);
+    float sigma = w <= peak ? 0.07f : 0.09f;
+    float shape = (w - peak) / (sigma * peak);
+    float ratio = peak / w;
+    float S = alpha * gravity * gravity / std::pow(w, 5.0f) * std::exp(-1.25f * ratio * ratio * ratio * ratio) *
+              std::pow(3.3f, std::exp(-0.5f * shape * shape));
+    float spreading = 2.0f / 3.14159265f * cosine * cosine;
+    return S * gravity / (2.0f * w) / k * spreading;
+}
+
+void FftOceanSimulator::initializeSpectrum() {
+    size_t cells = static_cast<size_t>(N) * N;
+    h0Re.assign(cells, 0.0f);
+    h0Im.assign(cells, 0.0f);
+    h0ConjRe.assign(cells, 0.0f);
+    h0ConjIm.assign(cells, 0.0f);
+    omega.assign(cells, 0.0f);
+
+    std::mt19937 rng(parameters.seed);
+    std::normal_distribution<float> gaussian(0.0f, 1.0f);
+    float dk = static_cast<float>(twoPi) / size;
+    double variance = 0.0;
+    for (int r = 0; r < N; ++r) {
+        int mz = r < N / 2 ? r : r - N;
+        for (int c = 0; c < N; ++c) {
+            int mx = c < N / 2 ? c : c - N;
+            size_t i = static_cast<size_t>(r) * N + c;
+            float xiRe = gaussian(rng);
+            float xiIm = gaussian(rng);
+            float kx = mx * dk;
+            float kz = mz * dk;
+            omega[i] = std::sqrt(gravity * std::sqrt(kx * kx + kz * kz));
+            // The Nyquist row and column have no partner with the opposite wave
+            // vector, so their slopes would not come out real. Leave them empty.
+            if (r == N / 2 || c == N / 2) continue;
+            // h(k) gets its energy from both h0(k) and h0(-k), hence a quarter per component.
+            float energy = spectrumDensity(kx, kz) * dk * dk;
+            float amplitude = parameters.amplitude * std::sqrt(0.25f * energy);
+            h0Re[i] = xiRe * amplitude;
+            h0Im[i] = xiIm * amplitude;
+            variance += energy;
+        }
+    }
+    for (int r = 0; r < N; ++r) {
+        for (int c = 0; c < N; ++c) {
+            size_t i = static_cast<size_t>(r) * N + c;
+            size_t mirrored = static_cast<size_t>((N - r) % N) * N + (N - c) % N;
+            h0ConjRe[i] = h0Re[mirrored];
+            h0ConjIm[i] = -h0Im[mirrored];
+        }
+    }
+    std::cout << "FftOcean significant wave height of the resolved waves: "
+              << 4.0 * parameters.amplitude * std::sqrt(variance) << " m" << std::endl;
+}
+
+void FftOceanSimulator::evaluateSpectrum(int rowBegin, int rowEnd) {
+    float dk = static_cast<float>(twoPi) / size;
+    float lambda = parameters.choppiness;
+    for (int r = rowBegin; r < rowEnd; ++r) {
+        int mz = r < N / 2 ? r : r - N;
+        float kz = mz * dk;
+        size_t row = static_cast<size_t>(r) * N;
+        for (int c = 0; c < N; ++c) {
+            int mx = c < N / 2 ? c : c - N;
+            float kx = mx * dk;
+            size_t i = row + c;
+
+            // Phase reduced in double so it stays accurate however long the ocean runs.
+            double cycles = omega[i] * time / twoPi;
+            float phase = static_cast<float>((cycles - std::floor(cycles)) * twoPi);
+            float cosine = std::cos(phase);
+            float sine = std::sin(phase);
+
+            // h(k, t) = h0(k) e^(i w t) + conj(h0(-k)) e^(-i w t)
+            float hRe = (h0Re[i] + h0ConjRe[i]) * cosine + (h0ConjIm[i] - h0Im[i]) * sine;
+            float hIm = (h0Im[i] + h0ConjIm[i]) * cosine + (h0Re[i] - h0ConjRe[i]) * sine;
+
+            // Slopes are i k h and the displacement i k / |k| h. Since each of
+            // them transforms to a real field, two share one complex FFT.
+            fieldRe[0][i] = (1.0f - kx) * hRe;
+            fieldIm[0][i] = (1.0f - kx) * hIm;
+            float k = std::sqrt(kx * kx + kz * kz);
+            float invK = k > 0.0f ? lambda / k : 0.0f;
+            float m1 = -kx * invK;
+            fieldRe[1][i] = m1 * hRe - kz * hIm;
+            fieldIm[1][i] = m1 * hIm + kz * hRe;
+            if (fieldCount > 2) {
+                float m2 = kz * invK;
+                fieldRe[2][i] = -m2 * hIm;
+                fieldIm[2][i] = m2 * hRe;
+            }
+        }
+    }
+}
+
+void FftOceanSimulator::inverseFftStrip(float* re, float* im) const {
+    // Radix-2 butterflies between whole rows of `columnStrip` independent
+    // transforms, so every butterfly is one SIMD row kernel over a cache line.
+    // The stages with short spans stay within blocks of stageBlockRows rows,
+    // which are run through all of them while they sit in L1.
+    int blockRows = std::min(N, stageBlockRows);
+    for (int block = 0; block < N; block += blockRows) {
+        for (int span = 1; span < blockRows; span *= 2) {
+            butterflyStage(re, im, span, block, block + blockRows);
+        }
+    }
+    for (int span = blockRows; span < N; span *= 2) {
+        butterflyStage(re, im, span, 0, N);
+    }
+}
+
+void FftOceanSimulator::butterflyStage(float* re, float* im, int span, int rowBegin, int rowEnd) const {
+    const int width = columnStrip;
+    size_t half = static_cast<size_t>(span) * width;
+    for (int start = rowBegin; start < rowEnd; start += 2 * span) {
+        float* aRe = re + static_cast<size_t>(start) * width;
+        float* aIm = im + static_cast<size_t>(start) * width;
+        kernels->butterflyRows(aRe, aIm, aRe + half, aIm + half, &twiddleRe[span], &twiddleIm[span], span, width);
+    }
+}
+
+void FftOceanSimulator::inverseFftRows(int field, int rowBegin, float* re, float* im) {
+    // Transposed into the strip in bit-reversed order, transformed, and transposed back.
+    const int width = columnStrip;
+    float* fieldR = fieldRe[field].data() + static_cast<size_t>(rowBegin) * N;
+    float* fieldI = fieldIm[field].data() + static_cast<size_t>(rowBegin) * N;
+    for (int j = 0; j < width; ++j) {
+        const float* rowR = fieldR + static_cast<size_t>(j) * N;
+        const float* rowI = fieldI + static_cast<size_t>(j) * N;
+        for (int n = 0; n < N; ++n) {
+            re[n * width + j] = rowR[bitReverse[n]];
+            im[n * width + j] = rowI[bitReverse[n]];
+        }
+    }
+    inverseFftStrip(re, im);
+    for (int j = 0; j < width; ++j) {
+        for (int n = 0; n < N; ++n) {
+            fieldR[static_cast<size_t>(j) * N + n] = re[n * width + j];
+            fieldI[static_cast<size_t>(j) * N + n] = im[n * width + j];
+        }
+    }
+}
+
+void FftOceanSimulator::inverseFftColumns(int field, int colBegin, float* re, float* im) {
+    // Copied into the strip so its rows are adjacent rather than N floats apart,
+    // which would put them all in the same few cache sets.
+    const int width = columnStrip;
+    float* fieldR = fieldRe[field].data() + colBegin;
+    float* fieldI = fieldIm[field].data() + colBegin;
+    for (int n = 0; n < N; ++n) {
+        size_t source = static_cast<size_t>(bitReverse[n]) * N;
+        std::copy(fieldR + source, fieldR + source + width, re + n * width);
+        std::copy(fieldI + source, fieldI + source + width, im + n * width);
+    }
+    inverseFftStrip(re, im);
+    for (int n = 0; n < N; ++n) {
+        std::copy(re + n * width, re + (n + 1) * width, fieldR + static_cast<size_t>(n) * N);
+        std::copy(im + n * width, im + (n + 1) * width, fieldI + static_cast<size_t>(n) * N);
+    }
+}
+
+void FftOceanSimulator::synthesize() {
+    threadPool.parallelFor(0, N, [this](int rowBegin, int rowEnd) { evaluateSpectrum(rowBegin, rowEnd); });
+
+    int strips = N / columnStrip;
+    threadPool.run(fieldCount * strips, [this, strips](int task, int worker) {
+        float* re = &stripScratch[static_cast<size_t>(worker) * 2 * N * columnStrip];
+        inverseFftRows(task / strips, (task % strips) * columnStrip, re, re + N * columnStrip);
+    });
+    threadPool.run(fieldCount * strips, [this, strips](int task, int worker) {
+        float* re = &stripScratch[static_cast<size_t>(worker) * 2 * N * columnStrip];
+        inverseFftColumns(task / strips, (task % strips) * columnStrip, re, re + N * columnStrip);
+    });
+
+    threadPool.parallelFor(0, N, [this](int rowBegin, int rowEnd) {
+        for (int r = rowBegin; r < rowEnd; ++r) {
+            size_t row = static_cast<size_t>(r) * N;
+            for (int c = 0; c < N; ++c) {
+                size_t i = row + c;
+                displacement[i * 2 + 0] = fieldCount > 2 ? fieldIm[1][i] : 0.0f;
+                displacement[i * 2 + 1] = fieldCount > 2 ? fieldRe[2][i] : 0.0f;
+            }
+        }
+        if (normalMapRequested) fillNormalmap(rowBegin, rowEnd);
+    });
+}
+
+void FftOceanSimulator::fillNormalmap(int rowBegin, int rowEnd) {
+    for (int r = rowBegin; r < rowEnd; ++r) {
+        size_t row = static_cast<size_t>(r) * N;
+        for (int c = 0; c < N; ++c) {
+            size_t i = row + c;
+            glm::vec3 n = glm::normalize(glm::vec3(-fieldIm[0][i], 1.0f, -fieldRe[1][i]));
+            normalmapData[i * 4 + 0] = static_cast<unsigned char>((n.x * 0.5f + 0.5f) * 255.0f);
+            normalmapData[i * 4 + 1] = static_cast<unsigned char>((n.y * 0.5f + 0.5f) * 255.0f);
+            normalmapData[i * 4 + 2] = static_cast<unsigned char>((n.z * 0.5f + 0.5f) * 255.0f);
+            normalmapData[i * 4 + 3] = 255;
+        }
+    }
+}
+
+void FftOceanSimulator::uploadTextures() {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, heightmapTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, N, N, GL_RED, GL_FLOAT, fieldRe[0].data());
+    glBindTexture(GL_TEXTURE_2D, displacementTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, N, N, GL_RG, GL_FLOAT, displacement.data());
+    if (normalMapRequested) {
+        glBindTexture(GL_TEXTURE_2D, normalmapTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, N, N, GL_RGBA, GL_UNSIGNED_BYTE, normalmapData.data());
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void FftOceanSimulator::updateSimulation(int substeps) {
+    // The spectrum is a closed-form function of time, so nothing changes without a step.
+    if (substeps <= 0) return;
+    time += static_cast<double>(substeps) * stepSeconds;
+    {
+        DUCK_PROFILE_CPU("sim step");
+        synthesize();
+    }
+    DUCK_PROFILE_GPU("texture upload");
+    uploadTextures();
+}
+
+void FftOceanSimulator::locate(float worldX, float worldZ, int& r0, int& c0, int& r1, int& c1, float& tx,
+                               float& ty) const {
+    // Texel centres, as GL_LINEAR with GL_REPEAT samples them over the patch.
+    float c_float = (worldX + size / 2.0f) / size * N - 0.5f;
+    float r_float = (worldZ + size / 2.0f) / size * N - 0.5f;
+    float c_floor = std::floor(c_float);
+    float r_floor = std::floor(r_float);
+    tx = c_float - c_floor;
+    ty = r_float - r_floor;
+    c0 = ((static_cast<int>(c_floor) % N) + N) % N;
+    r0 = ((static_cast<int>(r_floor) % N) + N) % N;
+    c1 = (c0 + 1) % N;
+    r1 = (r0 + 1) % N;
+}
+
+float FftOceanSimulator::getHeightAt(float worldX, float worldZ) const {
+    int r0, c0, r1, c1;
+    float tx, ty;
+    locate(worldX, worldZ, r0, c0, r1, c1, tx, ty);
+
+    const std::vector<float>& heights = fieldRe[0];
+    float h00 = heights[static_cast<size_t>(r0) * N + c0];
+    float h10 = heights[static_cast<size_t>(r0) * N + c1];
+    float h01 = heights[static_cast<size_t>(r1) * N + c0];
+    float h11 = heights[static_cast<size_t>(r1) * N + c1];
+
+    float h_r0 = h00 * (1.0f - tx) + h10 * tx;
+    float h_r1 = h01 * (1.0f - tx) + h11 * tx;
+    return h_r0 * (1.0f - ty) + h_r1 * ty;
+}
+
+glm::vec3 FftOceanSimulator::getNormalAt(float worldX, float worldZ) const {
+    int r0, c0, r1, c1;
+    float tx, ty;
+    locate(worldX, worldZ, r0, c0, r1, c1, tx, ty);
+
+    size_t i00 = static_cast<size_t>(r0) * N + c0;
+    size_t i10 = static_cast<size_t>(r0) * N + c1;
+    size_t i01 = static_cast<size_t>(r1) * N + c0;
+    size_t i11 = static_cast<size_t>(r1) * N + c1;
+    float w00 = (1.0f - tx) * (1.0f - ty);
+    float w10 = tx * (1.0f - ty);
+    float w01 = (1.0f - tx) * ty;
+    float w11 = tx * ty;
+
+    const std::vector<float>& slopeX = fieldIm[0];
+    const std::vector<float>& slopeZ = fieldRe[1];
+    float sx = slopeX[i00] * w00 + slopeX[i10] * w10 + slopeX[i01] * w01 + slopeX[i11] * w11;
+    float sz = slopeZ[i00] * w00 + slopeZ[i10] * w10 + slopeZ[i01] * w01 + slopeZ[i11] * w11;
+    return glm::normalize(glm::vec3(-sx, 1.0f, -sz));
+}
@@ -0,0 +1,143 @@
+#ifndef FFTOCEANSIMULATOR_H
+#define FFTOCEANSIMULATOR_H
+
+#include <vector>
+#include <random>
+#include <glad.h>
+#include <glm/glm.hpp>
+#include "ThreadPool.h"
+#include "WaterSurface.h"
+
+struct WaterKernels;
+
+// Directional wave spectrum the ocean is drawn from.
+enum class OceanSpectrum {
+    // Tessendorf's Phillips spectrum with cos^2 spreading around the wind.
+    // Scaled so the whole spectrum has the significant wave height of a fully
+    // developed Pierson-Moskowitz sea at that wind speed.
+    Phillips,
+    // JONSWAP for a sea still growing over `fetch` metres, with cos^2
+    // spreading in the wind direction only.
+    Jonswap
+};
+
+struct OceanSpectrumParameters {
+    OceanSpectrum spectrum = OceanSpectrum::Phillips;
+    // Wind speed at 10 m in m/s.
+    float windSpeed = 4.0f;
+    glm::vec2 windDirection = glm::vec2(1.0f, 0.0f);
+    // Distance over which the wind has blown, in metres (Jonswap only).
+    float fetch = 10000.0f;
+    // Multiplies every height, slope and displacement.
+    float amplitude = 1.0f;
+    // Scale of the horizontal displacement that sharpens the crests; zero turns it off.
+    float choppiness = 1.0f;
+    unsigned int seed = 1;
+};
+
+// Deep-water ocean synthesized from a wave spectrum (Tessendorf) instead of
+// integrated from the wave equation. The N x N complex amplitudes are drawn
+// once; every update advances their phases with the dispersion relation and
+// turns them into heights, slopes and horizontal displacement with radix-2
+// inverse FFTs, so a frame costs O(N^2 log N) whatever the sea state. The
+// patch is physicalSize metres wide and repeats seamlessly, and its textures
+// use GL_REPEAT so it can be tiled.
+//
+// The FFTs work on split real/imaginary arrays, 16 rows or 16 columns at a
+// time: each group is copied into a per-worker strip where the 16 transforms
+// sit side by side, so every butterfly is a WaterKernels::butterflyRows over
+// one contiguous cache line.
+class FftOceanSimulator : public WaterSurface {
+public:
+    // gridN is rounded up to a power of two. Every update advances the ocean
+    // by `substeps` times stepSeconds of simulated time.
+    FftOceanSimulator(int gridN = 256, float physicalSize = 2.0f, int threadCount = 0,
+                      const OceanSpectrumParameters& parameters = OceanSpectrumParameters(),
+                      float stepSeconds = 1.0f / 60.0f);
+    ~FftOceanSimulator() override;
+
+    const char* getBackendName() const override { return "fft"; }
+
+    void updateSimulation(int substeps = 1) override;
+
+    // The ocean has no local state to disturb, so these do nothing.
+    void createRaindrop(int = 0) override {}
+    void createDisturbance(float, float, float, int = 0) override {}
+
+    // Sampled at undisplaced grid positions, wrapping around the patch, so
+    // they match the heightmap the renderer reads.
+    float getHeightAt(float worldX, float worldZ) const override;
+    glm::vec3 getNormalAt(float worldX, float worldZ) const override;
+
+    // R32F heights in metres.
+    GLuint getHeightmapTextureID() const override { return heightmapTexture; }
+    // RG32F horizontal (x, z) displacement of every texel in metres.
+    GLuint getDisplacementTextureID() const override { return displacementTexture; }
+    // RGBA8 normals from the spectral slopes, only computed after the first call.
+    GLuint getNormalmapTextureID() override;
+
+    float getHeightmapScale() const override { return 1.0f; }
+    bool hasMetricHeights() const override { return true; }
+    int getGridN() const override { return N; }
+    double getTime() const { return time; }
+    int getThreadCount() const { return threadPool.getThreadCount(); }
+
+private:
+    int N;
+    float size;
+    OceanSpectrumParameters parameters;
+    float stepSeconds;
+    double time = 0.0;
+    int fieldCount;
+
+    const WaterKernels* kernels;
+    ThreadPool threadPool;
+
+    // h0(k) and conj(h0(-k)) of every wave vector, and its angular frequency.
+    std::vector<float> h0Re;
+    std::vector<float> h0Im;
+    std::vector<float> h0ConjRe;
+    std::vector<float> h0ConjIm;
+    std::vector<float> omega;
+
+    // Inverse FFT twiddles, exp(i pi j / span) at [span + j], and the bit-reversal permutation.
+    std::vector<float> twiddleRe;
+    std::vector<float> twiddleIm;
+    std::vector<int> bitReverse;
+
+    // Two real outputs are packed into each complex field:
+    // 0 = height + i slope x, 1 = slope z + i displacement x, 2 = displacement z.
+    std::vector<float> fieldRe[3];
+    std::vector<float> fieldIm[3];
+
+    // Real and imaginary strip of N x columnStrip values per worker.
+    std::vector<float> stripScratch;
+
+    std::vector<float> displacement;
+    std::vector<unsigned char> normalmapData;
+    bool normalMapRequested = false;
+
+    GLuint heightmapTexture;
+    GLuint displacementTexture;
+    GLuint normalmapTexture = 0;
+
+    // Transforms done side by side by one task, one cache line of floats.
+    static const int columnStrip = 16;
+    // 16 KB of strip rows, run through the short-span stages together.
+    static constexpr int stageBlockRows = 128;
+
+    float spectrumDensity(float kx, float kz) const;
+    void initializeSpectrum();
+    void evaluateSpectrum(int rowBegin, int rowEnd);
+    void inverseFftStrip(float* re, float* im) const;
+    void butterflyStage(float* re, float* im, int span, int rowBegin, int rowEnd) const;
+    void inverseFftRows(int field, int rowBegin, float* re, float* im);
+    void inverseFftColumns(int field, int colBegin, float* re, float* im);
+    void synthesize();
+    // Normal map texels of rows [rowBegin, rowEnd) from the slope fields.
+    void fillNormalmap(int rowBegin, int rowEnd);
+    void uploadTextures();
+    void locate(float worldX, float worldZ, int& r0, int& c0, int& r1, int& c1, float& tx, float& ty) const;
+};
+
+#endif // FFTOCEANSIMULATOR_H
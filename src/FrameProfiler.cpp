@@ -0,0 +1,180 @@
+#include "FrameProfiler.h"
+
+#ifdef DUCK_PROFILE
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+FrameProfiler& FrameProfiler::instance() {
+    static FrameProfiler profiler;
+    return profiler;
+}
+
+void FrameProfiler::RollingStats::add(float milliseconds) {
+    if (samples.size() < windowSize) {
+        samples.push_back(milliseconds);
+        return;
+    }
+    samples[next] = milliseconds;
+    next = (next + 1) % windowSize;
+}
+
+float FrameProfiler::RollingStats::mean() const {
+    double sum = 0.0;
+    for (float s : samples) sum += s;
+    return samples.empty() ? 0.0f : static_cast<float>(sum / samples.size());
+}
+
+float FrameProfiler::RollingStats::percentile(float p) const {
+    if (samples.empty()) return 0.0f;
+    std::vector<float> sorted(samples);
+    size_t rank = static_cast<size_t>(p * (sorted.size() - 1) + 0.5f);
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+}
+
+int FrameProfiler::stage(const char* name) {
+    for (size_t i = 0; i < stages.size(); ++i) {
+        if (stages[i].name == name) return static_cast<int>(i);
+    }
+    stages.emplace_back();
+    stages.back().name = name;
+    stages.back().traceName = name;
+    return static_cast<int>(stages.size() - 1);
+}
+
+void FrameProfiler::beginCpu(int stage) {
+    stages[stage].cpuStart = Clock::now();
+}
+
+void FrameProfiler::endCpu(int stage) {
+    Stage& s = stages[stage];
+    Clock::time_point now = Clock::now();
+    s.cpuFrameMs += std::chrono::duration<double, std::milli>(now - s.cpuStart).count();
+    s.cpuUsed = true;
+    TraceRecorder::instance().record(s.traceName, s.cpuStart, now);
+}
+
+void FrameProfiler::beginGpu(int stage) {
+    beginCpu(stage);
+    // GL_TIME_ELAPSED queries cannot nest; an inner scope is timed on the CPU only.
+    if (activeGpuStage >= 0) return;
+    QuerySlot& slot = slots[frameIndex % gpuLatency];
+    if (slot.used == slot.queries.size()) {
+        GLuint query;
+        glGenQueries(1, &query);
+        slot.queries.push_back(query);
+        slot.stages.push_back(stage);
+    }
+    slot.stages[slot.used] = stage;
+    glBeginQuery(GL_TIME_ELAPSED, slot.queries[slot.used]);
+    ++slot.used;
+    activeGpuStage = stage;
+}
+
+void FrameProfiler::endGpu(int stage) {
+    if (activeGpuStage == stage) {
+        glEndQuery(GL_TIME_ELAPSED);
+        activeGpuStage = -1;
+    }
+    endCpu(stage);
+}
+
+void FrameProfiler::collectGpu(QuerySlot& slot) {
+    if (slot.used == 0) return;
+    // Queries finish in order, so the last one being ready means all are.
+    GLint available = 0;
+    glGetQueryObjectiv(slot.queries[slot.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        ++droppedGpuFrames;
+        slot.used = 0;
+        return;
+    }
+
+    std::vector<double> frameMs(stages.size(), 0.0);
+    for (size_t i = 0; i < slot.used; ++i) {
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &nanoseconds);
+        frameMs[slot.stages[i]] += nanoseconds * 1e-6;
+        stages[slot.stages[i]].gpuUsed = true;
+    }
+    for (size_t i = 0; i < stages.size(); ++i) {
+        if (!stages[i].gpuUsed) continue;
+        stages[i].gpu.add(static_cast<float>(frameMs[i]));
+        stages[i].gpuUsed = false;
+    }
+    slot.used = 0;
+}
+
+void FrameProfiler::endFrame() {
+    Clock::time_point now = Clock::now();
+    if (frameStage < 0) frameStage = stage("frame");
+    if (frameStarted) {
+        stages[frameStage].cpuFrameMs = std::chrono::duration<double, std::milli>(now - frameStart).count();
+        stages[frameStage].cpuUsed = true;
+        TraceRecorder::instance().record("frame", frameStart, now);
+    } else {
+        lastReport = now;
+    }
+    frameStart = now;
+    frameStarted = true;
+
+    for (Stage& s : stages) {
+        if (!s.cpuUsed) continue;
+        s.cpu.add(static_cast<float>(s.cpuFrameMs));
+        s.cpuFrameMs = 0.0;
+        s.cpuUsed = false;
+    }
+
+    // The slot the next frame reuses holds the oldest queries still out.
+    ++frameIndex;
+    collectGpu(slots[frameIndex % gpuLatency]);
+
+    if (std::chrono::duration<double>(now - lastReport).count() >= reportIntervalSeconds) {
+        printReport(std::cout);
+        lastReport = now;
+    }
+}
+
+void FrameProfiler::printReport(std::ostream& out) const {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << "Frame profile, last " << windowSize << " frames (ms):" << std::endl;
+    out << std::left << std::setw(16) << "stage" << std::right
+        << std::setw(9) << "cpu avg" << std::setw(8) << "p50" << std::setw(8) << "p95" << std::setw(8) << "p99"
+        << std::setw(10) << "gpu avg" << std::setw(8) << "p50" << std::setw(8) << "p95" << std::setw(8) << "p99"
+        << std::endl;
+    out << std::fixed << std::setprecision(3);
+    for (const Stage& s : stages) {
+        out << std::left << std::setw(16) << s.name << std::right;
+        const RollingStats* both[2] = {&s.cpu, &s.gpu};
+        for (int i = 0; i < 2; ++i) {
+            const RollingStats& stats = *both[i];
+            out << std::setw(i == 0 ? 9 : 10);
+            if (stats.empty()) {
+                out << "-" << std::setw(8) << "-" << std::setw(8) << "-" << std::setw(8) << "-";
+                continue;
+            }
+            out << stats.mean() << std::setw(8) << stats.percentile(0.5f) << std::setw(8) << stats.percentile(0.95f)
+                << std::setw(8) << stats.percentile(0.99f);
+        }
+        out << std::endl;
+    }
+    if (droppedGpuFrames > 0) {
+        out << "GPU timings dropped for " << droppedGpuFrames << " frames (results not ready in time)" << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void FrameProfiler::shutdown() {
+    for (QuerySlot& slot : slots) {
+        if (!slot.queries.empty()) glDeleteQueries(static_cast<GLsizei>(slot.queries.size()), slot.queries.data());
+        slot.queries.clear();
+        slot.stages.clear();
+        slot.used = 0;
+    }
+}
+
+#endif // DUCK_PROFILE
@@ -0,0 +1,138 @@
+#ifndef FRAMEPROFILER_H
+#define FRAMEPROFILER_H
+
+// Per-stage frame timings (see README.md). Only built with DUCK_PROFILE
+// defined (CMake option DUCK_FRAME_PROFILER); otherwise every macro below
+// expands to nothing and the frame loop carries no trace of it.
+//
+//   DUCK_PROFILE_CPU("name")  times the rest of the enclosing scope on the CPU.
+//   DUCK_PROFILE_GPU("name")  also times the GL commands issued in it with a
+//                             GL_TIME_ELAPSED query. GPU scopes must not nest.
+//   DUCK_PROFILE_END_FRAME()  closes the frame, once per loop iteration.
+//   DUCK_PROFILE_REPORT()     prints the table to std::cout.
+//   DUCK_PROFILE_SHUTDOWN()   releases the queries; needs the GL context.
+//
+// While a TraceRecorder capture runs, every CPU scope and frame is also
+// written to the timeline.
+
+#ifdef DUCK_PROFILE
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <glad.h>
+#include "TraceRecorder.h"
+
+class FrameProfiler {
+public:
+    static FrameProfiler& instance();
+
+    // Stages are registered by name on first use and reported in that order.
+    // Scopes with the same name add up within a frame.
+    int stage(const char* name);
+
+    void beginCpu(int stage);
+    void endCpu(int stage);
+    void beginGpu(int stage);
+    void endGpu(int stage);
+
+    // Records this frame's CPU times and the GPU times of the frame before,
+    // and prints the report every reportIntervalSeconds.
+    void endFrame();
+    void printReport(std::ostream& out) const;
+    void shutdown();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // The last `windowSize` per-frame totals of one stage, in milliseconds.
+    class RollingStats {
+    public:
+        void add(float milliseconds);
+        bool empty() const { return samples.empty(); }
+        float mean() const;
+        float percentile(float p) const;
+
+    private:
+        std::vector<float> samples;
+        size_t next = 0;
+    };
+
+    struct Stage {
+        std::string name;
+        // The name passed to stage(), kept for the trace.
+        const char* traceName;
+        RollingStats cpu;
+        RollingStats gpu;
+        Clock::time_point cpuStart;
+        double cpuFrameMs = 0.0;
+        bool cpuUsed = false;
+        bool gpuUsed = false;
+    };
+
+    // Queries issued during one frame. Results are read gpuLatency - 1 frames
+    // later, right before the slot is reused, and dropped if not ready yet.
+    struct QuerySlot {
+        std::vector<GLuint> queries;
+        std::vector<int> stages;
+        size_t used = 0;
+    };
+
+    static const size_t windowSize = 600;
+    static constexpr int gpuLatency = 2;
+    static constexpr double reportIntervalSeconds = 5.0;
+
+    std::vector<Stage> stages;
+    QuerySlot slots[gpuLatency];
+    long long frameIndex = 0;
+    int activeGpuStage = -1;
+    long long droppedGpuFrames = 0;
+    int frameStage = -1;
+    Clock::time_point frameStart;
+    Clock::time_point lastReport;
+    bool frameStarted = false;
+
+    void collectGpu(QuerySlot& slot);
+};
+
+class CpuProfileScope {
+public:
+    explicit CpuProfileScope(int stage) : stage(stage) { FrameProfiler::instance().beginCpu(stage); }
+    ~CpuProfileScope() { FrameProfiler::instance().endCpu(stage); }
+
+private:
+    int stage;
+};
+
+class GpuProfileScope {
+public:
+    explicit GpuProfileScope(int stage) : stage(stage) { FrameProfiler::instance().beginGpu(stage); }
+    ~GpuProfileScope() { FrameProfiler::instance().endGpu(stage); }
+
+private:
+    int stage;
+};
+
+#define DUCK_PROFILE_JOIN2(a, b) a##b
+#define DUCK_PROFILE_JOIN(a, b) DUCK_PROFILE_JOIN2(a, b)
+#define DUCK_PROFILE_SCOPE(ScopeType, name) \
+    static const int DUCK_PROFILE_JOIN(duckProfileStage, __LINE__) = FrameProfiler::instance().stage(name); \
+    ScopeType DUCK_PROFILE_JOIN(duckProfileScope, __LINE__)(DUCK_PROFILE_JOIN(duckProfileStage, __LINE__))
+#define DUCK_PROFILE_CPU(name) DUCK_PROFILE_SCOPE(CpuProfileScope, name)
+#define DUCK_PROFILE_GPU(name) DUCK_PROFILE_SCOPE(GpuProfileScope, name)
+#define DUCK_PROFILE_END_FRAME() FrameProfiler::instance().endFrame()
+#define DUCK_PROFILE_REPORT() FrameProfiler::instance().printReport(std::cout)
+#define DUCK_PROFILE_SHUTDOWN() FrameProfiler::instance().shutdown()
+
+#else
+
+#define DUCK_PROFILE_CPU(name)
+#define DUCK_PROFILE_GPU(name)
+#define DUCK_PROFILE_END_FRAME()
+#define DUCK_PROFILE_REPORT()
+#define DUCK_PROFILE_SHUTDOWN()
+
+#endif // DUCK_PROFILE
+
+#endif // FRAMEPROFILER_H
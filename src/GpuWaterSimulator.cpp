@@ -0,0 +1,247 @@
+#include "GpuWaterSimulator.h"
+#include "WaterSolver.h"
+#include "FrameProfiler.h"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+GpuWaterSimulator::GpuWaterSimulator(int gridN, float physicalSize) :
+    N(gridN),
+    size(physicalSize),
+    stepShader("shaders/water_step.comp"),
+    normalShader("shaders/water_normals.comp"),
+    impulseShader("shaders/water_impulses.comp"),
+    current(0),
+    normalMapRequested(false),
+    rng(std::random_device{}()),
+    distN(0, gridN),
+    distProb(0.0f, 1.0f) {
+
+    h = size / (static_cast<float>(N));
+    dt_sim = (1.0f / static_cast<float>(N));
+
+    float C_const = 1.0f;
+    A_const = (C_const * C_const * dt_sim * dt_sim) / (h * h);
+    B_const = 2.0f - 4.0f * A_const;
+
+    std::cout << "GpuWaterSim N=" << N << ", size=" << size << ", A=" << A_const << ", B=" << B_const
+              << ", renderer: " << glGetString(GL_RENDERER) << std::endl;
+
+    setupResources();
+}
+
+GpuWaterSimulator::~GpuWaterSimulator() {
+    glDeleteTextures(2, heightTextures);
+    glDeleteTextures(1, &normalmapTexture);
+    glDeleteBuffers(1, &dampingBuffer);
+    glDeleteBuffers(1, &impulseBuffer);
+}
+
+void GpuWaterSimulator::setupResources() {
+    glGenTextures(2, heightTextures);
+    for (int i = 0; i < 2; ++i) {
+        glBindTexture(GL_TEXTURE_2D, heightTextures[i]);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, N, N);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        float zero = 0.0f;
+        glClearTexImage(heightTextures[i], 0, GL_RED, GL_FLOAT, &zero);
+    }
+
+    glGenTextures(1, &normalmapTexture);
+    glBindTexture(GL_TEXTURE_2D, normalmapTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, N, N);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    unsigned char flat[4] = {127, 255, 127, 255};
+    glClearTexImage(normalmapTexture, 0, GL_RGBA, GL_UNSIGNED_BYTE, flat);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    std::vector<float> edgeDamping = WaterSolver::edgeDampingProfile(N, size);
+    glGenBuffers(1, &dampingBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, dampingBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, edgeDamping.size() * sizeof(float), edgeDamping.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &impulseBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, impulseBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, impulseCapacity * sizeof(Impulse), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    stepShader.use();
+    stepShader.setInt("uN", N);
+    stepShader.setFloat("uA", A_const);
+    stepShader.setFloat("uB", B_const);
+    normalShader.use();
+    normalShader.setInt("uN", N);
+    normalShader.setFloat("uTwoH", 2.0f * h);
+    glUseProgram(0);
+}
+
+void GpuWaterSimulator::dispatchGrid() {
+    GLuint groups = static_cast<GLuint>((N + workGroupSize - 1) / workGroupSize);
+    glDispatchCompute(groups, groups, 1);
+}
+
+void GpuWaterSimulator::queueImpulse(int c, int r, float magnitude, int substep) {
+    size_t slot = static_cast<size_t>(std::max(0, substep));
+    if (pendingImpulses.size() <= slot) pendingImpulses.resize(slot + 1);
+    pendingImpulses[slot].push_back({c, r, magnitude, 0.0f});
+}
+
+void GpuWaterSimulator::applyImpulses(std::vector<Impulse>& impulses) {
+    if (impulses.empty()) return;
+
+    impulseShader.use();
+    glBindImageTexture(0, heightTextures[current], 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, impulseBuffer);
+    for (size_t first = 0; first < impulses.size(); first += impulseCapacity) {
+        int count = static_cast<int>(std::min(impulses.size() - first, static_cast<size_t>(impulseCapacity)));
+        // glBufferSubData is ordered after the previous dispatch that read the buffer.
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, impulseBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(Impulse), &impulses[first]);
+        impulseShader.setInt("uImpulseCount", count);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    impulses.clear();
+}
+
+void GpuWaterSimulator::updateSimulation(int substeps) {
+    if (substeps <= 0) return;
+    // Disturbances queued past the last substep fall on the last one.
+    for (size_t s = substeps; s < pendingImpulses.size(); ++s) {
+        std::vector<Impulse>& last = pendingImpulses[substeps - 1];
+        last.insert(last.end(), pendingImpulses[s].begin(), pendingImpulses[s].end());
+        pendingImpulses[s].clear();
+    }
+
+    for (int s = 0; s < substeps; ++s) {
+        if (static_cast<size_t>(s) < pendingImpulses.size() && !pendingImpulses[s].empty()) {
+            DUCK_PROFILE_GPU("disturbances");
+            applyImpulses(pendingImpulses[s]);
+        }
+        {
+            DUCK_PROFILE_GPU("sim step");
+            stepShader.use();
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, dampingBuffer);
+            int previous = 1 - current;
+            glBindImageTexture(0, heightTextures[current], 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+            glBindImageTexture(1, heightTextures[previous], 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+            dispatchGrid();
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            current = previous;
+        }
+    }
+
+    if (normalMapRequested) {
+        DUCK_PROFILE_GPU("normals");
+        normalShader.use();
+        glBindImageTexture(0, heightTextures[current], 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, normalmapTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        dispatchGrid();
+    }
+
+    // The next frame samples both maps in the vertex shader; the readbacks use glGetTextureSubImage.
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    glUseProgram(0);
+}
+
+void GpuWaterSimulator::createRaindrop(int substep) {
+    if (distProb(rng) < raindropProbability) {
+        int r = distN(rng);
+        int c = distN(rng);
+
+        r = std::max(1, std::min(N - 2, r));
+        c = std::max(1, std::min(N - 2, c));
+
+        queueImpulse(c, r, raindropMagnitude, substep);
+    }
+}
+
+void GpuWaterSimulator::createDisturbance(float worldX, float worldZ, float magnitude, int substep) {
+    float normX = (worldX + size / 2.0f) / size;
+    float normZ = (worldZ + size / 2.0f) / size;
+
+    int c = static_cast<int>(normX * (N - 1));
+    int r = static_cast<int>(normZ * (N - 1));
+
+    r = std::max(1, std::min(N - 2, r));
+    c = std::max(1, std::min(N - 2, c));
+
+    queueImpulse(c, r, magnitude, substep);
+}
+
+void GpuWaterSimulator::locate(float worldX, float worldZ, int& r0, int& c0, float& tx, float& ty) const {
+    float normX = (worldX + size / 2.0f) / size;
+    float normZ = (worldZ + size / 2.0f) / size;
+
+    float c_float = normX * (N - 1);
+    float r_float = normZ * (N - 1);
+
+    r0 = static_cast<int>(floor(r_float));
+    c0 = static_cast<int>(floor(c_float));
+
+    r0 = std::max(0, std::min(N - 2, r0));
+    c0 = std::max(0, std::min(N - 2, c0));
+
+    tx = c_float - c0;
+    ty = r_float - r0;
+}
+
+void GpuWaterSimulator::readHeights(int rowBegin, int rowEnd, int colBegin, int colEnd, float* dst) const {
+    int rows = rowEnd - rowBegin;
+    int cols = colEnd - colBegin;
+    glGetTextureSubImage(heightTextures[current], 0, colBegin, rowBegin, 0, cols, rows, 1,
+                         GL_RED, GL_FLOAT, rows * cols * static_cast<GLsizei>(sizeof(float)), dst);
+}
+
+float GpuWaterSimulator::getHeightAt(float worldX, float worldZ) const {
+    int r0, c0;
+    float tx, ty;
+    locate(worldX, worldZ, r0, c0, tx, ty);
+
+    float texels[4];
+    readHeights(r0, r0 + 2, c0, c0 + 2, texels);
+
+    return (1 - tx) * (1 - ty) * texels[0] +
+           tx * (1 - ty) * texels[1] +
+           (1 - tx) * ty * texels[2] +
+           tx * ty * texels[3];
+}
+
+glm::vec3 GpuWaterSimulator::getNormalAt(float worldX, float worldZ) const {
+    int r0, c0;
+    float tx, ty;
+    locate(worldX, worldZ, r0, c0, tx, ty);
+
+    // The 2x2 cells plus their clamped neighbours, so the normals come out in
+    // fp32 exactly like WaterSimulator's instead of from the RGBA8 normal map.
+    int rowBegin = std::max(r0 - 1, 0), rowEnd = std::min(r0 + 3, N);
+    int colBegin = std::max(c0 - 1, 0), colEnd = std::min(c0 + 3, N);
+    int cols = colEnd - colBegin;
+    float patch[16];
+    readHeights(rowBegin, rowEnd, colBegin, colEnd, patch);
+
+    auto height = [&](int r, int c) {
+        r = std::max(0, std::min(N - 1, r));
+        c = std::max(0, std::min(N - 1, c));
+        return patch[(r - rowBegin) * cols + (c - colBegin)];
+    };
+
+    float weights[4] = {(1 - tx) * (1 - ty), tx * (1 - ty), (1 - tx) * ty, tx * ty};
+    glm::vec3 interpolatedNormal(0.0f);
+    for (int i = 0; i < 4; ++i) {
+        int r = r0 + i / 2;
+        int c = c0 + i % 2;
+        float grad_x = (height(r, c + 1) - height(r, c - 1)) / (2.0f * h);
+        float grad_z = (height(r + 1, c) - height(r - 1, c)) / (2.0f * h);
+        interpolatedNormal += weights[i] * glm::normalize(glm::vec3(-grad_x, 1.0f, -grad_z));
+    }
+
+    return glm::normalize(interpolatedNormal);
+}
@@ -0,0 +1,87 @@
+#ifndef GPUWATERSIMULATOR_H
+#define GPUWATERSIMULATOR_H
+
+#include <vector>
+#include <glad.h>
+#include <glm/glm.hpp>
+#include <random>
+#include "Shader.h"
+#include "WaterSurface.h"
+
+// Same wave equation as WaterSimulator, run in compute shaders (GL 4.3+).
+// The two height levels are R32F textures used in ping-pong: each step writes
+// the new level over the oldest one and swaps the roles. Disturbances are
+// queued on the CPU and uploaded as one SSBO batch per frame, so the heights
+// never travel over the bus except for the explicit readbacks below.
+class GpuWaterSimulator : public WaterSurface {
+public:
+    GpuWaterSimulator(int gridN = 256, float physicalSize = 2.0f);
+    ~GpuWaterSimulator() override;
+
+    const char* getBackendName() const override { return "gpu"; }
+
+    // Advances `substeps` timesteps, each after its queued disturbances, and,
+    // once someone asked for it, rebuilds the normal map. Only records GL commands.
+    void updateSimulation(int substeps = 1) override;
+    void createRaindrop(int substep = 0) override;
+
+    void createDisturbance(float worldX, float worldZ, float magnitude, int substep = 0) override;
+
+    // These read a few height texels back from the GPU and therefore stall
+    // until every queued step has finished. Avoid calling them every frame.
+    float getHeightAt(float worldX, float worldZ) const override;
+    glm::vec3 getNormalAt(float worldX, float worldZ) const override;
+
+    GLuint getHeightmapTextureID() const override { return heightTextures[current]; }
+    // The normal pass only runs after the first call.
+    GLuint getNormalmapTextureID() override { normalMapRequested = true; return normalmapTexture; }
+
+    float getHeightmapScale() const override { return 1.0f; }
+    int getGridN() const override { return N; }
+
+private:
+    struct Impulse {
+        int c;
+        int r;
+        float magnitude;
+        float padding;
+    };
+
+    int N;
+    float size;
+    float h;
+    float dt_sim;
+    float A_const;
+    float B_const;
+
+    Shader stepShader;
+    Shader normalShader;
+    Shader impulseShader;
+
+    GLuint heightTextures[2];
+    int current;
+    GLuint normalmapTexture;
+    bool normalMapRequested;
+    GLuint dampingBuffer;
+    GLuint impulseBuffer;
+
+    // Per substep of the next updateSimulation() call.
+    std::vector<std::vector<Impulse>> pendingImpulses;
+
+    std::mt19937 rng;
+    std::uniform_int_distribution<int> distN;
+    std::uniform_real_distribution<float> distProb;
+    const float raindropProbability = 0.05f;
+    const float raindropMagnitude = 1.1f;
+    const int impulseCapacity = 1024;
+    const int workGroupSize = 16;
+
+    void setupResources();
+    void queueImpulse(int c, int r, float magnitude, int substep);
+    void applyImpulses(std::vector<Impulse>& impulses);
+    void dispatchGrid();
+    void locate(float worldX, float worldZ, int& r0, int& c0, float& tx, float& ty) const;
+    void readHeights(int rowBegin, int rowEnd, int colBegin, int colEnd, float* dst) const;
+};
+
+#endif // GPUWATERSIMULATOR_H
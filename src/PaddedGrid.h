@@ -0,0 +1,112 @@
+#ifndef PADDEDGRID_H
+#define PADDEDGRID_H
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Allocator for 64-byte (cache line) aligned storage.
+template <typename T>
+struct CacheAlignedAllocator {
+    using value_type = T;
+    static constexpr std::size_t alignment = 64;
+
+    CacheAlignedAllocator() = default;
+    template <typename U>
+    CacheAlignedAllocator(const CacheAlignedAllocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignment)));
+    }
+    void deallocate(T* p, std::size_t) {
+        ::operator delete(p, std::align_val_t(alignment));
+    }
+
+    template <typename U>
+    bool operator==(const CacheAlignedAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const CacheAlignedAllocator<U>&) const { return false; }
+};
+
+using AlignedFloatVector = std::vector<float, CacheAlignedAllocator<float>>;
+
+// An n x n float grid with a one-cell ghost halo, laid out for the row
+// kernels. Column 0 of every row starts a cache line and rows are padded to a
+// multiple of 16 floats (one line, one AVX-512 vector), so a kernel can run
+// over getPaddedWidth() columns with aligned loads and no scalar tail. Rows
+// -1 and n and columns -1 and n are the ghost cells; fillHalo() copies the
+// edge cells into them, which turns the clamped neighbours at the border
+// into plain reads.
+//
+// Each row is preceded by a gap of 16 floats: the left ghost is the last
+// float of the gap, and when n is a multiple of 16 the right ghost of the
+// row above is the first one.
+class PaddedGrid {
+public:
+    static constexpr int lineFloats = 16;
+
+    PaddedGrid() = default;
+    PaddedGrid(const PaddedGrid&) = delete;
+    PaddedGrid& operator=(const PaddedGrid&) = delete;
+
+    // Every cell, ghost cell and pad float is set to `value`.
+    void resize(int gridN, float value = 0.0f) {
+        n = gridN;
+        paddedWidth = (n + lineFloats - 1) / lineFloats * lineFloats;
+        stride = strideFor(n);
+        values.assign(static_cast<size_t>(n + 2) * stride + lineFloats, value);
+        origin = values.data() + originOffset();
+    }
+    void fill(float value) { std::fill(values.begin(), values.end(), value); }
+
+    int size() const { return n; }
+    bool empty() const { return values.empty(); }
+    // Floats between the starts of two rows.
+    int getStride() const { return stride; }
+    // Columns a whole-vector kernel may write: n rounded up to a multiple of 16.
+    int getPaddedWidth() const { return paddedWidth; }
+    // Offset of cell (0, 0) in storage().
+    size_t originOffset() const { return originOffsetFor(n); }
+
+    // The same layout values for a grid of size gridN, without one.
+    static int strideFor(int gridN) { return (gridN + lineFloats - 1) / lineFloats * lineFloats + lineFloats; }
+    static size_t originOffsetFor(int gridN) { return static_cast<size_t>(strideFor(gridN)) + lineFloats; }
+
+    // r in [-1, n]; columns -1 .. n of the row are valid.
+    float* row(int r) { return origin + static_cast<std::ptrdiff_t>(r) * stride; }
+    const float* row(int r) const { return origin + static_cast<std::ptrdiff_t>(r) * stride; }
+    float& at(int r, int c) { return row(r)[c]; }
+    const float& at(int r, int c) const { return row(r)[c]; }
+
+    // The whole allocation, halo and padding included.
+    const AlignedFloatVector& storage() const { return values; }
+
+    // Ghost cells take the value of the edge cell next to them.
+    void fillHalo() {
+        for (int r = 0; r < n; ++r) {
+            float* cells = row(r);
+            cells[-1] = cells[0];
+            cells[n] = cells[n - 1];
+        }
+        std::copy_n(row(0) - 1, n + 2, row(-1) - 1);
+        std::copy_n(row(n - 1) - 1, n + 2, row(n) - 1);
+    }
+
+    void swap(PaddedGrid& other) {
+        std::swap(n, other.n);
+        std::swap(stride, other.stride);
+        std::swap(paddedWidth, other.paddedWidth);
+        values.swap(other.values);
+        std::swap(origin, other.origin);
+    }
+
+private:
+    int n = 0;
+    int stride = 0;
+    int paddedWidth = 0;
+    AlignedFloatVector values;
+    float* origin = nullptr;
+};
+
+#endif // PADDEDGRID_H
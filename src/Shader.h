@@ -14,6 +14,7 @@ public:
     unsigned int ID;
 
     Shader(const char* vertexPath, const char* fragmentPath);
+    explicit Shader(const char* computePath);
     ~Shader();
 
     void use();
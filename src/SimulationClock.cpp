@@ -0,0 +1,38 @@
+#include "SimulationClock.h"
+#include <algorithm>
+#include <cmath>
+
+SimulationClock::SimulationClock(double stepsPerSecond, int maxSteps) :
+    stepDuration(1.0),
+    maxStepsPerFrame(1),
+    accumulator(0.0),
+    stepCount(0),
+    droppedSteps(0) {
+    setStepsPerSecond(stepsPerSecond);
+    setMaxStepsPerFrame(maxSteps);
+}
+
+void SimulationClock::setStepsPerSecond(double stepsPerSecond) {
+    stepDuration = 1.0 / std::max(stepsPerSecond, 1e-3);
+    accumulator = std::min(accumulator, stepDuration * 0.999);
+}
+
+void SimulationClock::setMaxStepsPerFrame(int maxSteps) {
+    maxStepsPerFrame = std::max(maxSteps, 1);
+}
+
+int SimulationClock::advance(double frameSeconds) {
+    if (frameSeconds > 0.0) accumulator += frameSeconds;
+
+    double due = std::floor(accumulator / stepDuration);
+    int steps = static_cast<int>(std::min(due, static_cast<double>(maxStepsPerFrame)));
+    if (due > maxStepsPerFrame) {
+        // Running behind (breakpoint, window drag, slow node): forget the
+        // backlog but keep the fractional phase.
+        droppedSteps += static_cast<unsigned long long>(due) - maxStepsPerFrame;
+    }
+    accumulator -= due * stepDuration;
+    accumulator = std::max(accumulator, 0.0);
+    stepCount += steps;
+    return steps;
+}
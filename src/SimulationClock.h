@@ -0,0 +1,35 @@
+#ifndef SIMULATIONCLOCK_H
+#define SIMULATIONCLOCK_H
+
+// Fixed-timestep scheduler. Real frame time is accumulated and paid out in
+// whole simulation steps, so the solver runs at stepsPerSecond regardless of
+// the display rate. When a frame is too slow the catch-up is capped at
+// maxStepsPerFrame and the remaining backlog is dropped instead of piling up.
+class SimulationClock {
+public:
+    SimulationClock(double stepsPerSecond = 60.0, int maxStepsPerFrame = 4);
+
+    // Adds frameSeconds of real time and returns how many steps to run now.
+    int advance(double frameSeconds);
+
+    // Leftover time as a fraction of one step, in [0, 1). Rendering can blend
+    // the last two states with it.
+    float getAlpha() const { return static_cast<float>(accumulator / stepDuration); }
+
+    double getStepDuration() const { return stepDuration; }
+    int getMaxStepsPerFrame() const { return maxStepsPerFrame; }
+    unsigned long long getStepCount() const { return stepCount; }
+    unsigned long long getDroppedSteps() const { return droppedSteps; }
+
+    void setStepsPerSecond(double stepsPerSecond);
+    void setMaxStepsPerFrame(int maxSteps);
+
+private:
+    double stepDuration;
+    int maxStepsPerFrame;
+    double accumulator;
+    unsigned long long stepCount;
+    unsigned long long droppedSteps;
+};
+
+#endif // SIMULATIONCLOCK_H
@@ -0,0 +1,100 @@
+#include "ThreadPool.h"
+#include "TraceRecorder.h"
+#include <algorithm>
+#include <string>
+
+ThreadPool::ThreadPool(int requestedThreads) {
+    threadCount = requestedThreads > 0 ? requestedThreads : static_cast<int>(std::thread::hardware_concurrency());
+    threadCount = std::max(1, threadCount);
+
+    workers.reserve(threadCount - 1);
+    for (int i = 1; i < threadCount; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::drainTasks(const std::function<void(int, int)>* task, int taskCount, int workerIndex) {
+    DUCK_TRACE_SCOPE("pool job");
+    for (int i = nextTask.fetch_add(1); i < taskCount; i = nextTask.fetch_add(1)) {
+        (*task)(i, workerIndex);
+    }
+}
+
+void ThreadPool::workerLoop(int workerIndex) {
+    DUCK_TRACE_THREAD_NAME("pool worker " + std::to_string(workerIndex));
+    unsigned long long seenGeneration = 0;
+    for (;;) {
+        const std::function<void(int, int)>* task;
+        int taskCount;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCondition.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping) return;
+            seenGeneration = generation;
+            task = currentTask;
+            taskCount = currentTaskCount;
+            ++busyWorkers;
+        }
+
+        drainTasks(task, taskCount, workerIndex);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --busyWorkers;
+        }
+        doneCondition.notify_one();
+    }
+}
+
+void ThreadPool::run(int taskCount, const std::function<void(int, int)>& task) {
+    if (taskCount <= 0) return;
+    if (workers.empty() || taskCount == 1) {
+        for (int i = 0; i < taskCount; ++i) task(i, 0);
+        return;
+    }
+
+    {
+        // A worker that woke up late for the previous job may still be looking
+        // at the exhausted task counter; it has to leave before it is reset.
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCondition.wait(lock, [&] { return busyWorkers == 0; });
+        currentTask = &task;
+        currentTaskCount = taskCount;
+        nextTask.store(0);
+        ++generation;
+    }
+    wakeCondition.notify_all();
+
+    drainTasks(&task, taskCount, 0);
+
+    // Workers that have not woken up by now find the counter exhausted, so
+    // only the ones already registered as busy can still be running tasks.
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [&] { return busyWorkers == 0; });
+    currentTask = nullptr;
+    currentTaskCount = 0;
+}
+
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int, int)>& body) {
+    int count = end - begin;
+    if (count <= 0) return;
+
+    // A few ranges per thread keeps the load balanced when some threads start late.
+    int ranges = std::min(count, threadCount * 4);
+    run(ranges, [&](int range, int) {
+        int rangeBegin = begin + static_cast<int>(static_cast<long long>(count) * range / ranges);
+        int rangeEnd = begin + static_cast<int>(static_cast<long long>(count) * (range + 1) / ranges);
+        body(rangeBegin, rangeEnd);
+    });
+}
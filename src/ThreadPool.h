@@ -0,0 +1,51 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent fork-join pool. The calling thread takes part in every job as
+// worker 0, so a pool of one thread runs everything inline.
+class ThreadPool {
+public:
+    // threadCount <= 0 uses std::thread::hardware_concurrency().
+    explicit ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int getThreadCount() const { return threadCount; }
+
+    // Runs task(taskIndex, workerIndex) for every taskIndex in [0, taskCount)
+    // and returns when all of them have finished. workerIndex is in
+    // [0, getThreadCount()) and is unique among concurrently running tasks.
+    void run(int taskCount, const std::function<void(int, int)>& task);
+
+    // Splits [begin, end) into contiguous ranges and runs body(rangeBegin, rangeEnd) on them.
+    void parallelFor(int begin, int end, const std::function<void(int, int)>& body);
+
+private:
+    int threadCount;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    unsigned long long generation = 0;
+    bool stopping = false;
+
+    const std::function<void(int, int)>* currentTask = nullptr;
+    int currentTaskCount = 0;
+    std::atomic<int> nextTask{0};
+    int busyWorkers = 0;
+
+    void workerLoop(int workerIndex);
+    void drainTasks(const std::function<void(int, int)>* task, int taskCount, int workerIndex);
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,320 @@
+#include "TiledOceanSolver.h"
+#include "WaterKernels.h"
+#include <iostream>
+#include <algorithm>
+
+TiledOceanSolver::TiledOceanSolver(float tileSize_, int tileCells_, int viewRadius_, int residentBudget_,
+                                   int storedBudget_, int threadCount) :
+    tileSize(tileSize_),
+    tileCells(tileCells_),
+    stride(tileCells_ + 2),
+    viewRadius(viewRadius_),
+    windowTiles(2 * viewRadius_ + 1),
+    residentBudget(std::max(residentBudget_, (2 * viewRadius_ + 1) * (2 * viewRadius_ + 1))),
+    storedBudget(storedBudget_),
+    kernels(&selectWaterKernels()),
+    threadPool(threadCount),
+    rng(std::random_device{}()),
+    distPos(0.0f, 1.0f),
+    distProb(0.0f, 1.0f) {
+
+    // Waves cross half a cell per step, the same Courant number as a 2 m WaterSimulator pool.
+    h = tileSize / static_cast<float>(tileCells);
+    dt_sim = 0.5f * h;
+    A = (dt_sim * dt_sim) / (h * h);
+    B = 2.0f - 4.0f * A;
+    absorbing = (dt_sim - h) / (dt_sim + h);
+    dampingRow.assign(tileCells, damping);
+
+    setView(0.0f, 0.0f);
+
+    std::cout << "TiledOcean tile " << tileSize << " m, " << tileCells << "x" << tileCells << " cells, h=" << h
+              << ", dt_sim=" << dt_sim << ", view " << windowTiles << "x" << windowTiles
+              << " tiles, budget " << residentBudget << " resident / " << storedBudget << " stored tiles, threads: " << threadPool.getThreadCount() << std::endl;
+}
+
+bool TiledOceanSolver::inView(int tx, int tz) const {
+    return std::abs(tx - viewTx) <= viewRadius && std::abs(tz - viewTz) <= viewRadius;
+}
+
+TiledOceanSolver::Tile* TiledOceanSolver::findTile(int tx, int tz) const {
+    auto it = resident.find(tileKey(tx, tz));
+    return it == resident.end() ? nullptr : it->second.get();
+}
+
+TiledOceanSolver::Tile* TiledOceanSolver::pageIn(int tx, int tz, unsigned long long lastUsed) {
+    if (Tile* tile = findTile(tx, tz)) {
+        tile->lastUsed = std::max(tile->lastUsed, lastUsed);
+        return tile;
+    }
+
+    std::unique_ptr<Tile> tile(new Tile());
+    tile->tx = tx;
+    tile->tz = tz;
+    tile->current.assign(stride * stride, 0.0f);
+    tile->previous.assign(stride * stride, 0.0f);
+    tile->lastUsed = lastUsed;
+    tile->pagedIn = frame;
+
+    auto it = stored.find(tileKey(tx, tz));
+    if (it != stored.end()) {
+        for (int r = 0; r < tileCells; ++r) {
+            kernels->halfToFloatRow(&it->second.current[r * tileCells], &tile->current[at(r, 0)], tileCells);
+            kernels->halfToFloatRow(&it->second.previous[r * tileCells], &tile->previous[at(r, 0)], tileCells);
+        }
+        stored.erase(it);
+    }
+
+    Tile* raw = tile.get();
+    resident[tileKey(tx, tz)] = std::move(tile);
+    neighboursDirty = true;
+    return raw;
+}
+
+void TiledOceanSolver::evict(Tile* tile) {
+    // Calm tiles are all zero as far as anyone can tell, so nothing is kept.
+    if (!isCalm(*tile)) {
+        StoredTile& copy = stored[tileKey(tile->tx, tile->tz)];
+        copy.current.resize(tileCells * tileCells);
+        copy.previous.resize(tileCells * tileCells);
+        for (int r = 0; r < tileCells; ++r) {
+            kernels->floatToHalfRow(&tile->current[at(r, 0)], &copy.current[r * tileCells], tileCells);
+            kernels->floatToHalfRow(&tile->previous[at(r, 0)], &copy.previous[r * tileCells], tileCells);
+        }
+        copy.lastUsed = tile->lastUsed;
+
+        if (static_cast<int>(stored.size()) > storedBudget) {
+            auto oldest = stored.begin();
+            for (auto it = stored.begin(); it != stored.end(); ++it) {
+                if (it->second.lastUsed < oldest->second.lastUsed ||
+                    (it->second.lastUsed == oldest->second.lastUsed && it->first < oldest->first)) {
+                    oldest = it;
+                }
+            }
+            stored.erase(oldest);
+        }
+    }
+    resident.erase(tileKey(tile->tx, tile->tz));
+    neighboursDirty = true;
+}
+
+bool TiledOceanSolver::isCalm(const Tile& tile) const {
+    for (int r = 0; r < tileCells; ++r) {
+        const float* cur = &tile.current[at(r, 0)];
+        const float* prev = &tile.previous[at(r, 0)];
+        for (int c = 0; c < tileCells; ++c) {
+            if (std::abs(cur[c]) > sleepThreshold || std::abs(cur[c] - prev[c]) > sleepThreshold) return false;
+        }
+    }
+    return true;
+}
+
+void TiledOceanSolver::setView(float worldX, float worldZ) {
+    int tx = tileCoord(worldX);
+    int tz = tileCoord(worldZ);
+    viewTx = tx;
+    viewTz = tz;
+
+    for (int z = tz - viewRadius; z <= tz + viewRadius; ++z) {
+        for (int x = tx - viewRadius; x <= tx + viewRadius; ++x) {
+            pageIn(x, z, frame);
+        }
+    }
+}
+
+void TiledOceanSolver::rebuildNeighbours() {
+    tiles.clear();
+    for (auto& entry : resident) {
+        tiles.push_back(entry.second.get());
+    }
+    std::sort(tiles.begin(), tiles.end(), [](const Tile* a, const Tile* b) {
+        return tileKey(a->tx, a->tz) < tileKey(b->tx, b->tz);
+    });
+
+    // Faces: 0 = -x, 1 = +x, 2 = -z, 3 = +z.
+    for (Tile* tile : tiles) {
+        tile->neighbours[0] = findTile(tile->tx - 1, tile->tz);
+        tile->neighbours[1] = findTile(tile->tx + 1, tile->tz);
+        tile->neighbours[2] = findTile(tile->tx, tile->tz - 1);
+        tile->neighbours[3] = findTile(tile->tx, tile->tz + 1);
+    }
+    neighboursDirty = false;
+}
+
+void TiledOceanSolver::updateResidency() {
+    // Waves reaching an edge pull the tile behind it in, as recent as the tile they came from.
+    std::vector<Tile*> snapshot = tiles;
+    for (Tile* tile : snapshot) {
+        for (int face = 0; face < 4; ++face) {
+            if (tile->neighbours[face]) continue;
+            bool moving = false;
+            for (int k = 0; k < tileCells && !moving; ++k) {
+                int r = face < 2 ? k : (face == 2 ? 0 : tileCells - 1);
+                int c = face >= 2 ? k : (face == 0 ? 0 : tileCells - 1);
+                moving = std::abs(tile->current[at(r, c)]) > edgeThreshold;
+            }
+            if (!moving) continue;
+            int tx = tile->tx + (face == 0 ? -1 : face == 1 ? 1 : 0);
+            int tz = tile->tz + (face == 2 ? -1 : face == 3 ? 1 : 0);
+            pageIn(tx, tz, tile->lastUsed);
+        }
+    }
+
+    // Calm tiles outside the view cost compute and hold nothing, so they go
+    // first, unless they were just paged in for a wave that has not arrived yet.
+    std::vector<Tile*> candidates;
+    for (auto& entry : resident) {
+        Tile* tile = entry.second.get();
+        if (!inView(tile->tx, tile->tz)) candidates.push_back(tile);
+    }
+    std::vector<Tile*> kept;
+    for (Tile* tile : candidates) {
+        if (tile->pagedIn != frame && isCalm(*tile)) {
+            evict(tile);
+        } else {
+            kept.push_back(tile);
+        }
+    }
+
+    int excess = static_cast<int>(resident.size()) - residentBudget;
+    if (excess > 0) {
+        std::sort(kept.begin(), kept.end(), [](const Tile* a, const Tile* b) {
+            if (a->lastUsed != b->lastUsed) return a->lastUsed < b->lastUsed;
+            return tileKey(a->tx, a->tz) < tileKey(b->tx, b->tz);
+        });
+        for (int i = 0; i < excess && i < static_cast<int>(kept.size()); ++i) {
+            evict(kept[i]);
+        }
+    }
+}
+
+void TiledOceanSolver::fillHalo(Tile& tile) const {
+    float* cur = tile.current.data();
+    const float* prev = tile.previous.data();
+
+    for (int face = 0; face < 4; ++face) {
+        // Halo cell k of the face sits at first + k * step, the cell inside it at first + inward + k * step.
+        int first, inward, step;
+        if (face < 2) {
+            first = at(0, face == 0 ? -1 : tileCells);
+            inward = face == 0 ? 1 : -1;
+            step = stride;
+        } else {
+            first = at(face == 2 ? -1 : tileCells, 0);
+            inward = face == 2 ? stride : -stride;
+            step = 1;
+        }
+
+        const Tile* neighbour = tile.neighbours[face];
+        if (neighbour) {
+            // The neighbour's edge cell is tileCells cells inward from the halo cell.
+            int offset = inward * tileCells;
+            const float* other = neighbour->current.data();
+            for (int k = 0; k < tileCells; ++k) {
+                cur[first + k * step] = other[first + offset + k * step];
+            }
+        } else {
+            // Mur's first-order absorbing boundary: u_g(t) = u_i(t-1) + a (u_i(t) - u_g(t-1)).
+            for (int k = 0; k < tileCells; ++k) {
+                int ghost = first + k * step;
+                cur[ghost] = prev[ghost + inward] + absorbing * (cur[ghost + inward] - prev[ghost]);
+            }
+        }
+    }
+}
+
+void TiledOceanSolver::stepTile(Tile& tile) {
+    float* prev = tile.previous.data();
+    const float* cur = tile.current.data();
+    for (int r = 0; r < tileCells; ++r) {
+        kernels->stencilRow(prev + at(r, 0), cur + at(r - 1, 0), cur + at(r, 0), cur + at(r + 1, 0),
+                            dampingRow.data(), tileCells, A, B);
+    }
+    tile.current.swap(tile.previous);
+}
+
+void TiledOceanSolver::advance(int substeps) {
+    for (int s = 0; s < substeps; ++s) {
+        if (neighboursDirty) rebuildNeighbours();
+        int count = static_cast<int>(tiles.size());
+        threadPool.run(count, [this](int i, int) { fillHalo(*tiles[i]); });
+        threadPool.run(count, [this](int i, int) { stepTile(*tiles[i]); });
+    }
+    if (substeps <= 0) return;
+
+    if (neighboursDirty) rebuildNeighbours();
+    updateResidency();
+    if (neighboursDirty) rebuildNeighbours();
+    ++frame;
+}
+
+const float* TiledOceanSolver::getWindowTileHeights(int wx, int wz) const {
+    return &findTile(viewTx - viewRadius + wx, viewTz - viewRadius + wz)->current[at(0, 0)];
+}
+
+glm::vec2 TiledOceanSolver::getWindowOrigin() const {
+    return glm::vec2(static_cast<float>(viewTx - viewRadius) * tileSize,
+                     static_cast<float>(viewTz - viewRadius) * tileSize);
+}
+
+size_t TiledOceanSolver::getResidentBytes() const {
+    return resident.size() * 2 * static_cast<size_t>(stride) * stride * sizeof(float);
+}
+
+size_t TiledOceanSolver::getStoredBytes() const {
+    return stored.size() * 2 * static_cast<size_t>(tileCells) * tileCells * sizeof(unsigned short);
+}
+
+void TiledOceanSolver::createRaindrop() {
+    if (distProb(rng) < raindropProbability) {
+        glm::vec2 origin = getWindowOrigin();
+        createDisturbance(origin.x + distPos(rng) * getWindowSize(), origin.y + distPos(rng) * getWindowSize(),
+                          raindropMagnitude);
+    }
+}
+
+void TiledOceanSolver::createDisturbance(float worldX, float worldZ, float magnitude) {
+    int tx = tileCoord(worldX);
+    int tz = tileCoord(worldZ);
+    Tile* tile = pageIn(tx, tz, frame);
+    int c = static_cast<int>(std::floor((worldX - tx * tileSize) / h));
+    int r = static_cast<int>(std::floor((worldZ - tz * tileSize) / h));
+    c = std::max(0, std::min(tileCells - 1, c));
+    r = std::max(0, std::min(tileCells - 1, r));
+    tile->current[at(r, c)] += magnitude;
+}
+
+float TiledOceanSolver::cellHeight(int gx, int gz) const {
+    int tx = gx >= 0 ? gx / tileCells : -((-gx - 1) / tileCells) - 1;
+    int tz = gz >= 0 ? gz / tileCells : -((-gz - 1) / tileCells) - 1;
+    int c = gx - tx * tileCells;
+    int r = gz - tz * tileCells;
+    if (const Tile* tile = findTile(tx, tz)) return tile->current[at(r, c)];
+
+    auto it = stored.find(tileKey(tx, tz));
+    if (it == stored.end()) return 0.0f;
+    float value;
+    kernels->halfToFloatRow(&it->second.current[r * tileCells + c], &value, 1);
+    return value;
+}
+
+float TiledOceanSolver::getHeightAt(float worldX, float worldZ) const {
+    // Bilinear between cell centres, across tile edges where needed.
+    float c_float = worldX / h - 0.5f;
+    float r_float = worldZ / h - 0.5f;
+    int c0 = static_cast<int>(std::floor(c_float));
+    int r0 = static_cast<int>(std::floor(r_float));
+    float tx = c_float - c0;
+    float ty = r_float - r0;
+
+    return (1 - tx) * (1 - ty) * cellHeight(c0, r0) +
+           tx * (1 - ty) * cellHeight(c0 + 1, r0) +
+           (1 - tx) * ty * cellHeight(c0, r0 + 1) +
+           tx * ty * cellHeight(c0 + 1, r0 + 1);
+}
+
+glm::vec3 TiledOceanSolver::getNormalAt(float worldX, float worldZ) const {
+    float grad_x = (getHeightAt(worldX + h, worldZ) - getHeightAt(worldX - h, worldZ)) / (2.0f * h);
+    float grad_z = (getHeightAt(worldX, worldZ + h) - getHeightAt(worldX, worldZ - h)) / (2.0f * h);
+    return glm::normalize(glm::vec3(-grad_x, 1.0f, -grad_z));
+}
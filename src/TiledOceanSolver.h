@@ -0,0 +1,143 @@
+#ifndef TILEDOCEANSOLVER_H
+#define TILEDOCEANSOLVER_H
+
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <random>
+#include <cmath>
+#include <glm/glm.hpp>
+#include "ThreadPool.h"
+
+struct WaterKernels;
+
+// Same wave equation as WaterSolver over an unbounded plane split into
+// square tiles of tileCells x tileCells cells. Tile (tx, tz) covers
+// [tx, tx + 1) x [tz, tz + 1) times tileSize metres.
+//
+// At most residentBudget tiles are simulated. Tiles around the view point are
+// always resident; tiles reached by a wave or a disturbance are paged in next
+// to them. When the budget is exceeded the least recently used tiles are
+// evicted: calm tiles are dropped (they are all zero), moving ones are kept as
+// half floats and resume where they stopped when they are paged back in. At
+// most storedBudget tiles are kept that way; past it the least recently used
+// copy is dropped as if its water had come to rest.
+//
+// Resident tiles exchange a one-cell halo every step. Across a face with no
+// resident neighbour the halo is a first-order absorbing boundary, so waves
+// leave the simulated region instead of reflecting off it.
+class TiledOceanSolver {
+public:
+    TiledOceanSolver(float tileSize = 4.0f, int tileCells = 64, int viewRadius = 2, int residentBudget = 64,
+                     int storedBudget = 256, int threadCount = 0);
+
+    // Advances the resident tiles by `substeps` timesteps, then pages tiles in and out.
+    void advance(int substeps = 1);
+    void createRaindrop();
+    void createDisturbance(float worldX, float worldZ, float magnitude);
+
+    // Tiles within viewRadius tiles of the point are kept resident and form
+    // the view window.
+    void setView(float worldX, float worldZ);
+
+    // Heights of paged-out tiles are read from their stored copy.
+    float getHeightAt(float worldX, float worldZ) const;
+    glm::vec3 getNormalAt(float worldX, float worldZ) const;
+
+    // The view window is the getWindowTiles()^2 tiles around the view point.
+    // getWindowOrigin() is the world position of its first cell corner and
+    // getWindowSize() its width in metres.
+    glm::vec2 getWindowOrigin() const;
+    float getWindowSize() const { return static_cast<float>(windowTiles) * tileSize; }
+    int getWindowTiles() const { return windowTiles; }
+    int getWindowGridN() const { return windowTiles * tileCells; }
+    int getTileCells() const { return tileCells; }
+
+    // Cell (0, 0) of window tile (wx, wz), counted from getWindowOrigin().
+    // Rows are getTileStride() floats apart. Window tiles are always resident.
+    const float* getWindowTileHeights(int wx, int wz) const;
+    int getTileStride() const { return stride; }
+
+    int getResidentTileCount() const { return static_cast<int>(resident.size()); }
+    int getStoredTileCount() const { return static_cast<int>(stored.size()); }
+    size_t getResidentBytes() const;
+    size_t getStoredBytes() const;
+
+private:
+    struct Tile {
+        int tx;
+        int tz;
+        // (tileCells + 2)^2 cells including the halo.
+        std::vector<float> current;
+        std::vector<float> previous;
+        Tile* neighbours[4];
+        unsigned long long lastUsed = 0;
+        unsigned long long pagedIn = 0;
+    };
+
+    // Both time levels of an evicted tile, interior cells only.
+    struct StoredTile {
+        std::vector<unsigned short> current;
+        std::vector<unsigned short> previous;
+        unsigned long long lastUsed;
+    };
+
+    float tileSize;
+    int tileCells;
+    int stride;
+    int viewRadius;
+    int windowTiles;
+    int residentBudget;
+    int storedBudget;
+    float h;
+    float dt_sim;
+    float A;
+    float B;
+    // First-order absorbing boundary coefficient (c dt - h) / (c dt + h).
+    float absorbing;
+
+    std::unordered_map<unsigned long long, std::unique_ptr<Tile>> resident;
+    std::unordered_map<unsigned long long, StoredTile> stored;
+    std::vector<Tile*> tiles;
+    bool neighboursDirty = true;
+    unsigned long long frame = 1;
+
+    int viewTx = 0;
+    int viewTz = 0;
+
+    const WaterKernels* kernels;
+    ThreadPool threadPool;
+    std::vector<float> dampingRow;
+
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> distPos;
+    std::uniform_real_distribution<float> distProb;
+    const float raindropProbability = 0.05f;
+    const float raindropMagnitude = 1.1f;
+    const float damping = 0.95f;
+    // Same threshold as the sparse WaterSolver tiles.
+    const float sleepThreshold = 1e-6f;
+    // A wave this high at a tile edge pages in the neighbour it is heading for.
+    const float edgeThreshold = 1e-3f;
+
+    static unsigned long long tileKey(int tx, int tz) {
+        return (static_cast<unsigned long long>(static_cast<unsigned int>(tz)) << 32) |
+               static_cast<unsigned long long>(static_cast<unsigned int>(tx));
+    }
+    int at(int r, int c) const { return (r + 1) * stride + (c + 1); }
+    int tileCoord(float world) const { return static_cast<int>(std::floor(world / tileSize)); }
+    bool inView(int tx, int tz) const;
+
+    Tile* findTile(int tx, int tz) const;
+    Tile* pageIn(int tx, int tz, unsigned long long lastUsed);
+    void evict(Tile* tile);
+    bool isCalm(const Tile& tile) const;
+    // Height of a cell in global cell coordinates, resident, stored or zero.
+    float cellHeight(int gx, int gz) const;
+    void updateResidency();
+    void rebuildNeighbours();
+    void fillHalo(Tile& tile) const;
+    void stepTile(Tile& tile);
+};
+
+#endif // TILEDOCEANSOLVER_H
@@ -0,0 +1,170 @@
+#include "TraceRecorder.h"
+
+#ifdef DUCK_PROFILE
+
+#include <iostream>
+
+namespace {
+// Per-thread state; the buffer itself is owned by the recorder's registry.
+thread_local void* localBuffer = nullptr;
+thread_local std::string localName;
+thread_local bool localNameSet = false;
+
+void writeJsonString(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (char ch : text) {
+        if (ch == '"' || ch == '\\') out << '\\';
+        if (static_cast<unsigned char>(ch) >= 0x20) out << ch;
+    }
+    out << '"';
+}
+}
+
+TraceRecorder& TraceRecorder::instance() {
+    static TraceRecorder recorder;
+    return recorder;
+}
+
+TraceRecorder::~TraceRecorder() {
+    stop();
+}
+
+void TraceRecorder::setThreadName(const std::string& name) {
+    localName = name;
+    localNameSet = true;
+    if (localBuffer) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        static_cast<ThreadBuffer*>(localBuffer)->name = name;
+    }
+}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::threadBuffer() {
+    if (localBuffer) return static_cast<ThreadBuffer*>(localBuffer);
+    std::shared_ptr<ThreadBuffer> buffer = std::make_shared<ThreadBuffer>();
+    std::lock_guard<std::mutex> lock(registryMutex);
+    buffer->tid = static_cast<int>(buffers.size()) + 1;
+    buffer->name = localNameSet ? localName : "thread " + std::to_string(buffer->tid);
+    buffers.push_back(buffer);
+    localBuffer = buffer.get();
+    return buffer.get();
+}
+
+void TraceRecorder::record(const char* name, Clock::time_point begin, Clock::time_point end) {
+    if (!isRecording() || begin < origin) return;
+    ThreadBuffer* buffer = threadBuffer();
+    size_t head = buffer->head.load(std::memory_order_relaxed);
+    if (head - buffer->tail.load(std::memory_order_acquire) == ThreadBuffer::capacity) {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Event& event = buffer->events[head % ThreadBuffer::capacity];
+    event.name = name;
+    event.beginNs = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - origin).count();
+    event.durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+bool TraceRecorder::start(const std::string& path, double maxSeconds) {
+    if (path.empty()) return false;
+    std::lock_guard<std::mutex> lock(writerMutex);
+    if (isRecording() || writer.joinable()) return false;
+    file.open(path, std::ios::out | std::ios::trunc);
+    if (!file) {
+        std::cerr << "Trace: cannot write " << path << std::endl;
+        return false;
+    }
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    firstEvent = true;
+    writtenEvents = 0;
+    writerStopping = false;
+
+    // Events left over from an earlier capture would have the wrong origin.
+    {
+        std::lock_guard<std::mutex> registryLock(registryMutex);
+        for (const std::shared_ptr<ThreadBuffer>& buffer : buffers) {
+            buffer->tail.store(buffer->head.load(std::memory_order_acquire), std::memory_order_release);
+            buffer->dropped.store(0);
+        }
+    }
+
+    origin = Clock::now();
+    hasDeadline = maxSeconds > 0.0;
+    deadline = origin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(maxSeconds));
+    recording.store(true);
+    writer = std::thread(&TraceRecorder::writerLoop, this);
+    std::cout << "Trace: recording to " << path;
+    if (hasDeadline) std::cout << " for " << maxSeconds << " s";
+    std::cout << std::endl;
+    return true;
+}
+
+void TraceRecorder::stop() {
+    {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        writerStopping = true;
+    }
+    writerCondition.notify_one();
+    if (writer.joinable()) writer.join();
+}
+
+void TraceRecorder::writerLoop() {
+    // Flushing a few times a second keeps the rings far from full at frame rate.
+    const auto flushInterval = std::chrono::milliseconds(100);
+    std::unique_lock<std::mutex> lock(writerMutex);
+    for (;;) {
+        writerCondition.wait_for(lock, flushInterval, [this] { return writerStopping; });
+        bool expired = hasDeadline && Clock::now() >= deadline;
+        if (writerStopping || expired) {
+            recording.store(false);
+            drain();
+            finish();
+            return;
+        }
+        drain();
+    }
+}
+
+void TraceRecorder::drain() {
+    std::vector<std::shared_ptr<ThreadBuffer>> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        snapshot = buffers;
+    }
+    for (const std::shared_ptr<ThreadBuffer>& buffer : snapshot) {
+        size_t tail = buffer->tail.load(std::memory_order_relaxed);
+        size_t head = buffer->head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            const Event& event = buffer->events[tail % ThreadBuffer::capacity];
+            file << (firstEvent ? "" : ",\n");
+            firstEvent = false;
+            // Trace-event timestamps are in microseconds.
+            file << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+                 << ",\"ts\":" << event.beginNs / 1000 << '.' << event.beginNs / 100 % 10
+                 << ",\"dur\":" << event.durationNs / 1000 << '.' << event.durationNs / 100 % 10 << '}';
+            ++writtenEvents;
+        }
+        buffer->tail.store(tail, std::memory_order_release);
+    }
+}
+
+void TraceRecorder::finish() {
+    long long dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (const std::shared_ptr<ThreadBuffer>& buffer : buffers) {
+            file << (firstEvent ? "" : ",\n");
+            firstEvent = false;
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid << ",\"args\":{\"name\":";
+            writeJsonString(file, buffer->name);
+            file << "}}";
+            dropped += buffer->dropped.load();
+        }
+    }
+    file << "\n]}\n";
+    file.close();
+    std::cout << "Trace: wrote " << writtenEvents << " events";
+    if (dropped > 0) std::cout << ", dropped " << dropped << " (ring buffers full)";
+    std::cout << std::endl;
+}
+
+#endif // DUCK_PROFILE
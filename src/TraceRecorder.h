@@ -0,0 +1,122 @@
+#ifndef TRACERECORDER_H
+#define TRACERECORDER_H
+
+// Timeline capture of the profiling scopes as Chrome trace-event JSON, to be
+// opened in ui.perfetto.dev or chrome://tracing (see README.md). Built with
+// DUCK_PROFILE only, like FrameProfiler; otherwise the DUCK_TRACE_* macros
+// expand to nothing. Nothing is recorded until start().
+
+#ifdef DUCK_PROFILE
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TraceRecorder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static TraceRecorder& instance();
+    ~TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // Records into `path` until stop(), or for maxSeconds if that is positive.
+    // Returns false for an empty path, if a capture is already running or if
+    // the file cannot be created.
+    bool start(const std::string& path, double maxSeconds = 0.0);
+    // Flushes the remaining events and closes the file. Safe to call twice.
+    void stop();
+    bool isRecording() const { return recording.load(std::memory_order_acquire); }
+
+    // Adds a span on the calling thread. `name` is kept as a pointer and must
+    // outlive the capture, as string literals do.
+    void record(const char* name, Clock::time_point begin, Clock::time_point end);
+    // Label the calling thread gets in the viewer.
+    void setThreadName(const std::string& name);
+
+private:
+    TraceRecorder() = default;
+
+    struct Event {
+        const char* name;
+        int64_t beginNs;
+        int64_t durationNs;
+    };
+
+    // Single-producer ring of one thread's events; the writer is the only
+    // consumer. A full ring drops the event instead of blocking the producer.
+    struct ThreadBuffer {
+        static constexpr size_t capacity = 1 << 14;
+        Event events[capacity];
+        std::atomic<size_t> head{0};
+        std::atomic<size_t> tail{0};
+        std::atomic<long long> dropped{0};
+        int tid = 0;
+        std::string name;
+    };
+
+    std::atomic<bool> recording{false};
+    Clock::time_point origin;
+    Clock::time_point deadline;
+    bool hasDeadline = false;
+
+    // Buffers outlive their threads so events of exited threads still get written.
+    std::mutex registryMutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+    std::mutex writerMutex;
+    std::condition_variable writerCondition;
+    std::thread writer;
+    bool writerStopping = false;
+    std::ofstream file;
+    bool firstEvent = true;
+    long long writtenEvents = 0;
+
+    ThreadBuffer* threadBuffer();
+    void writerLoop();
+    void drain();
+    void finish();
+};
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name(name) {
+        if (TraceRecorder::instance().isRecording()) begin = TraceRecorder::Clock::now();
+    }
+    ~TraceScope() {
+        if (begin != TraceRecorder::Clock::time_point()) {
+            TraceRecorder::instance().record(name, begin, TraceRecorder::Clock::now());
+        }
+    }
+
+private:
+    const char* name;
+    TraceRecorder::Clock::time_point begin;
+};
+
+#define DUCK_TRACE_JOIN2(a, b) a##b
+#define DUCK_TRACE_JOIN(a, b) DUCK_TRACE_JOIN2(a, b)
+#define DUCK_TRACE_SCOPE(name) TraceScope DUCK_TRACE_JOIN(duckTraceScope, __LINE__)(name)
+#define DUCK_TRACE_THREAD_NAME(name) TraceRecorder::instance().setThreadName(name)
+#define DUCK_TRACE_START(path, maxSeconds) TraceRecorder::instance().start(path, maxSeconds)
+#define DUCK_TRACE_STOP() TraceRecorder::instance().stop()
+
+#else
+
+#define DUCK_TRACE_SCOPE(name)
+#define DUCK_TRACE_THREAD_NAME(name)
+#define DUCK_TRACE_START(path, maxSeconds) ((void)(path), (void)(maxSeconds))
+#define DUCK_TRACE_STOP()
+
+#endif // DUCK_PROFILE
+
+#endif // TRACERECORDER_H
@@ -0,0 +1,42 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Lock-free single-producer / single-consumer triple buffer. The producer
+// fills writeBuffer() and publish()es it; the consumer calls acquire() and
+// then reads readBuffer(). Neither side ever waits: the producer always has a
+// free slot and the consumer always sees the newest complete one.
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : writeIndex(0), shared(1), readIndex(2) {}
+
+    T& writeBuffer() { return slots[writeIndex]; }
+    const T& readBuffer() const { return slots[readIndex]; }
+    T& slot(int i) { return slots[i]; }
+
+    void publish() {
+        unsigned previous = shared.exchange(static_cast<unsigned>(writeIndex) | freshBit, std::memory_order_acq_rel);
+        writeIndex = static_cast<int>(previous & indexMask);
+    }
+
+    // Makes the newest published slot the read buffer. Returns false if nothing was published since the last call.
+    bool acquire() {
+        if ((shared.load(std::memory_order_relaxed) & freshBit) == 0) return false;
+        unsigned previous = shared.exchange(static_cast<unsigned>(readIndex), std::memory_order_acq_rel);
+        readIndex = static_cast<int>(previous & indexMask);
+        return true;
+    }
+
+private:
+    static const unsigned freshBit = 4;
+    static const unsigned indexMask = 3;
+
+    T slots[3];
+    int writeIndex;
+    std::atomic<unsigned> shared;
+    int readIndex;
+};
+
+#endif // TRIPLEBUFFER_H
@@ -0,0 +1,352 @@
+#include "WaterKernels.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(DUCK_X86_KERNELS)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+extern const WaterKernels waterKernelsSSE42;
+extern const WaterKernels waterKernelsAVX2;
+extern const WaterKernels waterKernelsAVX512;
+#endif
+
+void stencilSpanScalar(float* prev, const float* up, const float* mid, const float* down,
+                       const float* damping, int begin, int end, float A, float B) {
+    for (int c = begin; c < end; ++c) {
+        float sum_neighbors = down[c] + up[c] + mid[c + 1] + mid[c - 1];
+        float new_h = A * sum_neighbors + B * mid[c] - prev[c];
+        prev[c] = new_h * damping[c];
+    }
+}
+
+void normalSpanScalar(const float* up, const float* mid, const float* down, int begin, int end,
+                      float twoH, float* normals, unsigned char* rgba) {
+    for (int c = begin; c < end; ++c) {
+        float grad_x = (mid[c + 1] - mid[c - 1]) / twoH;
+        float grad_z = (down[c] - up[c]) / twoH;
+
+        // Same operation order as glm::normalize(vec3(-grad_x, 1, -grad_z)).
+        float x = -grad_x;
+        float z = -grad_z;
+        float inv_len = 1.0f / std::sqrt(x * x + 1.0f + z * z);
+        x *= inv_len;
+        float y = inv_len;
+        z *= inv_len;
+
+        normals[c * 3 + 0] = x;
+        normals[c * 3 + 1] = y;
+        normals[c * 3 + 2] = z;
+
+        rgba[c * 4 + 0] = static_cast<unsigned char>((x * 0.5f + 0.5f) * 255.0f);
+        rgba[c * 4 + 1] = static_cast<unsigned char>((y * 0.5f + 0.5f) * 255.0f);
+        rgba[c * 4 + 2] = static_cast<unsigned char>((z * 0.5f + 0.5f) * 255.0f);
+        rgba[c * 4 + 3] = 255;
+    }
+}
+
+void halfToFloatSpanScalar(const unsigned short* src, float* dst, int begin, int end) {
+    for (int c = begin; c < end; ++c) {
+        std::uint32_t h = src[c];
+        std::uint32_t sign = (h & 0x8000u) << 16;
+        std::uint32_t exponent = (h >> 10) & 0x1Fu;
+        std::uint32_t mantissa = h & 0x3FFu;
+
+        std::uint32_t bits;
+        if (exponent == 0) {
+            // Zero or subnormal: mantissa * 2^-24 is exact in fp32.
+            float value = static_cast<float>(mantissa) * 5.9604644775390625e-8f;
+            std::memcpy(&bits, &value, sizeof(bits));
+            bits |= sign;
+        } else if (exponent == 31) {
+            bits = sign | 0x7F800000u | (mantissa << 13);
+        } else {
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        }
+        std::memcpy(&dst[c], &bits, sizeof(bits));
+    }
+}
+
+void floatToHalfSpanScalar(const float* src, unsigned short* dst, int begin, int end) {
+    for (int c = begin; c < end; ++c) {
+        std::uint32_t f;
+        std::memcpy(&f, &src[c], sizeof(f));
+        std::uint32_t sign = (f >> 16) & 0x8000u;
+        f &= 0x7FFFFFFFu;
+
+        std::uint32_t h;
+        if (f >= 0x47800000u) {
+            // >= 2^16 overflows to infinity; NaN stays a (quiet) NaN.
+            h = f > 0x7F800000u ? 0x7E00u : 0x7C00u;
+        } else if (f < 0x38800000u) {
+            // Below the smallest normal half: adding 0.5f lets the FPU do the
+            // round-to-nearest-even shift into the subnormal mantissa.
+            float value;
+            std::memcpy(&value, &f, sizeof(value));
+            value += 0.5f;
+            std::memcpy(&h, &value, sizeof(h));
+            h -= 0x3F000000u;
+        } else {
+            std::uint32_t mantissaOdd = (f >> 13) & 1u;
+            f += 0xC8000FFFu; // rebias exponent (15 - 127) << 23 plus rounding bias
+            f += mantissaOdd;
+            h = f >> 13;
+        }
+        dst[c] = static_cast<unsigned short>(h | sign);
+    }
+}
+
+void int16ToFloatSpanScalar(const short* src, float* dst, int begin, int end, float scale) {
+    for (int c = begin; c < end; ++c) {
+        dst[c] = static_cast<float>(src[c]) * scale;
+    }
+}
+
+void floatToInt16SpanScalar(const float* src, short* dst, int begin, int end, float invScale) {
+    for (int c = begin; c < end; ++c) {
+        float value = src[c] * invScale;
+        value = value < -32767.0f ? -32767.0f : (value > 32767.0f ? 32767.0f : value);
+        dst[c] = static_cast<short>(std::lrint(value));
+    }
+}
+
+void splatSpanScalar(float* dst, const float* weights, float scale, int begin, int end) {
+    for (int c = begin; c < end; ++c) {
+        dst[c] += scale * weights[c];
+    }
+}
+
+void peakSpanScalar(const float* next, const float* current, int begin, int end, float* peaks) {
+    for (int c = begin; c < end; ++c) {
+        float height = std::abs(next[c]);
+        float velocity = std::abs(next[c] - current[c]);
+        float peak = peaks[c];
+        peak = height > peak ? height : peak;
+        peaks[c] = velocity > peak ? velocity : peak;
+    }
+}
+
+void butterflySpanScalar(float* aRe, float* aIm, float* bRe, float* bIm, float wRe, float wIm, int begin, int end) {
+    for (int c = begin; c < end; ++c) {
+        float tRe = bRe[c] * wRe - bIm[c] * wIm;
+        float tIm = bRe[c] * wIm + bIm[c] * wRe;
+        bRe[c] = aRe[c] - tRe;
+        bIm[c] = aIm[c] - tIm;
+        aRe[c] = aRe[c] + tRe;
+        aIm[c] = aIm[c] + tIm;
+    }
+}
+
+// Normal of cell (r, c), as in normalSpanScalar().
+static void cellNormal(const float* grid, int stride, float twoH, int r, int c, float& x, float& y, float& z) {
+    const float* row = grid + r * stride;
+    float grad_x = (row[c + 1] - row[c - 1]) / twoH;
+    float grad_z = (row[stride + c] - row[c - stride]) / twoH;
+    x = -grad_x;
+    z = -grad_z;
+    float inv_len = 1.0f / std::sqrt(x * x + 1.0f + z * z);
+    x *= inv_len;
+    y = inv_len;
+    z *= inv_len;
+}
+
+void samplePointsSpanScalar(const float* grid, int n, int stride, float size, float twoH, const float* xz,
+                            int begin, int end, float* heights, float* normals) {
+    for (int i = begin; i < end; ++i) {
+        float c_float = (xz[2 * i] + size / 2.0f) / size * static_cast<float>(n - 1);
+        float r_float = (xz[2 * i + 1] + size / 2.0f) / size * static_cast<float>(n - 1);
+
+        int r0 = static_cast<int>(std::floor(r_float));
+        int c0 = static_cast<int>(std::floor(c_float));
+        r0 = r0 < 0 ? 0 : (r0 > n - 2 ? n - 2 : r0);
+        c0 = c0 < 0 ? 0 : (c0 > n - 2 ? n - 2 : c0);
+
+        float tx = c_float - static_cast<float>(c0);
+        float ty = r_float - static_cast<float>(r0);
+        float w00 = (1.0f - tx) * (1.0f - ty);
+        float w10 = tx * (1.0f - ty);
+        float w01 = (1.0f - tx) * ty;
+        float w11 = tx * ty;
+
+        if (heights) {
+            const float* cell = grid + r0 * stride + c0;
+            heights[i] = w00 * cell[0] + w10 * cell[1] + w01 * cell[stride] + w11 * cell[stride + 1];
+        }
+        if (normals) {
+            float nx[4], ny[4], nz[4];
+            cellNormal(grid, stride, twoH, r0, c0, nx[0], ny[0], nz[0]);
+            cellNormal(grid, stride, twoH, r0, c0 + 1, nx[1], ny[1], nz[1]);
+            cellNormal(grid, stride, twoH, r0 + 1, c0, nx[2], ny[2], nz[2]);
+            cellNormal(grid, stride, twoH, r0 + 1, c0 + 1, nx[3], ny[3], nz[3]);
+            float x = w00 * nx[0] + w10 * nx[1] + w01 * nx[2] + w11 * nx[3];
+            float y = w00 * ny[0] + w10 * ny[1] + w01 * ny[2] + w11 * ny[3];
+            float z = w00 * nz[0] + w10 * nz[1] + w01 * nz[2] + w11 * nz[3];
+            // Same operation order as glm::normalize.
+            float inv_len = 1.0f / std::sqrt(x * x + y * y + z * z);
+            normals[3 * i + 0] = x * inv_len;
+            normals[3 * i + 1] = y * inv_len;
+            normals[3 * i + 2] = z * inv_len;
+        }
+    }
+}
+
+static void stencilRowScalar(float* prev, const float* up, const float* mid, const float* down,
+                             const float* damping, int count, float A, float B) {
+    stencilSpanScalar(prev, up, mid, down, damping, 0, count, A, B);
+}
+
+static void normalRowScalar(const float* up, const float* mid, const float* down, int count, float twoH,
+                            float* normals, unsigned char* rgba) {
+    normalSpanScalar(up, mid, down, 0, count, twoH, normals, rgba);
+}
+
+static void halfToFloatRowScalar(const unsigned short* src, float* dst, int count) {
+    halfToFloatSpanScalar(src, dst, 0, count);
+}
+
+static void floatToHalfRowScalar(const float* src, unsigned short* dst, int count) {
+    floatToHalfSpanScalar(src, dst, 0, count);
+}
+
+static void int16ToFloatRowScalar(const short* src, float* dst, int count, float scale) {
+    int16ToFloatSpanScalar(src, dst, 0, count, scale);
+}
+
+static void floatToInt16RowScalar(const float* src, short* dst, int count, float invScale) {
+    floatToInt16SpanScalar(src, dst, 0, count, invScale);
+}
+
+static void splatRowScalar(float* dst, const float* weights, float scale, int count) {
+    splatSpanScalar(dst, weights, scale, 0, count);
+}
+
+static void peakRowScalar(const float* next, const float* current, int count, float* peaks) {
+    peakSpanScalar(next, current, 0, count, peaks);
+}
+
+static void samplePointsScalar(const float* grid, int n, int stride, float size, float twoH, const float* xz,
+                               int count, float* heights, float* normals) {
+    samplePointsSpanScalar(grid, n, stride, size, twoH, xz, 0, count, heights, normals);
+}
+
+static void butterflyRowsScalar(float* aRe, float* aIm, float* bRe, float* bIm, const float* wRe, const float* wIm,
+                                int rows, int width) {
+    for (int j = 0; j < rows; ++j) {
+        size_t offset = static_cast<size_t>(j) * width;
+        butterflySpanScalar(aRe + offset, aIm + offset, bRe + offset, bIm + offset, wRe[j], wIm[j], 0, width);
+    }
+}
+
+static const WaterKernels waterKernelsScalar = {
+    WaterKernelISA::Scalar, "scalar", stencilRowScalar, normalRowScalar,
+    halfToFloatRowScalar, floatToHalfRowScalar, int16ToFloatRowScalar, floatToInt16RowScalar,
+    splatRowScalar, peakRowScalar, samplePointsScalar, butterflyRowsScalar
+};
+
+#if defined(DUCK_X86_KERNELS)
+static void cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4]) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, static_cast<int>(leaf), static_cast<int>(subleaf));
+    for (int i = 0; i < 4; ++i) regs[i] = static_cast<unsigned>(r[i]);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long xgetbv0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+}
+
+bool isWaterKernelISASupported(WaterKernelISA isa) {
+    if (isa == WaterKernelISA::Scalar) return true;
+
+    unsigned regs[4];
+    cpuid(0, 0, regs);
+    unsigned maxLeaf = regs[0];
+    cpuid(1, 0, regs);
+    unsigned ecx1 = regs[2];
+
+    bool sse42 = (ecx1 & (1u << 20)) != 0;
+    if (isa == WaterKernelISA::SSE42) return sse42;
+
+    // AVX state must be enabled by the OS (OSXSAVE + XCR0 bits) on top of CPU
+    // support. F16C is required too, the AVX2 kernels use it for half floats.
+    bool osxsave = (ecx1 & (1u << 27)) != 0;
+    bool avx = (ecx1 & (1u << 28)) != 0;
+    bool f16c = (ecx1 & (1u << 29)) != 0;
+    if (!sse42 || !osxsave || !avx || !f16c || maxLeaf < 7) return false;
+    unsigned long long xcr0 = xgetbv0();
+    if ((xcr0 & 0x6) != 0x6) return false;
+
+    cpuid(7, 0, regs);
+    unsigned ebx7 = regs[1];
+    if (isa == WaterKernelISA::AVX2) return (ebx7 & (1u << 5)) != 0;
+    if (isa == WaterKernelISA::AVX512) return (ebx7 & (1u << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+    return false;
+}
+
+const WaterKernels& getWaterKernels(WaterKernelISA isa) {
+    switch (isa) {
+        case WaterKernelISA::SSE42: return waterKernelsSSE42;
+        case WaterKernelISA::AVX2: return waterKernelsAVX2;
+        case WaterKernelISA::AVX512: return waterKernelsAVX512;
+        default: return waterKernelsScalar;
+    }
+}
+#else
+bool isWaterKernelISASupported(WaterKernelISA isa) {
+    return isa == WaterKernelISA::Scalar;
+}
+
+const WaterKernels& getWaterKernels(WaterKernelISA) {
+    return waterKernelsScalar;
+}
+#endif
+
+static const WaterKernels* overriddenKernels = nullptr;
+
+bool overrideWaterKernels(WaterKernelISA isa) {
+    if (!isWaterKernelISASupported(isa)) return false;
+    overriddenKernels = &getWaterKernels(isa);
+    return true;
+}
+
+bool parseWaterKernelISA(const char* name, WaterKernelISA& isa) {
+    // Spelled out here: without DUCK_X86_KERNELS every ISA maps to the scalar table.
+    const WaterKernelISA isas[] = {
+        WaterKernelISA::Scalar, WaterKernelISA::SSE42, WaterKernelISA::AVX2, WaterKernelISA::AVX512
+    };
+    const char* names[] = { "scalar", "sse4.2", "avx2", "avx512" };
+    for (int i = 0; i < 4; ++i) {
+        if (std::strcmp(name, names[i]) == 0) {
+            isa = isas[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const WaterKernels& selectWaterKernels() {
+    if (overriddenKernels) return *overriddenKernels;
+    static const WaterKernels& selected = []() -> const WaterKernels& {
+        const WaterKernelISA preference[] = {
+            WaterKernelISA::AVX512, WaterKernelISA::AVX2, WaterKernelISA::SSE42
+        };
+        for (WaterKernelISA isa : preference) {
+            if (isWaterKernelISASupported(isa)) return getWaterKernels(isa);
+        }
+        return waterKernelsScalar;
+    }();
+    return selected;
+}
@@ -0,0 +1,94 @@
+#ifndef WATERKERNELS_H
+#define WATERKERNELS_H
+
+#include <cstddef>
+
+// Row kernels for the wave solver. Every variant performs the same floating
+// point operations in the same order as the scalar one, so switching the
+// instruction set never changes the simulation result.
+//
+// The kernels take plain float pointers on purpose: the SIMD variants live in
+// translation units built with extra -m flags and must not instantiate any
+// inline/template code (glm, <algorithm>) that the linker could pick up for
+// the rest of the program.
+
+enum class WaterKernelISA {
+    Scalar,
+    SSE42,
+    AVX2,
+    AVX512
+};
+
+struct WaterKernels {
+    WaterKernelISA isa;
+    const char* name;
+
+    // Leapfrog update of `count` cells. `prev` holds level t-1 on entry and
+    // level t+1 on return; `up`, `mid` and `down` are the level t rows above,
+    // at and below it. mid[-1] and mid[count] must be readable.
+    void (*stencilRow)(float* prev, const float* up, const float* mid, const float* down,
+                       const float* damping, int count, float A, float B);
+
+    // Normals of `count` cells. mid[-1] and mid[count] must be readable; at
+    // the grid border they are the ghost cells of a PaddedGrid, which hold the
+    // clamped neighbours. Writes xyz triples to `normals` and RGBA8 to `rgba`.
+    void (*normalRow)(const float* up, const float* mid, const float* down, int count, float twoH,
+                      float* normals, unsigned char* rgba);
+
+    // Conversions between fp32 rows and the reduced-precision storage formats.
+    // Half floats round to nearest even (as F16C does); int16 values are
+    // value * invScale rounded to nearest even and clamped to [-32767, 32767].
+    void (*halfToFloatRow)(const unsigned short* src, float* dst, int count);
+    void (*floatToHalfRow)(const float* src, unsigned short* dst, int count);
+    void (*int16ToFloatRow)(const short* src, float* dst, int count, float scale);
+    void (*floatToInt16Row)(const float* src, short* dst, int count, float invScale);
+
+    // dst[c] += scale * weights[c], used to stamp disturbance kernels.
+    void (*splatRow)(float* dst, const float* weights, float scale, int count);
+
+    // peaks[c] = max(peaks[c], |next[c]|, |next[c] - current[c]|): how far the
+    // new level is from flat and still water, gathered column by column.
+    void (*peakRow)(const float* next, const float* current, int count, float* peaks);
+
+    // Bilinear heights and normals of an n x n grid at `count` points. `grid`
+    // is cell (0, 0) of a PaddedGrid: rows are `stride` floats apart and the
+    // halo supplies the neighbours of the border cells. `xz` holds world x, z
+    // pairs on a square of side `size` centred on the origin; the results
+    // match WaterSolver::getHeightAt / getNormalAt. `heights` and `normals`
+    // (xyz triples) may be null.
+    void (*samplePoints)(const float* grid, int n, int stride, float size, float twoH, const float* xz, int count,
+                         float* heights, float* normals);
+
+    // Radix-2 butterflies between `rows` consecutive rows of `width` complex
+    // values in a and in b (split real/imaginary): row j uses the twiddle
+    // w[j], t = b * w, b = a - t, a = a + t.
+    void (*butterflyRows)(float* aRe, float* aIm, float* bRe, float* bIm, const float* wRe, const float* wIm,
+                          int rows, int width);
+};
+
+// Scalar reference spans, also used by the SIMD variants for row tails.
+void stencilSpanScalar(float* prev, const float* up, const float* mid, const float* down,
+                       const float* damping, int begin, int end, float A, float B);
+void normalSpanScalar(const float* up, const float* mid, const float* down, int begin, int end,
+                      float twoH, float* normals, unsigned char* rgba);
+void halfToFloatSpanScalar(const unsigned short* src, float* dst, int begin, int end);
+void floatToHalfSpanScalar(const float* src, unsigned short* dst, int begin, int end);
+void int16ToFloatSpanScalar(const short* src, float* dst, int begin, int end, float scale);
+void floatToInt16SpanScalar(const float* src, short* dst, int begin, int end, float invScale);
+void splatSpanScalar(float* dst, const float* weights, float scale, int begin, int end);
+void peakSpanScalar(const float* next, const float* current, int begin, int end, float* peaks);
+void samplePointsSpanScalar(const float* grid, int n, int stride, float size, float twoH, const float* xz,
+                            int begin, int end, float* heights, float* normals);
+void butterflySpanScalar(float* aRe, float* aIm, float* bRe, float* bIm, float wRe, float wIm, int begin, int end);
+
+bool isWaterKernelISASupported(WaterKernelISA isa);
+const WaterKernels& getWaterKernels(WaterKernelISA isa);
+const WaterKernels& selectWaterKernels();
+// Makes selectWaterKernels() return this variant instead of the best one, to
+// compare them in one binary. Only solvers created afterwards pick it up.
+// Returns false, and changes nothing, if the CPU lacks the instruction set.
+bool overrideWaterKernels(WaterKernelISA isa);
+// Looks a variant up by its WaterKernels::name.
+bool parseWaterKernelISA(const char* name, WaterKernelISA& isa);
+
+#endif // WATERKERNELS_H
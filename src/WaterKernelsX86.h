@@ -0,0 +1,36 @@
+#ifndef WATERKERNELSX86_H
+#define WATERKERNELSX86_H
+
+// Helpers shared by the SSE4.2/AVX2/AVX-512 kernel translation units.
+// Everything here has internal linkage so each unit keeps its own copy
+// compiled for its own instruction set.
+
+#include <immintrin.h>
+
+// Interleaves four x, y, z lanes into twelve consecutive floats.
+static inline void storeXYZ4(float* dst, __m128 x, __m128 y, __m128 z) {
+    __m128 xy_lo = _mm_unpacklo_ps(x, y);                               // x0 y0 x1 y1
+    __m128 xy_hi = _mm_unpackhi_ps(x, y);                               // x2 y2 x3 y3
+    __m128 z0x1 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0));        // z0 z0 x1 x1
+    __m128 y1z1 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1));        // y1 y1 z1 z1
+    __m128 z2x3 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2));        // z2 z2 x3 x3
+    __m128 y3z3 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3));        // y3 y3 z3 z3
+    _mm_storeu_ps(dst + 0, _mm_shuffle_ps(xy_lo, z0x1, _MM_SHUFFLE(2, 0, 1, 0)));
+    _mm_storeu_ps(dst + 4, _mm_shuffle_ps(y1z1, xy_hi, _MM_SHUFFLE(1, 0, 2, 0)));
+    _mm_storeu_ps(dst + 8, _mm_shuffle_ps(z2x3, y3z3, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+// Quantizes four unit normals to RGBA8 exactly like the scalar
+// static_cast<unsigned char>((v * 0.5f + 0.5f) * 255.0f), alpha = 255.
+static inline __m128i packRGBA4(__m128 x, __m128 y, __m128 z) {
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    __m128i r = _mm_cvttps_epi32(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(x, half), half), scale));
+    __m128i g = _mm_cvttps_epi32(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(y, half), half), scale));
+    __m128i b = _mm_cvttps_epi32(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(z, half), half), scale));
+    __m128i rgba = _mm_or_si128(r, _mm_slli_epi32(g, 8));
+    rgba = _mm_or_si128(rgba, _mm_slli_epi32(b, 16));
+    return _mm_or_si128(rgba, _mm_set1_epi32(static_cast<int>(0xFF000000u)));
+}
+
+#endif // WATERKERNELSX86_H
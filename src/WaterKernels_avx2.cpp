@@ -0,0 +1,242 @@
+#include "WaterKernels.h"
+#include "WaterKernelsX86.h"
+
+// Built with -mavx2 -mf16c but without -mfma: fused multiply-adds would
+// round differently from the scalar kernel.
+
+static void stencilRowAVX2(float* prev, const float* up, const float* mid, const float* down,
+                           const float* damping, int count, float A, float B) {
+    const __m256 a = _mm256_set1_ps(A);
+    const __m256 b = _mm256_set1_ps(B);
+    int c = 0;
+    for (; c + 8 <= count; c += 8) {
+        __m256 sum = _mm256_add_ps(_mm256_loadu_ps(down + c), _mm256_loadu_ps(up + c));
+        sum = _mm256_add_ps(sum, _mm256_loadu_ps(mid + c + 1));
+        sum = _mm256_add_ps(sum, _mm256_loadu_ps(mid + c - 1));
+        __m256 new_h = _mm256_add_ps(_mm256_mul_ps(a, sum), _mm256_mul_ps(b, _mm256_loadu_ps(mid + c)));
+        new_h = _mm256_sub_ps(new_h, _mm256_loadu_ps(prev + c));
+        _mm256_storeu_ps(prev + c, _mm256_mul_ps(new_h, _mm256_loadu_ps(damping + c)));
+    }
+    stencilSpanScalar(prev, up, mid, down, damping, c, count, A, B);
+}
+
+static void normalRowAVX2(const float* up, const float* mid, const float* down, int count, float twoH,
+                          float* normals, unsigned char* rgba) {
+    const __m256 two_h = _mm256_set1_ps(twoH);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+
+    int c = 0;
+    for (; c + 8 <= count; c += 8) {
+        __m256 x = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(mid + c + 1), _mm256_loadu_ps(mid + c - 1)), two_h);
+        __m256 z = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(down + c), _mm256_loadu_ps(up + c)), two_h);
+        x = _mm256_xor_ps(x, sign);
+        z = _mm256_xor_ps(z, sign);
+        __m256 len_sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), one), _mm256_mul_ps(z, z));
+        __m256 inv_len = _mm256_div_ps(one, _mm256_sqrt_ps(len_sq));
+        x = _mm256_mul_ps(x, inv_len);
+        z = _mm256_mul_ps(z, inv_len);
+
+        __m128 x_lo = _mm256_castps256_ps128(x), x_hi = _mm256_extractf128_ps(x, 1);
+        __m128 y_lo = _mm256_castps256_ps128(inv_len), y_hi = _mm256_extractf128_ps(inv_len, 1);
+        __m128 z_lo = _mm256_castps256_ps128(z), z_hi = _mm256_extractf128_ps(z, 1);
+        storeXYZ4(normals + c * 3, x_lo, y_lo, z_lo);
+        storeXYZ4(normals + c * 3 + 12, x_hi, y_hi, z_hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + c * 4), packRGBA4(x_lo, y_lo, z_lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + c * 4 + 16), packRGBA4(x_hi, y_hi, z_hi));
+    }
+    normalSpanScalar(up, mid, down, c, count, twoH, normals, rgba);
+}
+
+static void halfToFloatRowAVX2(const unsigned short* src, float* dst, int count) {
+    int c = 0;
+    for (; c + 8 <= count; c += 8) {
+        _mm256_storeu_ps(dst + c, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + c))));
+    }
+    halfToFloatSpanScalar(src, dst, c, count);
+}
+
+static void floatToHalfRowAVX2(const float* src, unsigned short* dst, int count) {
+    int c = 0;
+    for (; c + 8 <= count; c += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + c), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + c), h);
+    }
+    floatToHalfSpanScalar(src, dst, c, count);
+}
+
+static void int16ToFloatRowAVX2(const short* src, float* dst, int count, float scale) {
+    const __m256 s = _mm256_set1_ps(scale);
+    int c = 0;
+    for (; c + 8 <= count; c += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + c)));
+        _mm256_storeu_ps(dst + c, _mm256_mul_ps(_mm256_cvtepi32_ps(v), s));
+    }
+    int16ToFloatSpanScalar(src, dst, c, count, scale);
+}
+
+static void floatToInt16RowAVX2(const float* src, short* dst, int count, float invScale) {
+    const __m256 s = _mm256_set1_ps(invScale);
+    const __m256 lo = _mm256_set1_ps(-32767.0f);
+    const __m256 hi = _mm256_set1_ps(32767.0f);
+    int c = 0;
+    for (; c + 8 <= count; c += 8) {
+        __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + c), s), lo), hi);
+        __m256i i = _mm256_cvtps_epi32(v);
+        __m128i packed = _mm_packs_epi32(_mm256_castsi256_si128(i), _mm256_extracti128_si256(i, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + c), packed);
+    }
+    floatToInt16SpanScalar(src, dst, c, count, invScale);
+}
+
+static void splatRowAVX2(float* dst, const float* weights, float scale, int count) {
+    const __m256 s = _mm256_set1_ps(scale);
+    int c = 0;
+    for (; c + 8 <= count; c += 8) {
+        _mm256_storeu_ps(dst + c, _mm256_add_ps(_mm256_loadu_ps(dst + c), _mm256_mul_ps(s, _mm256_loadu_ps(weights + c))));
+    }
+    splatSpanScalar(dst, weights, scale, c, count);
+}
+
+static void peakRowAVX2(const float* next, const float* current, int count, float* peaks) {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    int c = 0;
+    for (; c + 8 <= count; c += 8) {
+        __m256 n = _mm256_loadu_ps(next + c);
+        __m256 peak = _mm256_max_ps(_mm256_loadu_ps(peaks + c), _mm256_andnot_ps(sign, n));
+        peak = _mm256_max_ps(peak, _mm256_andnot_ps(sign, _mm256_sub_ps(n, _mm256_loadu_ps(current + c))));
+        _mm256_storeu_ps(peaks + c, peak);
+    }
+    peakSpanScalar(next, current, c, count, peaks);
+}
+
+static inline __m256 gather(const float* grid, __m256i index) {
+    return _mm256_i32gather_ps(grid, index, 4);
+}
+
+static inline __m256 bilinear(__m256 w00, __m256 w10, __m256 w01, __m256 w11,
+                              __m256 v00, __m256 v10, __m256 v01, __m256 v11) {
+    __m256 sum = _mm256_add_ps(_mm256_mul_ps(w00, v00), _mm256_mul_ps(w10, v10));
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(w01, v01));
+    return _mm256_add_ps(sum, _mm256_mul_ps(w11, v11));
+}
+
+// Normal from the four neighbours of a cell, as in normalSpanScalar().
+static inline void cellNormal(__m256 left, __m256 right, __m256 up, __m256 down, __m256 twoH,
+                              __m256& x, __m256& y, __m256& z) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    x = _mm256_xor_ps(_mm256_div_ps(_mm256_sub_ps(right, left), twoH), sign);
+    z = _mm256_xor_ps(_mm256_div_ps(_mm256_sub_ps(down, up), twoH), sign);
+    y = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), one), _mm256_mul_ps(z, z))));
+    x = _mm256_mul_ps(x, y);
+    z = _mm256_mul_ps(z, y);
+}
+
+static void samplePointsAVX2(const float* grid, int n, int stride, float size, float twoH, const float* xz,
+                             int count, float* heights, float* normals) {
+    const __m256 half_size = _mm256_set1_ps(size / 2.0f);
+    const __m256 sz = _mm256_set1_ps(size);
+    const __m256 scale = _mm256_set1_ps(static_cast<float>(n - 1));
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 two_h = _mm256_set1_ps(twoH);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i max_index = _mm256_set1_epi32(n - 2);
+    const __m256i row_step = _mm256_set1_epi32(stride);
+    const __m256i unit = _mm256_set1_epi32(1);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 a = _mm256_loadu_ps(xz + 2 * i);                          // x0 z0 x1 z1 | x2 z2 x3 z3
+        __m256 b = _mm256_loadu_ps(xz + 2 * i + 8);                      // x4 z4 x5 z5 | x6 z6 x7 z7
+        __m256 xs = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));    // x0 x1 x4 x5 | x2 x3 x6 x7
+        __m256 zs = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        xs = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(xs), _MM_SHUFFLE(3, 1, 2, 0)));
+        zs = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(zs), _MM_SHUFFLE(3, 1, 2, 0)));
+
+        __m256 c_float = _mm256_mul_ps(_mm256_div_ps(_mm256_add_ps(xs, half_size), sz), scale);
+        __m256 r_float = _mm256_mul_ps(_mm256_div_ps(_mm256_add_ps(zs, half_size), sz), scale);
+        __m256i c0 = _mm256_cvttps_epi32(_mm256_floor_ps(c_float));
+        __m256i r0 = _mm256_cvttps_epi32(_mm256_floor_ps(r_float));
+        c0 = _mm256_min_epi32(_mm256_max_epi32(c0, zero), max_index);
+        r0 = _mm256_min_epi32(_mm256_max_epi32(r0, zero), max_index);
+
+        __m256 tx = _mm256_sub_ps(c_float, _mm256_cvtepi32_ps(c0));
+        __m256 ty = _mm256_sub_ps(r_float, _mm256_cvtepi32_ps(r0));
+        __m256 w00 = _mm256_mul_ps(_mm256_sub_ps(one, tx), _mm256_sub_ps(one, ty));
+        __m256 w10 = _mm256_mul_ps(tx, _mm256_sub_ps(one, ty));
+        __m256 w01 = _mm256_mul_ps(_mm256_sub_ps(one, tx), ty);
+        __m256 w11 = _mm256_mul_ps(tx, ty);
+
+        __m256i i00 = _mm256_add_epi32(_mm256_mullo_epi32(r0, row_step), c0);
+        __m256i i10 = _mm256_add_epi32(i00, unit);
+        __m256i i01 = _mm256_add_epi32(i00, row_step);
+        __m256i i11 = _mm256_add_epi32(i01, unit);
+        __m256 h00 = gather(grid, i00);
+        __m256 h10 = gather(grid, i10);
+        __m256 h01 = gather(grid, i01);
+        __m256 h11 = gather(grid, i11);
+
+        if (heights) {
+            _mm256_storeu_ps(heights + i, bilinear(w00, w10, w01, w11, h00, h10, h01, h11));
+        }
+        if (!normals) continue;
+
+        // Neighbours outside the 2x2 block; the halo stands in for them at the border.
+        __m256 x00, y00, z00, x10, y10, z10, x01, y01, z01, x11, y11, z11;
+        cellNormal(gather(grid, _mm256_sub_epi32(i00, unit)), h10, gather(grid, _mm256_sub_epi32(i00, row_step)), h01,
+                   two_h, x00, y00, z00);
+        cellNormal(h00, gather(grid, _mm256_add_epi32(i10, unit)), gather(grid, _mm256_sub_epi32(i10, row_step)), h11,
+                   two_h, x10, y10, z10);
+        cellNormal(gather(grid, _mm256_sub_epi32(i01, unit)), h11, h00, gather(grid, _mm256_add_epi32(i01, row_step)),
+                   two_h, x01, y01, z01);
+        cellNormal(h01, gather(grid, _mm256_add_epi32(i11, unit)), h10, gather(grid, _mm256_add_epi32(i11, row_step)),
+                   two_h, x11, y11, z11);
+
+        __m256 x = bilinear(w00, w10, w01, w11, x00, x10, x01, x11);
+        __m256 y = bilinear(w00, w10, w01, w11, y00, y10, y01, y11);
+        __m256 z = bilinear(w00, w10, w01, w11, z00, z10, z01, z11);
+        __m256 len_sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+        __m256 inv_len = _mm256_div_ps(one, _mm256_sqrt_ps(len_sq));
+        x = _mm256_mul_ps(x, inv_len);
+        y = _mm256_mul_ps(y, inv_len);
+        z = _mm256_mul_ps(z, inv_len);
+        storeXYZ4(normals + 3 * i, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z));
+        storeXYZ4(normals + 3 * i + 12, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1),
+                  _mm256_extractf128_ps(z, 1));
+    }
+    samplePointsSpanScalar(grid, n, stride, size, twoH, xz, i, count, heights, normals);
+}
+
+static void butterflyRowsAVX2(float* aRe, float* aIm, float* bRe, float* bIm, const float* wRe, const float* wIm,
+                             int rows, int width) {
+    for (int j = 0; j < rows; ++j) {
+        size_t offset = static_cast<size_t>(j) * width;
+        float* aReRow = aRe + offset;
+        float* aImRow = aIm + offset;
+        float* bReRow = bRe + offset;
+        float* bImRow = bIm + offset;
+        const __m256 wr = _mm256_set1_ps(wRe[j]);
+        const __m256 wi = _mm256_set1_ps(wIm[j]);
+        int c = 0;
+        for (; c + 8 <= width; c += 8) {
+            __m256 br = _mm256_loadu_ps(bReRow + c);
+            __m256 bi = _mm256_loadu_ps(bImRow + c);
+            __m256 ar = _mm256_loadu_ps(aReRow + c);
+            __m256 ai = _mm256_loadu_ps(aImRow + c);
+            __m256 tr = _mm256_sub_ps(_mm256_mul_ps(br, wr), _mm256_mul_ps(bi, wi));
+            __m256 ti = _mm256_add_ps(_mm256_mul_ps(br, wi), _mm256_mul_ps(bi, wr));
+            _mm256_storeu_ps(bReRow + c, _mm256_sub_ps(ar, tr));
+            _mm256_storeu_ps(bImRow + c, _mm256_sub_ps(ai, ti));
+            _mm256_storeu_ps(aReRow + c, _mm256_add_ps(ar, tr));
+            _mm256_storeu_ps(aImRow + c, _mm256_add_ps(ai, ti));
+        }
+        butterflySpanScalar(aReRow, aImRow, bReRow, bImRow, wRe[j], wIm[j], c, width);
+    }
+}
+
+extern const WaterKernels waterKernelsAVX2 = {
+    WaterKernelISA::AVX2, "avx2", stencilRowAVX2, normalRowAVX2,
+    halfToFloatRowAVX2, floatToHalfRowAVX2, int16ToFloatRowAVX2, floatToInt16RowAVX2,
+    splatRowAVX2, peakRowAVX2, samplePointsAVX2, butterflyRowsAVX2
+};
@@ -0,0 +1,250 @@
+#include "WaterKernels.h"
+#include "WaterKernelsX86.h"
+
+// Built with -mavx512f but without -mfma, see WaterKernels_avx2.cpp.
+
+static inline __m512 negate(__m512 v) {
+    return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(v), _mm512_set1_epi32(static_cast<int>(0x80000000u))));
+}
+
+template <int Q>
+static inline void storeQuarter(float* normals, unsigned char* rgba, __m512 x, __m512 y, __m512 z) {
+    __m128 xq = _mm512_extractf32x4_ps(x, Q);
+    __m128 yq = _mm512_extractf32x4_ps(y, Q);
+    __m128 zq = _mm512_extractf32x4_ps(z, Q);
+    storeXYZ4(normals + Q * 12, xq, yq, zq);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + Q * 16), packRGBA4(xq, yq, zq));
+}
+
+static void stencilRowAVX512(float* prev, const float* up, const float* mid, const float* down,
+                             const float* damping, int count, float A, float B) {
+    const __m512 a = _mm512_set1_ps(A);
+    const __m512 b = _mm512_set1_ps(B);
+    int c = 0;
+    for (; c + 16 <= count; c += 16) {
+        __m512 sum = _mm512_add_ps(_mm512_loadu_ps(down + c), _mm512_loadu_ps(up + c));
+        sum = _mm512_add_ps(sum, _mm512_loadu_ps(mid + c + 1));
+        sum = _mm512_add_ps(sum, _mm512_loadu_ps(mid + c - 1));
+        __m512 new_h = _mm512_add_ps(_mm512_mul_ps(a, sum), _mm512_mul_ps(b, _mm512_loadu_ps(mid + c)));
+        new_h = _mm512_sub_ps(new_h, _mm512_loadu_ps(prev + c));
+        _mm512_storeu_ps(prev + c, _mm512_mul_ps(new_h, _mm512_loadu_ps(damping + c)));
+    }
+    stencilSpanScalar(prev, up, mid, down, damping, c, count, A, B);
+}
+
+static void normalRowAVX512(const float* up, const float* mid, const float* down, int count, float twoH,
+                            float* normals, unsigned char* rgba) {
+    const __m512 two_h = _mm512_set1_ps(twoH);
+    const __m512 one = _mm512_set1_ps(1.0f);
+
+    int c = 0;
+    for (; c + 16 <= count; c += 16) {
+        __m512 x = _mm512_div_ps(_mm512_sub_ps(_mm512_loadu_ps(mid + c + 1), _mm512_loadu_ps(mid + c - 1)), two_h);
+        __m512 z = _mm512_div_ps(_mm512_sub_ps(_mm512_loadu_ps(down + c), _mm512_loadu_ps(up + c)), two_h);
+        x = negate(x);
+        z = negate(z);
+        __m512 len_sq = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(x, x), one), _mm512_mul_ps(z, z));
+        __m512 inv_len = _mm512_div_ps(one, _mm512_sqrt_ps(len_sq));
+        x = _mm512_mul_ps(x, inv_len);
+        z = _mm512_mul_ps(z, inv_len);
+
+        storeQuarter<0>(normals + c * 3, rgba + c * 4, x, inv_len, z);
+        storeQuarter<1>(normals + c * 3, rgba + c * 4, x, inv_len, z);
+        storeQuarter<2>(normals + c * 3, rgba + c * 4, x, inv_len, z);
+        storeQuarter<3>(normals + c * 3, rgba + c * 4, x, inv_len, z);
+    }
+    normalSpanScalar(up, mid, down, c, count, twoH, normals, rgba);
+}
+
+static void halfToFloatRowAVX512(const unsigned short* src, float* dst, int count) {
+    int c = 0;
+    for (; c + 16 <= count; c += 16) {
+        _mm512_storeu_ps(dst + c, _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + c))));
+    }
+    halfToFloatSpanScalar(src, dst, c, count);
+}
+
+static void floatToHalfRowAVX512(const float* src, unsigned short* dst, int count) {
+    int c = 0;
+    for (; c + 16 <= count; c += 16) {
+        __m256i h = _mm512_cvtps_ph(_mm512_loadu_ps(src + c), _MM_FROUND_TO_NEAREST_INT);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + c), h);
+    }
+    floatToHalfSpanScalar(src, dst, c, count);
+}
+
+static void int16ToFloatRowAVX512(const short* src, float* dst, int count, float scale) {
+    const __m512 s = _mm512_set1_ps(scale);
+    int c = 0;
+    for (; c + 16 <= count; c += 16) {
+        __m512i v = _mm512_cvtepi16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + c)));
+        _mm512_storeu_ps(dst + c, _mm512_mul_ps(_mm512_cvtepi32_ps(v), s));
+    }
+    int16ToFloatSpanScalar(src, dst, c, count, scale);
+}
+
+static void floatToInt16RowAVX512(const float* src, short* dst, int count, float invScale) {
+    const __m512 s = _mm512_set1_ps(invScale);
+    const __m512 lo = _mm512_set1_ps(-32767.0f);
+    const __m512 hi = _mm512_set1_ps(32767.0f);
+    int c = 0;
+    for (; c + 16 <= count; c += 16) {
+        __m512 v = _mm512_min_ps(_mm512_max_ps(_mm512_mul_ps(_mm512_loadu_ps(src + c), s), lo), hi);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + c), _mm512_cvtsepi32_epi16(_mm512_cvtps_epi32(v)));
+    }
+    floatToInt16SpanScalar(src, dst, c, count, invScale);
+}
+
+static void splatRowAVX512(float* dst, const float* weights, float scale, int count) {
+    const __m512 s = _mm512_set1_ps(scale);
+    int c = 0;
+    for (; c + 16 <= count; c += 16) {
+        _mm512_storeu_ps(dst + c, _mm512_add_ps(_mm512_loadu_ps(dst + c), _mm512_mul_ps(s, _mm512_loadu_ps(weights + c))));
+    }
+    splatSpanScalar(dst, weights, scale, c, count);
+}
+
+static void peakRowAVX512(const float* next, const float* current, int count, float* peaks) {
+    const __m512i magnitude = _mm512_set1_epi32(0x7FFFFFFF);
+    int c = 0;
+    for (; c + 16 <= count; c += 16) {
+        __m512 n = _mm512_loadu_ps(next + c);
+        __m512 d = _mm512_sub_ps(n, _mm512_loadu_ps(current + c));
+        __m512 peak = _mm512_max_ps(_mm512_loadu_ps(peaks + c),
+                                    _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(n), magnitude)));
+        peak = _mm512_max_ps(peak, _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(d), magnitude)));
+        _mm512_storeu_ps(peaks + c, peak);
+    }
+    peakSpanScalar(next, current, c, count, peaks);
+}
+
+static inline __m512 gather(const float* grid, __m512i index) {
+    return _mm512_i32gather_ps(index, grid, 4);
+}
+
+static inline __m512 bilinear(__m512 w00, __m512 w10, __m512 w01, __m512 w11,
+                              __m512 v00, __m512 v10, __m512 v01, __m512 v11) {
+    __m512 sum = _mm512_add_ps(_mm512_mul_ps(w00, v00), _mm512_mul_ps(w10, v10));
+    sum = _mm512_add_ps(sum, _mm512_mul_ps(w01, v01));
+    return _mm512_add_ps(sum, _mm512_mul_ps(w11, v11));
+}
+
+// Normal from the four neighbours of a cell, as in normalSpanScalar().
+static inline void cellNormal(__m512 left, __m512 right, __m512 up, __m512 down, __m512 twoH,
+                              __m512& x, __m512& y, __m512& z) {
+    const __m512 one = _mm512_set1_ps(1.0f);
+    x = negate(_mm512_div_ps(_mm512_sub_ps(right, left), twoH));
+    z = negate(_mm512_div_ps(_mm512_sub_ps(down, up), twoH));
+    y = _mm512_div_ps(one, _mm512_sqrt_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(x, x), one), _mm512_mul_ps(z, z))));
+    x = _mm512_mul_ps(x, y);
+    z = _mm512_mul_ps(z, y);
+}
+
+static void samplePointsAVX512(const float* grid, int n, int stride, float size, float twoH, const float* xz,
+                               int count, float* heights, float* normals) {
+    const __m512 half_size = _mm512_set1_ps(size / 2.0f);
+    const __m512 sz = _mm512_set1_ps(size);
+    const __m512 scale = _mm512_set1_ps(static_cast<float>(n - 1));
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 two_h = _mm512_set1_ps(twoH);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i max_index = _mm512_set1_epi32(n - 2);
+    const __m512i row_step = _mm512_set1_epi32(stride);
+    const __m512i unit = _mm512_set1_epi32(1);
+    const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i odd = _mm512_add_epi32(even, unit);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512 a = _mm512_loadu_ps(xz + 2 * i);
+        __m512 b = _mm512_loadu_ps(xz + 2 * i + 16);
+        __m512 xs = _mm512_permutex2var_ps(a, even, b);
+        __m512 zs = _mm512_permutex2var_ps(a, odd, b);
+
+        __m512 c_float = _mm512_mul_ps(_mm512_div_ps(_mm512_add_ps(xs, half_size), sz), scale);
+        __m512 r_float = _mm512_mul_ps(_mm512_div_ps(_mm512_add_ps(zs, half_size), sz), scale);
+        __m512i c0 = _mm512_cvttps_epi32(_mm512_roundscale_ps(c_float, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC));
+        __m512i r0 = _mm512_cvttps_epi32(_mm512_roundscale_ps(r_float, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC));
+        c0 = _mm512_min_epi32(_mm512_max_epi32(c0, zero), max_index);
+        r0 = _mm512_min_epi32(_mm512_max_epi32(r0, zero), max_index);
+
+        __m512 tx = _mm512_sub_ps(c_float, _mm512_cvtepi32_ps(c0));
+        __m512 ty = _mm512_sub_ps(r_float, _mm512_cvtepi32_ps(r0));
+        __m512 w00 = _mm512_mul_ps(_mm512_sub_ps(one, tx), _mm512_sub_ps(one, ty));
+        __m512 w10 = _mm512_mul_ps(tx, _mm512_sub_ps(one, ty));
+        __m512 w01 = _mm512_mul_ps(_mm512_sub_ps(one, tx), ty);
+        __m512 w11 = _mm512_mul_ps(tx, ty);
+
+        __m512i i00 = _mm512_add_epi32(_mm512_mullo_epi32(r0, row_step), c0);
+        __m512i i10 = _mm512_add_epi32(i00, unit);
+        __m512i i01 = _mm512_add_epi32(i00, row_step);
+        __m512i i11 = _mm512_add_epi32(i01, unit);
+        __m512 h00 = gather(grid, i00);
+        __m512 h10 = gather(grid, i10);
+        __m512 h01 = gather(grid, i01);
+        __m512 h11 = gather(grid, i11);
+
+        if (heights) {
+            _mm512_storeu_ps(heights + i, bilinear(w00, w10, w01, w11, h00, h10, h01, h11));
+        }
+        if (!normals) continue;
+
+        // Neighbours outside the 2x2 block; the halo stands in for them at the border.
+        __m512 x00, y00, z00, x10, y10, z10, x01, y01, z01, x11, y11, z11;
+        cellNormal(gather(grid, _mm512_sub_epi32(i00, unit)), h10, gather(grid, _mm512_sub_epi32(i00, row_step)), h01,
+                   two_h, x00, y00, z00);
+        cellNormal(h00, gather(grid, _mm512_add_epi32(i10, unit)), gather(grid, _mm512_sub_epi32(i10, row_step)), h11,
+                   two_h, x10, y10, z10);
+        cellNormal(gather(grid, _mm512_sub_epi32(i01, unit)), h11, h00, gather(grid, _mm512_add_epi32(i01, row_step)),
+                   two_h, x01, y01, z01);
+        cellNormal(h01, gather(grid, _mm512_add_epi32(i11, unit)), h10, gather(grid, _mm512_add_epi32(i11, row_step)),
+                   two_h, x11, y11, z11);
+
+        __m512 x = bilinear(w00, w10, w01, w11, x00, x10, x01, x11);
+        __m512 y = bilinear(w00, w10, w01, w11, y00, y10, y01, y11);
+        __m512 z = bilinear(w00, w10, w01, w11, z00, z10, z01, z11);
+        __m512 len_sq = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(x, x), _mm512_mul_ps(y, y)), _mm512_mul_ps(z, z));
+        __m512 inv_len = _mm512_div_ps(one, _mm512_sqrt_ps(len_sq));
+        x = _mm512_mul_ps(x, inv_len);
+        y = _mm512_mul_ps(y, inv_len);
+        z = _mm512_mul_ps(z, inv_len);
+        storeXYZ4(normals + 3 * i, _mm512_extractf32x4_ps(x, 0), _mm512_extractf32x4_ps(y, 0), _mm512_extractf32x4_ps(z, 0));
+        storeXYZ4(normals + 3 * i + 12, _mm512_extractf32x4_ps(x, 1), _mm512_extractf32x4_ps(y, 1), _mm512_extractf32x4_ps(z, 1));
+        storeXYZ4(normals + 3 * i + 24, _mm512_extractf32x4_ps(x, 2), _mm512_extractf32x4_ps(y, 2), _mm512_extractf32x4_ps(z, 2));
+        storeXYZ4(normals + 3 * i + 36, _mm512_extractf32x4_ps(x, 3), _mm512_extractf32x4_ps(y, 3), _mm512_extractf32x4_ps(z, 3));
+    }
+    samplePointsSpanScalar(grid, n, stride, size, twoH, xz, i, count, heights, normals);
+}
+
+static void butterflyRowsAVX512(float* aRe, float* aIm, float* bRe, float* bIm, const float* wRe, const float* wIm,
+                             int rows, int width) {
+    for (int j = 0; j < rows; ++j) {
+        size_t offset = static_cast<size_t>(j) * width;
+        float* aReRow = aRe + offset;
+        float* aImRow = aIm + offset;
+        float* bReRow = bRe + offset;
+        float* bImRow = bIm + offset;
+        const __m512 wr = _mm512_set1_ps(wRe[j]);
+        const __m512 wi = _mm512_set1_ps(wIm[j]);
+        int c = 0;
+        for (; c + 16 <= width; c += 16) {
+            __m512 br = _mm512_loadu_ps(bReRow + c);
+            __m512 bi = _mm512_loadu_ps(bImRow + c);
+            __m512 ar = _mm512_loadu_ps(aReRow + c);
+            __m512 ai = _mm512_loadu_ps(aImRow + c);
+            __m512 tr = _mm512_sub_ps(_mm512_mul_ps(br, wr), _mm512_mul_ps(bi, wi));
+            __m512 ti = _mm512_add_ps(_mm512_mul_ps(br, wi), _mm512_mul_ps(bi, wr));
+            _mm512_storeu_ps(bReRow + c, _mm512_sub_ps(ar, tr));
+            _mm512_storeu_ps(bImRow + c, _mm512_sub_ps(ai, ti));
+            _mm512_storeu_ps(aReRow + c, _mm512_add_ps(ar, tr));
+            _mm512_storeu_ps(aImRow + c, _mm512_add_ps(ai, ti));
+        }
+        butterflySpanScalar(aReRow, aImRow, bReRow, bImRow, wRe[j], wIm[j], c, width);
+    }
+}
+
+extern const WaterKernels waterKernelsAVX512 = {
+    WaterKernelISA::AVX512, "avx512", stencilRowAVX512, normalRowAVX512,
+    halfToFloatRowAVX512, floatToHalfRowAVX512, int16ToFloatRowAVX512, floatToInt16RowAVX512,
+    splatRowAVX512, peakRowAVX512, samplePointsAVX512, butterflyRowsAVX512
+};
@@ -0,0 +1,134 @@
+#include "WaterKernels.h"
+#include "WaterKernelsX86.h"
+
+static void stencilRowSSE42(float* prev, const float* up, const float* mid, const float* down,
+                            const float* damping, int count, float A, float B) {
+    const __m128 a = _mm_set1_ps(A);
+    const __m128 b = _mm_set1_ps(B);
+    int c = 0;
+    for (; c + 4 <= count; c += 4) {
+        __m128 sum = _mm_add_ps(_mm_loadu_ps(down + c), _mm_loadu_ps(up + c));
+        sum = _mm_add_ps(sum, _mm_loadu_ps(mid + c + 1));
+        sum = _mm_add_ps(sum, _mm_loadu_ps(mid + c - 1));
+        __m128 new_h = _mm_add_ps(_mm_mul_ps(a, sum), _mm_mul_ps(b, _mm_loadu_ps(mid + c)));
+        new_h = _mm_sub_ps(new_h, _mm_loadu_ps(prev + c));
+        _mm_storeu_ps(prev + c, _mm_mul_ps(new_h, _mm_loadu_ps(damping + c)));
+    }
+    stencilSpanScalar(prev, up, mid, down, damping, c, count, A, B);
+}
+
+static void normalRowSSE42(const float* up, const float* mid, const float* down, int count, float twoH,
+                           float* normals, unsigned char* rgba) {
+    const __m128 two_h = _mm_set1_ps(twoH);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+
+    int c = 0;
+    for (; c + 4 <= count; c += 4) {
+        __m128 x = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(mid + c + 1), _mm_loadu_ps(mid + c - 1)), two_h);
+        __m128 z = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(down + c), _mm_loadu_ps(up + c)), two_h);
+        x = _mm_xor_ps(x, sign);
+        z = _mm_xor_ps(z, sign);
+        __m128 len_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), one), _mm_mul_ps(z, z));
+        __m128 inv_len = _mm_div_ps(one, _mm_sqrt_ps(len_sq));
+        x = _mm_mul_ps(x, inv_len);
+        z = _mm_mul_ps(z, inv_len);
+
+        storeXYZ4(normals + c * 3, x, inv_len, z);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + c * 4), packRGBA4(x, inv_len, z));
+    }
+    normalSpanScalar(up, mid, down, c, count, twoH, normals, rgba);
+}
+
+static void halfToFloatRowSSE42(const unsigned short* src, float* dst, int count) {
+    // No F16C before AVX: half floats are converted by the scalar code.
+    halfToFloatSpanScalar(src, dst, 0, count);
+}
+
+static void floatToHalfRowSSE42(const float* src, unsigned short* dst, int count) {
+    floatToHalfSpanScalar(src, dst, 0, count);
+}
+
+static void int16ToFloatRowSSE42(const short* src, float* dst, int count, float scale) {
+    const __m128 s = _mm_set1_ps(scale);
+    int c = 0;
+    for (; c + 4 <= count; c += 4) {
+        __m128i v = _mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + c)));
+        _mm_storeu_ps(dst + c, _mm_mul_ps(_mm_cvtepi32_ps(v), s));
+    }
+    int16ToFloatSpanScalar(src, dst, c, count, scale);
+}
+
+static void floatToInt16RowSSE42(const float* src, short* dst, int count, float invScale) {
+    const __m128 s = _mm_set1_ps(invScale);
+    const __m128 lo = _mm_set1_ps(-32767.0f);
+    const __m128 hi = _mm_set1_ps(32767.0f);
+    int c = 0;
+    for (; c + 8 <= count; c += 8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + c), s), lo), hi);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + c + 4), s), lo), hi);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + c), packed);
+    }
+    floatToInt16SpanScalar(src, dst, c, count, invScale);
+}
+
+static void splatRowSSE42(float* dst, const float* weights, float scale, int count) {
+    const __m128 s = _mm_set1_ps(scale);
+    int c = 0;
+    for (; c + 4 <= count; c += 4) {
+        _mm_storeu_ps(dst + c, _mm_add_ps(_mm_loadu_ps(dst + c), _mm_mul_ps(s, _mm_loadu_ps(weights + c))));
+    }
+    splatSpanScalar(dst, weights, scale, c, count);
+}
+
+static void peakRowSSE42(const float* next, const float* current, int count, float* peaks) {
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    int c = 0;
+    for (; c + 4 <= count; c += 4) {
+        __m128 n = _mm_loadu_ps(next + c);
+        __m128 peak = _mm_max_ps(_mm_loadu_ps(peaks + c), _mm_andnot_ps(sign, n));
+        peak = _mm_max_ps(peak, _mm_andnot_ps(sign, _mm_sub_ps(n, _mm_loadu_ps(current + c))));
+        _mm_storeu_ps(peaks + c, peak);
+    }
+    peakSpanScalar(next, current, c, count, peaks);
+}
+
+// SSE4.2 has no gather, so point sampling stays scalar.
+static void samplePointsSSE42(const float* grid, int n, int stride, float size, float twoH, const float* xz,
+                              int count, float* heights, float* normals) {
+    samplePointsSpanScalar(grid, n, stride, size, twoH, xz, 0, count, heights, normals);
+}
+
+static void butterflyRowsSSE42(float* aRe, float* aIm, float* bRe, float* bIm, const float* wRe, const float* wIm,
+                             int rows, int width) {
+    for (int j = 0; j < rows; ++j) {
+        size_t offset = static_cast<size_t>(j) * width;
+        float* aReRow = aRe + offset;
+        float* aImRow = aIm + offset;
+        float* bReRow = bRe + offset;
+        float* bImRow = bIm + offset;
+        const __m128 wr = _mm_set1_ps(wRe[j]);
+        const __m128 wi = _mm_set1_ps(wIm[j]);
+        int c = 0;
+        for (; c + 4 <= width; c += 4) {
+            __m128 br = _mm_loadu_ps(bReRow + c);
+            __m128 bi = _mm_loadu_ps(bImRow + c);
+            __m128 ar = _mm_loadu_ps(aReRow + c);
+            __m128 ai = _mm_loadu_ps(aImRow + c);
+            __m128 tr = _mm_sub_ps(_mm_mul_ps(br, wr), _mm_mul_ps(bi, wi));
+            __m128 ti = _mm_add_ps(_mm_mul_ps(br, wi), _mm_mul_ps(bi, wr));
+            _mm_storeu_ps(bReRow + c, _mm_sub_ps(ar, tr));
+            _mm_storeu_ps(bImRow + c, _mm_sub_ps(ai, ti));
+            _mm_storeu_ps(aReRow + c, _mm_add_ps(ar, tr));
+            _mm_storeu_ps(aImRow + c, _mm_add_ps(ai, ti));
+        }
+        butterflySpanScalar(aReRow, aImRow, bReRow, bImRow, wRe[j], wIm[j], c, width);
+    }
+}
+
+extern const WaterKernels waterKernelsSSE42 = {
+    WaterKernelISA::SSE42, "sse4.2", stencilRowSSE42, normalRowSSE42,
+    halfToFloatRowSSE42, floatToHalfRowSSE42, int16ToFloatRowSSE42, floatToInt16RowSSE42,
+    splatRowSSE42, peakRowSSE42, samplePointsSSE42, butterflyRowsSSE42
+};
@@ -1,267 +1,267 @@
 #include "WaterSimulator.h"
+#include "FrameProfiler.h"
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <chrono>
+#include <functional>
 
-WaterSimulator::WaterSimulator(int gridN, float physicalSize) :
+WaterSimulator::WaterSimulator(int gridN, float physicalSize, int threadCount, HeightPrecision heightPrecision) :
+    solver(gridN, physicalSize, threadCount, heightPrecision),
     N(gridN),
-    size(physicalSize),
-    rng(std::random_device{}()),
-    distN(0, gridN),
-    distProb(0.0f, 1.0f) {
-
-    h = size / (static_cast<float>(N));
-    C_const = 1.0f;
-    dt_sim = (1.0f / static_cast<float>(N));
-
-    float dt_sim_sq = dt_sim * dt_sim;
-    float h_sq = h * h;
-    float C_const_sq = C_const * C_const;
-
-    A_const = (C_const_sq * dt_sim_sq) / h_sq;
-    B_const = 2.0f - 4.0f * A_const;
-
-    std::cout << "WaterSim N=" << N << ", size=" << size << ", h=" << h << ", dt_sim=" << dt_sim << std::endl;
-    std::cout << "WaterSim A=" << A_const << ", B=" << B_const << std::endl;
-    float stability_check = (C_const_sq * dt_sim_sq) / h_sq;
-    std::cout << "Stability Check (c^2*dt^2/h^2) = " << stability_check << " (should be <= 0.5)" << std::endl;
-    if (stability_check > 0.5f) {
-        std::cerr << "WARNING: Simulation might be unstable!" << std::endl;
-    }
-
-    currentHeights.resize(N * N, 0.0f);
-    previousHeights.resize(N * N, 0.0f);
-    dampingFactors.resize(N * N, 1.0f);
-    normals.resize(N * N, glm::vec3(0.0f, 1.0f, 0.0f));
-    normalmapData.resize(N * N * 4, 0);
-
-    initializeGrid();
+    precision(heightPrecision),
+    tileSize(WaterSolver::getTileSize()),
+    tilesPerSide(solver.getTilesPerSide()) {
     setupTextures();
+    setupUploadBuffers();
 }
 
 WaterSimulator::~WaterSimulator() {
+    solver.stopAsync();
     glDeleteTextures(1, &heightmapTexture);
-    glDeleteTextures(1, &normalmapTexture);
-}
-
-void WaterSimulator::initializeGrid() {
-    for (int r = 0; r < N; ++r) {
-        for (int c = 0; c < N; ++c) {
-            getHeight(currentHeights, r, c) = 0.0f;
-            getHeight(previousHeights, r, c) = 0.0f;
-        }
-    }
-    initializeDampingFactors();
-}
-
-void WaterSimulator::initializeDampingFactors() {
-    float square_half_size = size / 2.0f;
-
-    for (int r = 0; r < N; ++r) {
-        for (int c = 0; c < N; ++c) {
-            float norm_x = static_cast<float>(c) / (N - 1);
-            float norm_y = static_cast<float>(r) / (N - 1);
-
-            float phys_x = -square_half_size + norm_x * size;
-            float phys_y_coord = -square_half_size + norm_y * size;
-
-            float dist_to_left_edge   = std::abs(phys_x - (-square_half_size));
-            float dist_to_right_edge  = std::abs(phys_x - square_half_size);
-            float dist_to_bottom_edge = std::abs(phys_y_coord - (-square_half_size));
-            float dist_to_top_edge    = std::abs(phys_y_coord - square_half_size);
-
-            float l = std::min({dist_to_left_edge, dist_to_right_edge, dist_to_bottom_edge, dist_to_top_edge});
-
-            getDamping(r, c) = 0.95f * std::min(1.0f, l / 0.2f);
-            if (r == 0 || r == N - 1 || c == 0 || c == N - 1) {
-                 getDamping(r,c) = 0.95f;
-            }
-        }
+    if (normalmapTexture) glDeleteTextures(1, &normalmapTexture);
+    for (int i = 0; i < uploadRingSize; ++i) {
+        if (uploadFences[i]) glDeleteSync(uploadFences[i]);
     }
+    if (uploadBuffers[0]) glDeleteBuffers(uploadRingSize, uploadBuffers);
 }
 
 void WaterSimulator::setupTextures() {
     glGenTextures(1, &heightmapTexture);
     glBindTexture(GL_TEXTURE_2D, heightmapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, N, N, 0, GL_RED, GL_FLOAT, nullptr);
+    if (precision == HeightPrecision::Float16) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, N, N, 0, GL_RED, GL_HALF_FLOAT, nullptr);
+    } else if (precision == HeightPrecision::Int16) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R16_SNORM, N, N, 0, GL_RED, GL_SHORT, nullptr);
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, N, N, 0, GL_RED, GL_FLOAT, nullptr);
+    }
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    glGenTextures(1, &normalmapTexture);
-    glBindTexture(GL_TEXTURE_2D, normalmapTexture);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-    std::fill(normalmapData.begin(), normalmapData.end(), 0);
-    for(size_t i = 0; i < N * N; ++i) {
-        normalmapData[i*4 + 0] = 127;
-        normalmapData[i*4 + 1] = 255;
-        normalmapData[i*4 + 2] = 127;
-        normalmapData[i*4 + 3] = 255;
+GLuint WaterSimulator::getNormalmapTextureID() {
+    if (normalmapTexture) return normalmapTexture;
+
+    // First request: create the texture flat and have the solver start
+    // producing normals from the next step on.
+    std::vector<unsigned char> flat(static_cast<size_t>(N) * N * 4);
+    for (size_t i = 0; i < flat.size(); i += 4) {
+        flat[i + 0] = 127;
+        flat[i + 1] = 255;
+        flat[i + 2] = 127;
+        flat[i + 3] = 255;
     }
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, N, N, 0, GL_RGBA, GL_UNSIGNED_BYTE, normalmapData.data()); // [cite: 9]
+    glGenTextures(1, &normalmapTexture);
+    glBindTexture(GL_TEXTURE_2D, normalmapTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, N, N, 0, GL_RGBA, GL_UNSIGNED_BYTE, flat.data());
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
     glBindTexture(GL_TEXTURE_2D, 0);
-}
-
-void WaterSimulator::updateTextures() {
-    glBindTexture(GL_TEXTURE_2D, heightmapTexture);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, N, N, GL_RED, GL_FLOAT, currentHeights.data());
 
-    glBindTexture(GL_TEXTURE_2D, normalmapTexture);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, N, N, GL_RGBA, GL_UNSIGNED_BYTE, normalmapData.data());
-
-    glBindTexture(GL_TEXTURE_2D, 0);
+    solver.requestNormalMap();
+    return normalmapTexture;
 }
 
-
-void WaterSimulator::simulateWaterSurface() {
-    std::vector<float> nextHeights = currentHeights;
-
-    for (int r = 1; r < N - 1; ++r) {
-        for (int c = 1; c < N - 1; ++c) {
-            float sum_neighbors = getHeight(currentHeights, r + 1, c) +
-                                  getHeight(currentHeights, r - 1, c) +
-                                  getHeight(currentHeights, r, c + 1) +
-                                  getHeight(currentHeights, r, c - 1);
-
-            float new_h = A_const * sum_neighbors +
-                          B_const * getHeight(currentHeights, r, c) -
-                          getHeight(previousHeights, r, c);
-
-            getHeight(nextHeights, r, c) = new_h * getDamping(r,c);
+void WaterSimulator::setupUploadBuffers() {
+    // Persistent mapping needs GL 4.4; without it uploadTextures() reads client memory directly.
+    if (!GLAD_GL_VERSION_4_4) return;
+
+    size_t heightBytes = static_cast<size_t>(N) * N * (precision == HeightPrecision::Float32 ? 4 : 2);
+    uploadNormalOffset = (heightBytes + 255) & ~static_cast<size_t>(255);
+    size_t slotBytes = uploadNormalOffset + static_cast<size_t>(N) * N * 4;
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(uploadRingSize, uploadBuffers);
+    for (int i = 0; i < uploadRingSize; ++i) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadBuffers[i]);
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, slotBytes, nullptr, flags);
+        uploadMapped[i] = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slotBytes, flags));
+        if (!uploadMapped[i]) {
+            std::cerr << "WaterSim: persistent upload buffer mapping failed, uploading from client memory" << std::endl;
+            // Deleting a buffer also unmaps it.
+            glDeleteBuffers(uploadRingSize, uploadBuffers);
+            std::fill(uploadBuffers, uploadBuffers + uploadRingSize, 0);
+            std::fill(uploadMapped, uploadMapped + uploadRingSize, nullptr);
+            break;
         }
     }
-
-    previousHeights = currentHeights;
-    currentHeights = nextHeights;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
-void WaterSimulator::calculateNormals() {
-    for (int r = 0; r < N; ++r) {
-        for (int c = 0; c < N; ++c) {
-            float grad_x = (getHeight(currentHeights, r, std::min(N - 1, c + 1)) - getHeight(currentHeights, r, std::max(0, c - 1))) / (2.0f*h);
-            float grad_z = (getHeight(currentHeights, std::min(N - 1, r + 1), c) - getHeight(currentHeights, std::max(0, r - 1), c)) / (2.0f*h);
-
-            glm::vec3 normal = glm::normalize(glm::vec3(-grad_x, 1.0f, -grad_z));
-
-            normals[r * N + c] = normal;
-
-            normalmapData[(r * N + c) * 4 + 0] = static_cast<unsigned char>((normal.x * 0.5f + 0.5f) * 255.0f);
-            normalmapData[(r * N + c) * 4 + 1] = static_cast<unsigned char>((normal.y * 0.5f + 0.5f) * 255.0f);
-            normalmapData[(r * N + c) * 4 + 2] = static_cast<unsigned char>((normal.z * 0.5f + 0.5f) * 255.0f);
-            normalmapData[(r * N + c) * 4 + 3] = 255;
-        }
+void WaterSimulator::waitForUploadSlot(int slot) {
+    GLsync fence = uploadFences[slot];
+    uploadStats.lastFenceWaitSeconds = 0.0;
+    if (!fence) return;
+
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        // The GPU is still reading this slot: a CPU/GPU serialization stall.
+        auto start = std::chrono::steady_clock::now();
+        do {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        } while (status == GL_TIMEOUT_EXPIRED);
+        double waited = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        uploadStats.lastFenceWaitSeconds = waited;
+        uploadStats.fenceWaitSeconds += waited;
+        ++uploadStats.fenceStalls;
     }
+    glDeleteSync(fence);
+    uploadFences[slot] = nullptr;
 }
 
-void WaterSimulator::createRaindrop() {
-    if (distProb(rng) < raindropProbability) {
-        int r = distN(rng);
-        int c = distN(rng);
-
-        r = std::max(1, std::min(N - 2, r));
-        c = std::max(1, std::min(N - 2, c));
-
-        getHeight(currentHeights, r, c) += raindropMagnitude;
+void WaterSimulator::updateSimulation(int substeps) {
+    bool advanced;
+    {
+        // Includes the normal pass, which is fused into the last step; in
+        // async mode this only hands the steps to the worker.
+        DUCK_PROFILE_CPU("sim step");
+        advanced = solver.advance(substeps);
     }
-}
-
-void WaterSimulator::updateSimulation() {
-    simulateWaterSurface();
-    calculateNormals();
-    updateTextures();
-}
-
-void WaterSimulator::createDisturbance(float worldX, float worldZ, float magnitude) {
-    float normX = (worldX + size / 2.0f) / size;
-    float normZ = (worldZ + size / 2.0f) / size;
-
-    int c = static_cast<int>(normX * (N - 1));
-    int r = static_cast<int>(normZ * (N - 1));
-
-    r = std::max(1, std::min(N - 2, r));
-    c = std::max(1, std::min(N - 2, c));
-
-    if (r >= 0 && r < N && c >= 0 && c < N) {
-        getHeight(currentHeights, r, c) += magnitude;
+    if (!advanced) return;
+    WaterSolverFrame frame = solver.getFrame();
+    {
+        DUCK_PROFILE_GPU("texture upload");
+        uploadTextures(frame);
     }
 }
 
-float WaterSimulator::getHeightAt(float worldX, float worldZ) const {
-    float normX = (worldX + size / 2.0f) / size;
-    float normZ = (worldZ + size / 2.0f) / size;
-
-    float c_float = normX * (N - 1);
-    float r_float = normZ * (N - 1);
-
-    int r0 = static_cast<int>(floor(r_float));
-    int c0 = static_cast<int>(floor(c_float));
-
-    r0 = std::max(0, std::min(N - 2, r0));
-    c0 = std::max(0, std::min(N - 2, c0));
-
-    int r1 = r0 + 1;
-    int c1 = c0 + 1;
-
-    float tx = c_float - c0;
-    float ty = r_float - r0;
+void WaterSimulator::uploadTextures(const WaterSolverFrame& frame) {
+    ++uploadStats.uploads;
+    bool full = !findDirtyTiles(frame);
+    if (!full && dirtyTiles.empty()) return;
+
+    size_t bytesPerHeight = precision == HeightPrecision::Float32 ? 4 : 2;
+    const unsigned char* heightBytes = precision == HeightPrecision::Float32
+        ? reinterpret_cast<const unsigned char*>(frame.heights)
+        : reinterpret_cast<const unsigned char*>(frame.packedHeights);
+    const unsigned char* normalmap = frame.normalmap;
+    size_t heightStride = static_cast<size_t>(frame.heightStride);
+
+    // Every rectangle keeps the full-frame layout, both in client memory and
+    // in the PBO slot, so one offset formula per layout serves all. The PBO
+    // slot and the normal map have rows of N texels; the frame's height rows
+    // are heightStride apart, which is more than N for the padded fp32 grid.
+    auto forEachRect = [&](const std::function<void(int, int, int, int)>& fn) {
+        if (full) {
+            fn(0, 0, N, N);
+            return;
+        }
+        for (int tile : dirtyTiles) {
+            int x = (tile % tilesPerSide) * tileSize;
+            int y = (tile / tilesPerSide) * tileSize;
+            fn(x, y, std::min(tileSize, N - x), std::min(tileSize, N - y));
+        }
+    };
+
+    int slot = uploadSlot;
+    unsigned char* staging = uploadMapped[slot];
+    if (staging) {
+        // Copy into the next slot of the ring; the driver then streams from the
+        // PBO asynchronously instead of copying client memory inside glTexSubImage2D.
+        waitForUploadSlot(slot);
+        forEachRect([&](int x, int y, int cols, int rows) {
+            for (int r = y; r < y + rows; ++r) {
+                size_t texel = static_cast<size_t>(r) * N + x;
+                std::memcpy(staging + texel * bytesPerHeight, heightBytes + (r * heightStride + x) * bytesPerHeight,
+                            cols * bytesPerHeight);
+                if (normalmap) {
+                    std::memcpy(staging + uploadNormalOffset + texel * 4, normalmap + texel * 4, cols * 4);
+                }
+            }
+        });
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadBuffers[slot]);
+    }
+    const unsigned char* heightBase = staging ? nullptr : heightBytes;
+    const unsigned char* normalBase = staging ? reinterpret_cast<const unsigned char*>(uploadNormalOffset) : normalmap;
 
-    float h00 = getHeight(currentHeights, r0, c0);
-    float h10 = getHeight(currentHeights, r0, c1);
-    float h01 = getHeight(currentHeights, r1, c0);
-    float h11 = getHeight(currentHeights, r1, c1);
+    size_t heightRowLength = staging ? static_cast<size_t>(N) : heightStride;
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, static_cast<GLint>(heightRowLength));
+    glBindTexture(GL_TEXTURE_2D, heightmapTexture);
+    // 16-bit rows of odd N are not 4-byte aligned.
+    if (bytesPerHeight == 2) glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    GLenum heightType = precision == HeightPrecision::Float32 ? GL_FLOAT :
+                        precision == HeightPrecision::Float16 ? GL_HALF_FLOAT : GL_SHORT;
+    forEachRect([&](int x, int y, int cols, int rows) {
+        size_t texel = y * heightRowLength + x;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, cols, rows, GL_RED, heightType, heightBase + texel * bytesPerHeight);
+    });
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (normalmap) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, N);
+        glBindTexture(GL_TEXTURE_2D, normalmapTexture);
+        forEachRect([&](int x, int y, int cols, int rows) {
+            size_t texel = static_cast<size_t>(y) * N + x;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, cols, rows, GL_RGBA, GL_UNSIGNED_BYTE, normalBase + texel * 4);
+        });
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 
-    float height = (1 - tx) * (1 - ty) * h00 +
-                   tx * (1 - ty) * h10 +
-                   (1 - tx) * ty * h01 +
-                   tx * ty * h11;
-    return height;
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (staging) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        uploadFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        uploadSlot = (slot + 1) % uploadRingSize;
+    }
+    if (full) {
+        ++uploadStats.fullUploads;
+    } else {
+        uploadStats.tilesUploaded += dirtyTiles.size();
+    }
 }
 
-glm::vec3 WaterSimulator::getNormalAt(float worldX, float worldZ) const {
-    float normX = (worldX + size / 2.0f) / size;
-    float normZ = (worldZ + size / 2.0f) / size;
-
-    float c_float = normX * (N - 1);
-    float r_float = normZ * (N - 1);
-
-    int r0 = static_cast<int>(floor(r_float));
-    int c0 = static_cast<int>(floor(c_float));
-
-    r0 = std::max(0, std::min(N - 2, r0));
-    c0 = std::max(0, std::min(N - 2, c0));
-
-    int r1 = r0 + 1;
-    int c1 = c0 + 1;
-
-    float tx = c_float - c0;
-    float ty = r_float - r0;
-
-    const glm::vec3& n00 = normals[r0 * N + c0];
-    const glm::vec3& n10 = normals[r0 * N + c1];
-    const glm::vec3& n01 = normals[r1 * N + c0];
-    const glm::vec3& n11 = normals[r1 * N + c1];
-
-    glm::vec3 interpolatedNormal;
-    interpolatedNormal.x = (1 - tx) * (1 - ty) * n00.x +
-                           tx * (1 - ty) * n10.x +
-                           (1 - tx) * ty * n01.x +
-                           tx * ty * n11.x;
-
-    interpolatedNormal.y = (1 - tx) * (1 - ty) * n00.y +
-                           tx * (1 - ty) * n10.y +
-                           (1 - tx) * ty * n01.y +
-                           tx * ty * n11.y;
+bool WaterSimulator::findDirtyTiles(const WaterSolverFrame& frame) {
+    // The solver marks the tiles that are not flat and still. A calm tile is
+    // only sent if it was moving when it was last sent: both versions are
+    // then within twice getTileMovingEpsilon() of flat, so the texture never
+    // drifts further than that from the simulation.
+    dirtyTiles.clear();
+    int tileCount = tilesPerSide * tilesPerSide;
+    // Normals read one cell around them, so a tile next to a moving one may
+    // have new normals along its edge.
+    const unsigned char* moving = frame.movingTiles;
+    if (frame.normalmap) {
+        movingMask.assign(tileCount, 0);
+        for (int ty = 0; ty < tilesPerSide; ++ty) {
+            for (int tx = 0; tx < tilesPerSide; ++tx) {
+                if (!moving[ty * tilesPerSide + tx]) continue;
+                for (int y = std::max(ty - 1, 0); y <= std::min(ty + 1, tilesPerSide - 1); ++y) {
+                    for (int x = std::max(tx - 1, 0); x <= std::min(tx + 1, tilesPerSide - 1); ++x) {
+                        movingMask[y * tilesPerSide + x] = 1;
+                    }
+                }
+            }
+        }
+        moving = movingMask.data();
+    }
 
-    interpolatedNormal.z = (1 - tx) * (1 - ty) * n00.z +
-                           tx * (1 - ty) * n10.z +
-                           (1 - tx) * ty * n01.z +
-                           tx * ty * n11.z;
+    // The normal map may start arriving later, when it is first requested;
+    // its first upload is then a full one too.
+    bool uploaded = !uploadedCalm.empty() && (!frame.normalmap || normalmapUploaded);
+    uploadedCalm.resize(tileCount);
+    normalmapUploaded = frame.normalmap != nullptr;
+    for (int tile = 0; tile < tileCount && uploaded; ++tile) {
+        if (moving[tile] || !uploadedCalm[tile]) dirtyTiles.push_back(tile);
+    }
 
-    return glm::normalize(interpolatedNormal);
+    bool partial = uploaded && dirtyTiles.size() * 2 <= static_cast<size_t>(tileCount);
+    if (!partial) {
+        // Most of the surface moved (or nothing was uploaded yet): one full upload is cheaper.
+        for (int tile = 0; tile < tileCount; ++tile) {
+            uploadedCalm[tile] = !moving[tile];
+        }
+        return false;
+    }
+    for (int tile : dirtyTiles) {
+        uploadedCalm[tile] = !moving[tile];
+    }
+    return true;
 }
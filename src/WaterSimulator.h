@@ -4,69 +4,80 @@
 #include <vector>
 #include <glad.h>
 #include <glm/glm.hpp>
-#include <string>
-#include <random>
+#include "WaterSolver.h"
+#include "WaterSurface.h"
 
-class WaterSimulator {
+// WaterSolver on screen: owns the heightmap and normal map textures and
+// streams the solver's frames into them, only the tiles that changed.
+class WaterSimulator : public WaterSurface {
 public:
-    WaterSimulator(int gridN = 256, float physicalSize = 2.0f);
-    ~WaterSimulator();
+    // threadCount <= 0 uses every hardware thread; results do not depend on it.
+    WaterSimulator(int gridN = 256, float physicalSize = 2.0f, int threadCount = 0,
+                   HeightPrecision precision = HeightPrecision::Float32);
+    ~WaterSimulator() override;
 
-    void updateSimulation();
-    void createRaindrop();
+    const char* getBackendName() const override { return "cpu"; }
 
-    void createDisturbance(float worldX, float worldZ, float magnitude);
-    float getHeightAt(float worldX, float worldZ) const;
+    // Advances the solver by `substeps` timesteps, then refreshes the textures once.
+    void updateSimulation(int substeps = 1) override;
 
-    GLuint getHeightmapTextureID() const { return heightmapTexture; }
-    GLuint getNormalmapTextureID() const { return normalmapTexture; }
+    void createRaindrop(int substep = 0) override { solver.createRaindrop(substep); }
+    void createDisturbance(float worldX, float worldZ, float magnitude, int substep = 0) override {
+        solver.createDisturbance(worldX, worldZ, magnitude, substep);
+    }
+    float getHeightAt(float worldX, float worldZ) const override { return solver.getHeightAt(worldX, worldZ); }
+    glm::vec3 getNormalAt(float worldX, float worldZ) const override { return solver.getNormalAt(worldX, worldZ); }
+
+    GLuint getHeightmapTextureID() const override { return heightmapTexture; }
+    // The first call creates the texture and has the solver compute normals
+    // from the next step on.
+    GLuint getNormalmapTextureID() override;
 
-    glm::vec3 getNormalAt(float worldX, float worldZ) const;
+    // Factor that turns a heightmap texel into metres (SNORM texels are height / range).
+    float getHeightmapScale() const override {
+        return precision == HeightPrecision::Int16 ? solver.getPackedHeightRange() : 1.0f;
+    }
+    int getGridN() const override { return N; }
+    const TextureUploadStats* getUploadStats() const override { return &uploadStats; }
 
-    int getGridN() const { return N; }
+    // Stepping options, async mode, batched disturbances and batch sampling.
+    WaterSolver& getSolver() { return solver; }
+    const WaterSolver& getSolver() const { return solver; }
 
 private:
+    WaterSolver solver;
     int N;
-    float size;
-    float h;
-    float dt_sim;
-    float C_const;
-    float A_const;
-    float B_const;
-
-    std::vector<float> currentHeights;
-    std::vector<float> previousHeights;
-    std::vector<float> dampingFactors;
-    std::vector<glm::vec3> normals;
-    std::vector<unsigned char> normalmapData;
+    HeightPrecision precision;
 
     GLuint heightmapTexture;
-    GLuint normalmapTexture;
-
-    std::mt19937 rng;
-    std::uniform_int_distribution<int> distN;
-    std::uniform_real_distribution<float> distProb;
-    const float raindropProbability = 0.05f;
-    const float raindropMagnitude = 1.1f;
+    GLuint normalmapTexture = 0;
+
+    // Ring of persistently mapped upload buffers, each holding one heightmap
+    // and one normal map. A fence per slot keeps the CPU from overwriting data
+    // the GPU has not copied into the textures yet.
+    static const int uploadRingSize = 3;
+    GLuint uploadBuffers[uploadRingSize] = {};
+    unsigned char* uploadMapped[uploadRingSize] = {};
+    GLsync uploadFences[uploadRingSize] = {};
+    int uploadSlot = 0;
+    size_t uploadNormalOffset = 0;
+    TextureUploadStats uploadStats;
+
+    // Dirty-tile uploads: only tiles (WaterSolver::getTileSize() cells wide)
+    // that the frame marks as moving, or that were moving when last sent, go
+    // up. uploadedCalm is empty until the first upload.
+    int tileSize;
+    int tilesPerSide;
+    std::vector<int> dirtyTiles;
+    std::vector<unsigned char> movingMask;
+    std::vector<unsigned char> uploadedCalm;
+    bool normalmapUploaded = false;
 
-    void initializeGrid();
-    void initializeDampingFactors();
-    void simulateWaterSurface();
-    void calculateNormals();
     void setupTextures();
-    void updateTextures();
-
-    float& getHeight(std::vector<float>& heights, int r, int c) {
-        return heights[r * N + c];
-    }
-
-    const float& getHeight(const std::vector<float>& heights, int r, int c) const {
-        return heights[r * N + c];
-    }
-
-    float& getDamping(int r, int c) {
-        return dampingFactors[r * N + c];
-    }
+    void setupUploadBuffers();
+    void waitForUploadSlot(int slot);
+    void uploadTextures(const WaterSolverFrame& frame);
+    bool findDirtyTiles(const WaterSolverFrame& frame);
 };
 
 #endif // WATERSIMULATOR_H
@@ -0,0 +1,1505 @@
+#include "WaterSolver.h"
+#include "WaterKernels.h"
+#include "TraceRecorder.h"
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+WaterSolver::WaterSolver(int gridN, float physicalSize, int threadCount, HeightPrecision heightPrecision) :
+    N(gridN),
+    size(physicalSize),
+    precision(heightPrecision),
+    heightStride(heightPrecision == HeightPrecision::Float32 ? PaddedGrid::strideFor(gridN) : gridN),
+    heightOriginOffset(PaddedGrid::originOffsetFor(gridN)),
+    kernels(&selectWaterKernels()),
+    threadPool(threadCount),
+    rng(std::random_device{}()),
+    distN(0, gridN),
+    distProb(0.0f, 1.0f) {
+
+    h = size / (static_cast<float>(N));
+    C_const = 1.0f;
+    dt_sim = (1.0f / static_cast<float>(N));
+
+    float dt_sim_sq = dt_sim * dt_sim;
+    float h_sq = h * h;
+    float C_const_sq = C_const * C_const;
+
+    A_const = (C_const_sq * dt_sim_sq) / h_sq;
+    B_const = 2.0f - 4.0f * A_const;
+    tilesPerSide = (N + tileSize - 1) / tileSize;
+    tileMoving.assign(static_cast<size_t>(tilesPerSide) * tilesPerSide, 1);
+
+    std::cout << "WaterSim N=" << N << ", size=" << size << ", h=" << h << ", dt_sim=" << dt_sim << std::endl;
+    std::cout << "WaterSim A=" << A_const << ", B=" << B_const << std::endl;
+    std::cout << "WaterSim kernels: " << kernels->name << ", threads: " << threadPool.getThreadCount()
+              << ", height storage: " << (precision == HeightPrecision::Float32 ? "fp32" :
+                                          precision == HeightPrecision::Float16 ? "fp16" : "int16") << std::endl;
+    float stability_check = (C_const_sq * dt_sim_sq) / h_sq;
+    std::cout << "Stability Check (c^2*dt^2/h^2) = " << stability_check << " (should be <= 0.5)" << std::endl;
+    if (stability_check > 0.5f) {
+        std::cerr << "WARNING: Simulation might be unstable!" << std::endl;
+    }
+
+    if (precision == HeightPrecision::Float32) {
+        currentHeights.resize(N);
+        previousHeights.resize(N);
+        dampingFactors.resize(N);
+        rowTilePeaks.resize(static_cast<size_t>(N) * tilesPerSide);
+        peakScratch.assign(threadPool.getThreadCount(), std::vector<float>(N));
+    } else {
+        packedCurrentHeights.resize(N * N, 0);
+        packedPreviousHeights.resize(N * N, 0);
+    }
+    edgeDamping.resize(N, 1.0f);
+
+    initializeGrid();
+    initializeSplatKernels();
+}
+
+WaterSolver::~WaterSolver() {
+    stopAsync();
+}
+
+void WaterSolver::initializeGrid() {
+    // Zero is all-zero bits in every storage format.
+    currentHeights.fill(0.0f);
+    previousHeights.fill(0.0f);
+    std::fill(packedCurrentHeights.begin(), packedCurrentHeights.end(), 0);
+    std::fill(packedPreviousHeights.begin(), packedPreviousHeights.end(), 0);
+    initializeDampingFactors();
+}
+
+std::vector<float> WaterSolver::edgeDampingProfile(int gridN, float physicalSize) {
+    std::vector<float> profile(gridN, 1.0f);
+    float square_half_size = physicalSize / 2.0f;
+
+    // The distance to the nearest edge is the smaller of the row and column
+    // distances, and every step below is monotonic, so damping(r, c) equals
+    // min(profile[r], profile[c]) exactly.
+    for (int i = 0; i < gridN; ++i) {
+        float norm = static_cast<float>(i) / (gridN - 1);
+        float phys = -square_half_size + norm * physicalSize;
+
+        float dist_to_low_edge  = std::abs(phys - (-square_half_size));
+        float dist_to_high_edge = std::abs(phys - square_half_size);
+
+        float l = std::min(dist_to_low_edge, dist_to_high_edge);
+        profile[i] = 0.95f * std::min(1.0f, l / 0.2f);
+    }
+    return profile;
+}
+
+void WaterSolver::initializeDampingFactors() {
+    edgeDamping = edgeDampingProfile(N, size);
+
+    if (dampingFactors.empty()) return;
+    for (int r = 0; r < N; ++r) {
+        for (int c = 0; c < N; ++c) {
+            getDamping(r, c) = std::min(edgeDamping[r], edgeDamping[c]);
+            if (r == 0 || r == N - 1 || c == 0 || c == N - 1) {
+                 getDamping(r,c) = 0.95f;
+            }
+        }
+    }
+}
+
+void WaterSolver::initializeSplatKernels() {
+    const float pi = 3.14159265358979f;
+    splatKernels.assign(static_cast<size_t>(2 * (splatMaxRadius + 1) * splatPhases * splatKernelLength), 0.0f);
+    for (DisturbanceShape shape : {DisturbanceShape::Gaussian, DisturbanceShape::Cosine}) {
+        for (int radius = 0; radius <= splatMaxRadius; ++radius) {
+            for (int phase = 0; phase < splatPhases; ++phase) {
+                float* weights = &splatKernels[splatKernelIndex(shape, radius, phase)];
+                if (radius == 0) {
+                    weights[0] = 1.0f;
+                    continue;
+                }
+                // Entry k is the cell k - radius away from the kernel's floor cell.
+                float centre = radius + static_cast<float>(phase) / splatPhases;
+                float sum = 0.0f;
+                for (int k = 0; k < 2 * radius + 2; ++k) {
+                    float x = (k - centre) / radius;
+                    float w = 0.0f;
+                    if (std::abs(x) < 1.0f) {
+                        // The Gaussian is cut off at three standard deviations.
+                        w = shape == DisturbanceShape::Gaussian ? std::exp(-4.5f * x * x)
+                                                                : 0.5f * (1.0f + std::cos(pi * x));
+                    }
+                    weights[k] = w;
+                    sum += w;
+                }
+                for (int k = 0; k < 2 * radius + 2; ++k) {
+                    weights[k] /= sum;
+                }
+            }
+        }
+    }
+}
+
+int WaterSolver::splatKernelIndex(DisturbanceShape shape, int radius, int phase) const {
+    int s = shape == DisturbanceShape::Gaussian ? 0 : 1;
+    return ((s * (splatMaxRadius + 1) + radius) * splatPhases + phase) * splatKernelLength;
+}
+
+void WaterSolver::integrateRow(int r) {
+    // Leapfrog update written in place over the oldest time level: each cell of
+    // previousHeights is read exactly once, right before it is overwritten.
+    // The kernel runs over the whole padded row from the aligned column 0;
+    // the boundary and pad cells it computes are overwritten below.
+    float* prev = previousHeights.row(r);
+    const float* mid = currentHeights.row(r);
+    kernels->stencilRow(prev, currentHeights.row(r - 1), mid, currentHeights.row(r + 1),
+                        dampingFactors.row(r), previousHeights.getPaddedWidth(), A_const, B_const);
+
+    // Boundary cells are not integrated, they carry the current level forward.
+    prev[0] = mid[0];
+    prev[N - 1] = mid[N - 1];
+    prev[-1] = prev[0];
+    prev[N] = prev[N - 1];
+}
+
+void WaterSolver::trackRowPeaks(const float* next, const float* current, int r, int bandBegin, int bandEnd,
+                                int worker) {
+    // A segment is the rows of one band inside one tile row. Its rows are
+    // gathered column by column, and its last row reduces the columns to one
+    // peak per tile, stored at the segment's first row.
+    float* columnPeaks = peakScratch[worker].data();
+    int segmentBegin = std::max(bandBegin, r - r % tileSize);
+    if (r == segmentBegin) std::fill_n(columnPeaks, N, 0.0f);
+    kernels->peakRow(next, current, N, columnPeaks);
+    if (r + 1 != bandEnd && (r + 1) % tileSize != 0) return;
+
+    float* peaks = rowTilePeaks.data() + static_cast<size_t>(segmentBegin) * tilesPerSide;
+    for (int t = 0; t < tilesPerSide; ++t) {
+        int x = t * tileSize;
+        peaks[t] = *std::max_element(columnPeaks + x, columnPeaks + std::min(x + tileSize, N));
+    }
+    std::fill(peaks + tilesPerSide, rowTilePeaks.data() + static_cast<size_t>(r + 1) * tilesPerSide, 0.0f);
+}
+
+void WaterSolver::finishMovingTiles() {
+    threadPool.parallelFor(0, tilesPerSide, [this](int tileRowBegin, int tileRowEnd) {
+        for (int ty = tileRowBegin; ty < tileRowEnd; ++ty) {
+            int rowEnd = std::min(N, (ty + 1) * tileSize);
+            for (int tx = 0; tx < tilesPerSide; ++tx) {
+                float peak = 0.0f;
+                for (int r = ty * tileSize; r < rowEnd; ++r) {
+                    peak = std::max(peak, rowTilePeaks[static_cast<size_t>(r) * tilesPerSide + tx]);
+                }
+                tileMoving[ty * tilesPerSide + tx] = peak >= tileMovingEpsilon;
+            }
+        }
+    });
+}
+
+void WaterSolver::trackPackedMovingTiles() {
+    // Both 16-bit formats order their magnitudes like the integers, so a
+    // cell is compared with tileMovingEpsilon in storage units.
+    int threshold;
+    if (precision == HeightPrecision::Float16) {
+        unsigned short bits;
+        floatToHalfSpanScalar(&tileMovingEpsilon, &bits, 0, 1);
+        threshold = bits;
+    } else {
+        threshold = std::max(1, static_cast<int>(std::ceil(tileMovingEpsilon * 32767.0f / packedHeightRange)));
+    }
+    threadPool.parallelFor(0, tilesPerSide, [this, threshold](int tileRowBegin, int tileRowEnd) {
+        bool isHalf = precision == HeightPrecision::Float16;
+        for (int ty = tileRowBegin; ty < tileRowEnd; ++ty) {
+            int rowEnd = std::min(N, (ty + 1) * tileSize);
+            for (int tx = 0; tx < tilesPerSide; ++tx) {
+                int x = tx * tileSize;
+                int cols = std::min(tileSize, N - x);
+                int peak = 0;
+                for (int r = ty * tileSize; r < rowEnd; ++r) {
+                    const unsigned short* cells = &packedCurrentHeights[static_cast<size_t>(r) * N + x];
+                    for (int c = 0; c < cols; ++c) {
+                        int magnitude = isHalf ? cells[c] & 0x7FFF
+                                               : std::abs(static_cast<int>(static_cast<short>(cells[c])));
+                        peak = std::max(peak, magnitude);
+                    }
+                }
+                tileMoving[ty * tilesPerSide + tx] = peak >= threshold;
+            }
+        }
+    });
+}
+
+// Copies the boundary rows, with their ghost rows, to the new level.
+static void carryBoundaryRows(const PaddedGrid& cur, PaddedGrid& prev) {
+    int n = cur.size();
+    for (int r : {-1, 0, n - 1, n}) {
+        std::copy_n(cur.row(r) - 1, n + 2, prev.row(r) - 1);
+    }
+}
+
+void WaterSolver::normalRow(const PaddedGrid& heights, int r) {
+    // The ghost rows stand in for the clamped neighbours of the first and last row.
+    normalRow(heights.row(r - 1), heights.row(r), heights.row(r + 1), r);
+}
+
+void WaterSolver::normalRow(const float* up, const float* mid, const float* down, int r) {
+    kernels->normalRow(up, mid, down, N, 2.0f * h, &normals[r * N].x, &normalmapData[(r * N) * 4]);
+}
+
+void WaterSolver::simulateWaterSurface(bool trackTiles) {
+    carryBoundaryRows(currentHeights, previousHeights);
+
+    // Rows are independent, so the split across threads never changes the result.
+    if (!trackTiles) {
+        threadPool.parallelFor(1, N - 1, [this](int rowBegin, int rowEnd) {
+            for (int r = rowBegin; r < rowEnd; ++r) {
+                integrateRow(r);
+            }
+        });
+        currentHeights.swap(previousHeights);
+        return;
+    }
+
+    // Each row is tracked right after it is integrated, while it is in cache.
+    const int bands = std::min(N, threadPool.getThreadCount() * 4);
+    threadPool.run(bands, [&](int band, int worker) {
+        int begin = static_cast<int>(static_cast<long long>(N) * band / bands);
+        int end = static_cast<int>(static_cast<long long>(N) * (band + 1) / bands);
+        for (int r = begin; r < end; ++r) {
+            if (r > 0 && r < N - 1) {
+                integrateRow(r);
+            }
+            trackRowPeaks(previousHeights.row(r), currentHeights.row(r), r, begin, end, worker);
+        }
+    });
+    finishMovingTiles();
+
+    currentHeights.swap(previousHeights);
+}
+
+void WaterSolver::simulateWaterSurfaceWithNormals() {
+    // One sweep per row band: the normals of row r - 1 are computed right after
+    // row r has been integrated, while the three new rows are still in cache.
+    // A band cannot see the new rows of its neighbours, so its first and last
+    // rows are finished in a short second pass once every band is done.
+    carryBoundaryRows(currentHeights, previousHeights);
+
+    const int bands = std::min(N, threadPool.getThreadCount() * 4);
+    auto bandBegin = [this, bands](int band) {
+        return static_cast<int>(static_cast<long long>(N) * band / bands);
+    };
+    // Row q of band [begin, end) only needs new rows from its own band.
+    auto isBandLocal = [this](int q, int begin, int end) {
+        return (q - 1 >= begin || q == 0) && (q + 1 < end || q == N - 1);
+    };
+
+    threadPool.run(bands, [&](int band, int worker) {
+        int begin = bandBegin(band);
+        int end = bandBegin(band + 1);
+        for (int r = begin; r < end; ++r) {
+            if (r > 0 && r < N - 1) {
+                integrateRow(r);
+            }
+            trackRowPeaks(previousHeights.row(r), currentHeights.row(r), r, begin, end, worker);
+            if (r - 1 >= begin && isBandLocal(r - 1, begin, end)) {
+                normalRow(previousHeights, r - 1);
+            }
+        }
+        if (isBandLocal(end - 1, begin, end)) {
+            normalRow(previousHeights, end - 1);
+        }
+    });
+
+    threadPool.run(bands, [&](int band, int) {
+        int begin = bandBegin(band);
+        int end = bandBegin(band + 1);
+        if (!isBandLocal(begin, begin, end)) {
+            normalRow(previousHeights, begin);
+        }
+        if (end - 1 != begin && !isBandLocal(end - 1, begin, end)) {
+            normalRow(previousHeights, end - 1);
+        }
+    });
+    finishMovingTiles();
+
+    currentHeights.swap(previousHeights);
+}
+
+void WaterSolver::loadPackedRow(const std::vector<unsigned short>& packed, int r, float* dst) const {
+    if (precision == HeightPrecision::Float16) {
+        kernels->halfToFloatRow(&packed[r * N], dst, N);
+    } else {
+        kernels->int16ToFloatRow(reinterpret_cast<const short*>(&packed[r * N]), dst, N,
+                                 packedHeightRange / 32767.0f);
+    }
+    // Ghost cells for the normal kernel, as in PaddedGrid::fillHalo().
+    dst[-1] = dst[0];
+    dst[N] = dst[N - 1];
+}
+
+void WaterSolver::allocateRowScratch() {
+    if (static_cast<int>(rowScratch.size()) != threadPool.getThreadCount()) {
+        rowScratch.assign(threadPool.getThreadCount(), std::vector<float>(8 * static_cast<size_t>(N + 2)));
+    }
+}
+
+void WaterSolver::storePackedRow(const float* src, std::vector<unsigned short>& packed, int r) const {
+    if (precision == HeightPrecision::Float16) {
+        kernels->floatToHalfRow(src, &packed[r * N], N);
+    } else {
+        kernels->floatToInt16Row(src, reinterpret_cast<short*>(&packed[r * N]), N,
+                                 32767.0f / packedHeightRange);
+    }
+}
+
+float WaterSolver::heightAt(int r, int c) const {
+    return heightAt(currentHeights.row(0), packedCurrentHeights.data(), r, c);
+}
+
+float WaterSolver::heightAt(const float* heights, const unsigned short* packed, int r, int c) const {
+    if (precision == HeightPrecision::Float32) {
+        return heights[static_cast<size_t>(r) * heightStride + c];
+    }
+    float value;
+    if (precision == HeightPrecision::Float16) {
+        halfToFloatSpanScalar(&packed[r * N + c], &value, 0, 1);
+    } else {
+        int16ToFloatSpanScalar(reinterpret_cast<const short*>(&packed[r * N + c]), &value, 0, 1,
+                               packedHeightRange / 32767.0f);
+    }
+    return value;
+}
+
+void WaterSolver::addHeight(int r, int c, float delta) {
+    tileMoving[(r / tileSize) * tilesPerSide + c / tileSize] = 1;
+    if (precision == HeightPrecision::Float32) {
+        getHeight(currentHeights, r, c) += delta;
+        // An impulse also gives the cell a velocity of delta / dt_sim. Over an
+        // implicit step that is implicitMultiple times longer, the same
+        // velocity needs the older level lowered by the difference.
+        if (integrator == WaterIntegrator::ImplicitADI) {
+            getHeight(previousHeights, r, c) -= static_cast<float>(implicitMultiple - 1) * delta;
+        }
+        if (sparseSimulation) tileActive[(r / tileSize) * tilesPerSide + c / tileSize] = 1;
+        return;
+    }
+    float value = heightAt(r, c) + delta;
+    if (precision == HeightPrecision::Float16) {
+        floatToHalfSpanScalar(&value, &packedCurrentHeights[r * N + c], 0, 1);
+    } else {
+        floatToInt16SpanScalar(&value, reinterpret_cast<short*>(&packedCurrentHeights[r * N + c]), 0, 1,
+                               32767.0f / packedHeightRange);
+    }
+}
+
+void WaterSolver::simulatePackedWaterSurface(bool withNormals) {
+    // Same band sweep as simulateWaterSurfaceWithNormals(), with both time
+    // levels stored at 16 bits. Every band keeps fp32 copies of the three
+    // level t rows around the one being integrated and, for the normals, of
+    // the last three new rows as they read back from storage, so the normals
+    // always describe the stored heights.
+    std::copy_n(&packedCurrentHeights[0], N, &packedPreviousHeights[0]);
+    std::copy_n(&packedCurrentHeights[(N - 1) * N], N, &packedPreviousHeights[(N - 1) * N]);
+
+    allocateRowScratch();
+
+    const int bands = std::min(N, threadPool.getThreadCount() * 4);
+    auto bandBegin = [this, bands](int band) {
+        return static_cast<int>(static_cast<long long>(N) * band / bands);
+    };
+    auto isBandLocal = [this](int q, int begin, int end) {
+        return (q - 1 >= begin || q == 0) && (q + 1 < end || q == N - 1);
+    };
+
+    // Scratch rows are N + 2 floats apart and start one float in, leaving
+    // room for the ghost cells loadPackedRow() writes.
+    const int slot = N + 2;
+    threadPool.run(bands, [&](int band, int worker) {
+        float* currentRows = rowScratch[worker].data() + 1;
+        float* newRows = currentRows + 3 * slot;
+        float* dampingRow = currentRows + 6 * slot;
+        float* previousRow = currentRows + 7 * slot;
+        int loaded[3] = {-1, -1, -1};
+
+        auto currentRow = [&](int row) {
+            float* dst = currentRows + (row % 3) * slot;
+            if (loaded[row % 3] != row) {
+                loadPackedRow(packedCurrentHeights, row, dst);
+                loaded[row % 3] = row;
+            }
+            return dst;
+        };
+        auto newRow = [&](int row) { return newRows + (row % 3) * slot; };
+        auto finishNormals = [&](int q) {
+            normalRow(newRow(std::max(0, q - 1)), newRow(q), newRow(std::min(N - 1, q + 1)), q);
+        };
+
+        int begin = bandBegin(band);
+        int end = bandBegin(band + 1);
+        for (int r = begin; r < end; ++r) {
+            if (r == 0 || r == N - 1) {
+                if (withNormals) loadPackedRow(packedCurrentHeights, r, newRow(r));
+            } else {
+                const float* up = currentRow(r - 1);
+                const float* mid = currentRow(r);
+                const float* down = currentRow(r + 1);
+                loadPackedRow(packedPreviousHeights, r, previousRow);
+                for (int c = 1; c < N - 1; ++c) {
+                    dampingRow[c] = std::min(edgeDamping[r], edgeDamping[c]);
+                }
+                kernels->stencilRow(previousRow + 1, up + 1, mid + 1, down + 1, dampingRow + 1,
+                                    N - 2, A_const, B_const);
+                previousRow[0] = mid[0];
+                previousRow[N - 1] = mid[N - 1];
+                storePackedRow(previousRow, packedPreviousHeights, r);
+                if (withNormals) loadPackedRow(packedPreviousHeights, r, newRow(r));
+            }
+            if (withNormals && r - 1 >= begin && isBandLocal(r - 1, begin, end)) {
+                finishNormals(r - 1);
+            }
+        }
+        if (withNormals && isBandLocal(end - 1, begin, end)) {
+            finishNormals(end - 1);
+        }
+    });
+
+    if (withNormals) {
+        threadPool.run(bands, [&](int band, int worker) {
+            float* rows = rowScratch[worker].data() + 1;
+            auto finishNormals = [&](int q) {
+                int up = std::max(0, q - 1);
+                int down = std::min(N - 1, q + 1);
+                loadPackedRow(packedPreviousHeights, up, rows);
+                loadPackedRow(packedPreviousHeights, q, rows + slot);
+                loadPackedRow(packedPreviousHeights, down, rows + 2 * slot);
+                normalRow(rows, rows + slot, rows + 2 * slot, q);
+            };
+            int begin = bandBegin(band);
+            int end = bandBegin(band + 1);
+            if (!isBandLocal(begin, begin, end)) {
+                finishNormals(begin);
+            }
+            if (end - 1 != begin && !isBandLocal(end - 1, begin, end)) {
+                finishNormals(end - 1);
+            }
+        });
+    }
+
+    packedCurrentHeights.swap(packedPreviousHeights);
+}
+
+void WaterSolver::step(int k) {
+    if (k <= 0) return;
+    DUCK_TRACE_SCOPE("solver steps");
+    applySplats();
+    if (integrator == WaterIntegrator::ImplicitADI) {
+        advanceImplicit(k);
+        return;
+    }
+
+    if (precision != HeightPrecision::Float32) {
+        // Every step rounds to storage precision; temporal blocking would skip
+        // those roundings and give a different (if slightly better) result.
+        for (int i = 0; i < k; ++i) {
+            simulatePackedWaterSurface(false);
+        }
+        return;
+    }
+
+    size_t stateBytes = 2 * static_cast<size_t>(N) * N * sizeof(float);
+    if (sparseSimulation) {
+        for (int i = 0; i < k; ++i) {
+            simulateSparseWaterSurface(false);
+        }
+        return;
+    }
+    if (k == 1 || stateBytes <= temporalBlockBytes) {
+        for (int i = 0; i < k; ++i) {
+            simulateWaterSurface(false);
+        }
+        return;
+    }
+    simulateWaterSurfaceBlocked(k);
+}
+
+void WaterSolver::stepWithNormals() {
+    // The last substep is fused with the normal pass; its output is the same
+    // as simulateWaterSurface() followed by calculateNormals().
+    // Without a normal map consumer the normal pass is skipped entirely.
+    DUCK_TRACE_SCOPE("solver step + normals");
+    applySplats();
+    bool withNormals = normalMapRequested;
+    bool normalsAllocated = withNormals && allocateNormals();
+
+    if (integrator == WaterIntegrator::ImplicitADI) {
+        bool stepped = advanceImplicit(1);
+        if (withNormals && (stepped || normalsAllocated)) {
+            normalPass();
+        }
+        if (stepped) {
+            const int bands = std::min(N, threadPool.getThreadCount() * 4);
+            threadPool.run(bands, [&](int band, int worker) {
+                int begin = static_cast<int>(static_cast<long long>(N) * band / bands);
+                int end = static_cast<int>(static_cast<long long>(N) * (band + 1) / bands);
+                for (int r = begin; r < end; ++r) {
+                    trackRowPeaks(currentHeights.row(r), previousHeights.row(r), r, begin, end, worker);
+                }
+            });
+            finishMovingTiles();
+        }
+        return;
+    }
+
+    if (sparseSimulation) {
+        simulateSparseWaterSurface(withNormals);
+    } else if (precision != HeightPrecision::Float32) {
+        simulatePackedWaterSurface(withNormals);
+        trackPackedMovingTiles();
+    } else if (withNormals) {
+        simulateWaterSurfaceWithNormals();
+    } else {
+        simulateWaterSurface(true);
+    }
+}
+
+bool WaterSolver::allocateNormals() {
+    if (!normalmapData.empty()) return false;
+    normals.assign(static_cast<size_t>(N) * N, glm::vec3(0.0f, 1.0f, 0.0f));
+    normalmapData.assign(static_cast<size_t>(N) * N * 4, 0);
+    std::fill(tileChanged.begin(), tileChanged.end(), 1);
+    return true;
+}
+
+void WaterSolver::normalPass() {
+    threadPool.parallelFor(0, N, [this](int rowBegin, int rowEnd) {
+        for (int r = rowBegin; r < rowEnd; ++r) {
+            normalRow(currentHeights, r);
+        }
+    });
+}
+
+void WaterSolver::calculateNormals() {
+    if (precision != HeightPrecision::Float32 || isAsync()) return;
+    normalMapRequested = true;
+    allocateNormals();
+    normalPass();
+    // Every normal is fresh now.
+    std::fill(tileChanged.begin(), tileChanged.end(), 0);
+}
+
+void WaterSolver::setSparseSimulation(bool enabled, float epsilon) {
+    // Only the fp32 solver is tiled; the 16-bit modes already round quiet water to zero.
+    sparseSimulation = enabled && precision == HeightPrecision::Float32;
+    sleepEpsilon = epsilon;
+    size_t tileCount = static_cast<size_t>(tilesPerSide) * tilesPerSide;
+    tileActive.assign(tileCount, 1);
+    tileChanged.assign(tileCount, 1);
+}
+
+int WaterSolver::getActiveTileCount() const {
+    return static_cast<int>(std::count(tileActive.begin(), tileActive.end(), 1));
+}
+
+void WaterSolver::dilateTiles(const std::vector<unsigned char>& mask, std::vector<int>& tiles) const {
+    tiles.clear();
+    for (int ty = 0; ty < tilesPerSide; ++ty) {
+        for (int tx = 0; tx < tilesPerSide; ++tx) {
+            bool hit = false;
+            for (int y = std::max(ty - 1, 0); y <= std::min(ty + 1, tilesPerSide - 1) && !hit; ++y) {
+                for (int x = std::max(tx - 1, 0); x <= std::min(tx + 1, tilesPerSide - 1); ++x) {
+                    if (mask[y * tilesPerSide + x]) {
+                        hit = true;
+                        break;
+                    }
+                }
+            }
+            if (hit) tiles.push_back(ty * tilesPerSide + tx);
+        }
+    }
+}
+
+void WaterSolver::simulateSparseWaterSurface(bool withNormals) {
+    // The stencil reaches one cell, so in one step a wave cannot travel past
+    // the tiles around an active one. Stepping the active tiles and their
+    // neighbours therefore gives the same result as a dense step, as long as
+    // every other tile holds zero in both levels. Tiles whose height and
+    // velocity stay below sleepEpsilon are zeroed and put to sleep; that is
+    // the only difference from the dense solver.
+    dilateTiles(tileActive, sparseTiles);
+    // Tiles left out hold zero in both levels, so they are not moving.
+    std::fill(tileMoving.begin(), tileMoving.end(), 0);
+    PaddedGrid& prev = previousHeights;
+    const PaddedGrid& cur = currentHeights;
+    // Border tiles keep the halo next to them up to date, so a tile that
+    // falls asleep leaves a valid halo behind in both levels. Only the corners
+    // of the halo go stale, and nothing reads those.
+    auto fillTileHalo = [this](PaddedGrid& grid, int x, int y, int cols, int rows) {
+        for (int r = y; r < y + rows; ++r) {
+            float* cells = grid.row(r);
+            if (x == 0) cells[-1] = cells[0];
+            if (x + cols == N) cells[N] = cells[N - 1];
+        }
+        if (y == 0) std::copy_n(grid.row(0) + x, cols, grid.row(-1) + x);
+        if (y + rows == N) std::copy_n(grid.row(N - 1) + x, cols, grid.row(N) + x);
+    };
+
+    threadPool.run(static_cast<int>(sparseTiles.size()), [&](int i, int) {
+        int tile = sparseTiles[i];
+        int x = (tile % tilesPerSide) * tileSize;
+        int y = (tile / tilesPerSide) * tileSize;
+        int cols = std::min(tileSize, N - x);
+        int rows = std::min(tileSize, N - y);
+
+        float columnPeaks[tileSize] = {};
+        for (int r = y; r < y + rows; ++r) {
+            float* newRow = prev.row(r);
+            const float* mid = cur.row(r);
+            if (r == 0 || r == N - 1) {
+                std::copy_n(mid + x, cols, newRow + x);
+            } else {
+                // Tiles start on a cache line, so the whole tile row is
+                // integrated and the boundary cells are put back afterwards.
+                kernels->stencilRow(newRow + x, cur.row(r - 1) + x, mid + x, cur.row(r + 1) + x,
+                                    dampingFactors.row(r) + x, cols, A_const, B_const);
+                if (x == 0) newRow[0] = mid[0];
+                if (x + cols == N) newRow[N - 1] = mid[N - 1];
+            }
+            kernels->peakRow(newRow + x, mid + x, cols, columnPeaks);
+        }
+        float peak = *std::max_element(columnPeaks, columnPeaks + cols);
+        fillTileHalo(prev, x, y, cols, rows);
+        tileActive[tile] = peak >= sleepEpsilon;
+        // A tile falling asleep is zeroed below.
+        tileMoving[tile] = tileActive[tile] && peak >= tileMovingEpsilon;
+        tileChanged[tile] = 1;
+    });
+
+    // Neighbouring tiles read this level while they step, so tiles that fell
+    // asleep are only zeroed once every tile is done.
+    threadPool.run(static_cast<int>(sparseTiles.size()), [&](int i, int) {
+        int tile = sparseTiles[i];
+        if (tileActive[tile]) return;
+        int x = (tile % tilesPerSide) * tileSize;
+        int y = (tile / tilesPerSide) * tileSize;
+        int cols = std::min(tileSize, N - x);
+        int rows = std::min(tileSize, N - y);
+        for (int r = y; r < y + rows; ++r) {
+            std::fill_n(prev.row(r) + x, cols, 0.0f);
+            std::fill_n(currentHeights.row(r) + x, cols, 0.0f);
+        }
+        fillTileHalo(prev, x, y, cols, rows);
+        fillTileHalo(currentHeights, x, y, cols, rows);
+    });
+
+    currentHeights.swap(previousHeights);
+    if (withNormals) {
+        sparseNormals();
+    }
+}
+
+void WaterSolver::sparseNormals() {
+    // Normals read one cell around them, so they are refreshed on every tile
+    // that changed since the last normal pass and on its neighbours.
+    dilateTiles(tileChanged, sparseTiles);
+    std::fill(tileChanged.begin(), tileChanged.end(), 0);
+    float twoH = 2.0f * h;
+
+    threadPool.run(static_cast<int>(sparseTiles.size()), [&](int i, int) {
+        int tile = sparseTiles[i];
+        int x = (tile % tilesPerSide) * tileSize;
+        int y = (tile / tilesPerSide) * tileSize;
+        int cols = std::min(tileSize, N - x);
+        int rows = std::min(tileSize, N - y);
+        for (int r = y; r < y + rows; ++r) {
+            // The kernel reads one cell beyond the span: the neighbouring tile
+            // inside the grid, the halo at its border.
+            const float* up = currentHeights.row(r - 1) + x;
+            const float* mid = currentHeights.row(r) + x;
+            const float* down = currentHeights.row(r + 1) + x;
+            size_t cell = static_cast<size_t>(r) * N + x;
+            kernels->normalRow(up, mid, down, cols, twoH, &normals[cell].x, &normalmapData[cell * 4]);
+        }
+    });
+}
+
+void WaterSolver::simulateWaterSurfaceBlocked(int k) {
+    // Overlapped tiling: every tile loads its region plus a k-cell halo of the
+    // two current time levels, advances them k steps locally (the valid area
+    // shrinks by one cell per step) and writes back only its own region. Halo
+    // cells are recomputed by neighbouring tiles instead of being shared, so
+    // tiles are independent and read the old levels while writing new ones.
+    if (blockedCurrentHeights.size() != N) {
+        blockedCurrentHeights.resize(N);
+        blockedPreviousHeights.resize(N);
+    }
+    if (static_cast<int>(tileScratch.size()) != threadPool.getThreadCount()) {
+        tileScratch.resize(threadPool.getThreadCount());
+    }
+
+    // Two local levels of (tileRows + 2k) x (tileCols + 2k) floats must fit the budget.
+    int tileCols = std::min(N, 512);
+    int maxLocalRows = static_cast<int>(temporalBlockBytes / (2 * sizeof(float) * (tileCols + 2 * k)));
+    int tileRows = std::max(8, maxLocalRows - 2 * k);
+
+    int tilesX = (N + tileCols - 1) / tileCols;
+    int tilesY = (N + tileRows - 1) / tileRows;
+    threadPool.run(tilesX * tilesY, [&](int tile, int worker) {
+        int rowBegin = (tile / tilesX) * tileRows;
+        int colBegin = (tile % tilesX) * tileCols;
+        advanceTile(k, rowBegin, std::min(N, rowBegin + tileRows), colBegin, std::min(N, colBegin + tileCols),
+                    tileScratch[worker]);
+    });
+
+    blockedCurrentHeights.fillHalo();
+    currentHeights.swap(blockedCurrentHeights);
+    previousHeights.swap(blockedPreviousHeights);
+}
+
+void WaterSolver::advanceTile(int k, int rowBegin, int rowEnd, int colBegin, int colEnd, std::vector<float>& scratch) {
+    int localRowBegin = std::max(0, rowBegin - k);
+    int localRowEnd = std::min(N, rowEnd + k);
+    int localColBegin = std::max(0, colBegin - k);
+    int localColEnd = std::min(N, colEnd + k);
+    int rows = localRowEnd - localRowBegin;
+    int cols = localColEnd - localColBegin;
+
+    size_t levelSize = static_cast<size_t>(rows) * cols;
+    if (scratch.size() < 2 * levelSize) {
+        scratch.resize(2 * levelSize);
+    }
+    float* cur = scratch.data();
+    float* prev = scratch.data() + levelSize;
+
+    for (int r = 0; r < rows; ++r) {
+        std::copy_n(&getHeight(currentHeights, localRowBegin + r, localColBegin), cols, cur + r * cols);
+        std::copy_n(&getHeight(previousHeights, localRowBegin + r, localColBegin), cols, prev + r * cols);
+    }
+
+    for (int s = 1; s <= k; ++s) {
+        // Cells of level t+s are valid where all their level t+s-1 neighbours were;
+        // the grid boundary does not shrink because it is never integrated.
+        int validRowBegin = localRowBegin > 0 ? localRowBegin + s : 0;
+        int validRowEnd = localRowEnd < N ? localRowEnd - s : N;
+        int validColBegin = localColBegin > 0 ? localColBegin + s : 0;
+        int validColEnd = localColEnd < N ? localColEnd - s : N;
+
+        int stencilColBegin = std::max(1, validColBegin);
+        int stencilColEnd = std::min(N - 1, validColEnd);
+        for (int g = std::max(1, validRowBegin); g < std::min(N - 1, validRowEnd); ++g) {
+            int r = g - localRowBegin;
+            int c = stencilColBegin - localColBegin;
+            kernels->stencilRow(prev + r * cols + c,
+                                cur + (r - 1) * cols + c,
+                                cur + r * cols + c,
+                                cur + (r + 1) * cols + c,
+                                &getDamping(g, stencilColBegin), stencilColEnd - stencilColBegin, A_const, B_const);
+        }
+
+        // Boundary cells carry the current level forward, as in simulateWaterSurface().
+        if (localRowBegin == 0) std::copy_n(cur, cols, prev);
+        if (localRowEnd == N) std::copy_n(cur + (rows - 1) * cols, cols, prev + (rows - 1) * cols);
+        for (int r = 0; r < rows; ++r) {
+            if (localColBegin == 0) prev[r * cols] = cur[r * cols];
+            if (localColEnd == N) prev[r * cols + cols - 1] = cur[r * cols + cols - 1];
+        }
+
+        std::swap(cur, prev);
+    }
+
+    for (int g = rowBegin; g < rowEnd; ++g) {
+        int r = g - localRowBegin;
+        int c = colBegin - localColBegin;
+        std::copy_n(cur + r * cols + c, colEnd - colBegin, &getHeight(blockedCurrentHeights, g, colBegin));
+        std::copy_n(prev + r * cols + c, colEnd - colBegin, &getHeight(blockedPreviousHeights, g, colBegin));
+    }
+}
+
+void WaterSolver::setIntegrator(WaterIntegrator newIntegrator, int timestepMultiple) {
+    // The 16-bit modes round to storage precision every step and stay explicit.
+    integrator = precision == HeightPrecision::Float32 ? newIntegrator : WaterIntegrator::Explicit;
+    implicitMultiple = std::max(1, timestepMultiple);
+    implicitStepsOwed = 0;
+    if (integrator != WaterIntegrator::ImplicitADI) return;
+
+    // Theta scheme for w = u(t+T) - 2u(t) + u(t-T) with T = multiple * dt_sim:
+    // (I - theta r Dxx)(I - theta r Dzz) w = r (Dxx + Dzz) u(t), r = c^2 T^2 / h^2.
+    // Splitting the left side into the two 1D factors adds a term of order T^4;
+    // for theta >= 1/4 the scheme is stable for every T.
+    float r = A_const * static_cast<float>(implicitMultiple * implicitMultiple);
+    implicitLaplacianScale = r;
+    implicitCoupling = implicitTheta * r;
+
+    // Thomas coefficients of tridiag(-a, 1 + 2a, -a) over the N - 2 interior cells.
+    int m = N - 2;
+    implicitForward.resize(m);
+    implicitPivotInverse.resize(m);
+    float a = implicitCoupling;
+    float forward = 0.0f;
+    for (int i = 0; i < m; ++i) {
+        float pivotInverse = 1.0f / (1.0f + 2.0f * a + a * forward);
+        forward = -a * pivotInverse;
+        implicitForward[i] = forward;
+        implicitPivotInverse[i] = pivotInverse;
+    }
+
+    // The explicit step multiplies the new level by the damping d, which turns
+    // u(t+dt) = d (2 u(t) - u(t-dt)) into a decaying oscillation with roots
+    // sqrt(d) exp(+-i phi), cos(phi) = sqrt(d). Every multiple-th level of it
+    // obeys u(t+T) = s u(t) - p u(t-T) with s = 2 d^(k/2) cos(k phi) and
+    // p = d^k, so the implicit step reproduces the explicit damping exactly on
+    // flat water. d(r, c) is min(edgeDamping[r], edgeDamping[c]), so both
+    // factors are kept per row and picked by whichever index holds the minimum.
+    implicitEdgeSum.resize(N);
+    implicitEdgeProduct.resize(N);
+    float k = static_cast<float>(implicitMultiple);
+    for (int i = 0; i < N; ++i) {
+        double d = edgeDamping[i];
+        double phi = std::acos(std::sqrt(d));
+        implicitEdgeSum[i] = static_cast<float>(2.0 * std::pow(d, k / 2.0) * std::cos(k * phi));
+        implicitEdgeProduct[i] = static_cast<float>(std::pow(d, k));
+    }
+    implicitIncrement.assign(static_cast<size_t>(N) * N, 0.0f);
+    implicitScratch.assign(threadPool.getThreadCount(), std::vector<float>(static_cast<size_t>(N) * implicitRowGroup, 0.0f));
+
+    std::cout << "WaterSim implicit ADI: " << implicitMultiple << " steps per solve, c^2*T^2/h^2 = " << r << std::endl;
+}
+
+// The implicit solves spread every disturbance over the whole grid, and the
+// tails would soon be denormals, which are many times slower to compute with.
+static inline float flushTiny(float value) {
+    return std::abs(value) < 1e-30f ? 0.0f : value;
+}
+
+bool WaterSolver::advanceImplicit(int k) {
+    implicitStepsOwed += k;
+    bool stepped = false;
+    while (implicitStepsOwed >= implicitMultiple) {
+        simulateWaterSurfaceImplicit();
+        implicitStepsOwed -= implicitMultiple;
+        stepped = true;
+    }
+    return stepped;
+}
+
+void WaterSolver::simulateWaterSurfaceImplicit() {
+    const int m = N - 2;
+    const float a = implicitCoupling;
+    const float r = implicitLaplacianScale;
+    const float* forward = implicitForward.data();
+    const float* pivotInverse = implicitPivotInverse.data();
+    const float* damping = edgeDamping.data();
+    const float* edgeSum = implicitEdgeSum.data();
+    const float* edgeProduct = implicitEdgeProduct.data();
+    const PaddedGrid& cur = currentHeights;
+    PaddedGrid& prev = previousHeights;
+    float* w = implicitIncrement.data();
+
+    // x sweep: every row solves (I - a Dxx) y = r L u(t) on its own. The
+    // elimination is a serial chain along the row, so a group of rows is
+    // transposed into the worker's scratch and eliminated implicitRowGroup
+    // lanes at a time. Rows 0 and N - 1 of w, and the first and last scratch
+    // rows, stay zero and act as the boundary of both solves.
+    const int G = implicitRowGroup;
+    int groups = (m + G - 1) / G;
+    threadPool.run(groups, [&](int group, int worker) {
+        int rowBegin = 1 + group * G;
+        int count = std::min(N - 1 - rowBegin, G);
+        float* lanes = implicitScratch[worker].data();
+        for (int g = 0; g < G; ++g) {
+            int row = rowBegin + g;
+            if (g >= count) {
+                for (int i = 1; i <= m; ++i) lanes[i * G + g] = 0.0f;
+                continue;
+            }
+            const float* up = cur.row(row - 1);
+            const float* mid = cur.row(row);
+            const float* down = cur.row(row + 1);
+            for (int i = 1; i <= m; ++i) {
+                lanes[i * G + g] = r * (up[i] + down[i] + mid[i - 1] + mid[i + 1] - 4.0f * mid[i]);
+            }
+        }
+        for (int i = 1; i <= m; ++i) {
+            float* lane = lanes + i * G;
+            const float* above = lane - G;
+            float pivot = pivotInverse[i - 1];
+            for (int g = 0; g < G; ++g) {
+                lane[g] = flushTiny((lane[g] + a * above[g]) * pivot);
+            }
+        }
+        for (int i = m; i >= 1; --i) {
+            float* lane = lanes + i * G;
+            const float* below = lane + G;
+            float factor = forward[i - 1];
+            for (int g = 0; g < G; ++g) {
+                lane[g] = flushTiny(lane[g] - factor * below[g]);
+            }
+        }
+        for (int g = 0; g < count; ++g) {
+            float* out = w + (rowBegin + g) * N;
+            for (int i = 1; i <= m; ++i) {
+                out[i] = lanes[i * G + g];
+            }
+        }
+    });
+
+    // z sweep over strips of columns, a whole row of the strip at a time so
+    // the inner loops stay contiguous. The back substitution finishes w row by
+    // row, and the new level is written as soon as its row is final.
+    threadPool.parallelFor(1, N - 1, [&](int colBegin, int colEnd) {
+        for (int i = 0; i < m; ++i) {
+            float* out = w + (i + 1) * N;
+            const float* above = w + i * N;
+            for (int c = colBegin; c < colEnd; ++c) {
+                out[c] = flushTiny((out[c] + a * above[c]) * pivotInverse[i]);
+            }
+        }
+        for (int i = m - 1; i >= 0; --i) {
+            int row = i + 1;
+            float* out = w + row * N;
+            const float* below = w + (row + 1) * N;
+            const float* mid = cur.row(row);
+            float* newRow = prev.row(row);
+            for (int c = colBegin; c < colEnd; ++c) {
+                out[c] = flushTiny(out[c] - forward[i] * below[c]);
+                int d = damping[row] <= damping[c] ? row : c;
+                newRow[c] = flushTiny(0.5f * edgeSum[d] * (2.0f * mid[c] + out[c]) - edgeProduct[d] * newRow[c]);
+            }
+        }
+    });
+
+    // Boundary cells are not integrated, they carry the current level forward.
+    std::copy_n(&getHeight(currentHeights, 0, 0), N, &getHeight(previousHeights, 0, 0));
+    std::copy_n(&getHeight(currentHeights, N - 1, 0), N, &getHeight(previousHeights, N - 1, 0));
+    for (int row = 1; row < N - 1; ++row) {
+        getHeight(previousHeights, row, 0) = getHeight(currentHeights, row, 0);
+        getHeight(previousHeights, row, N - 1) = getHeight(currentHeights, row, N - 1);
+    }
+    previousHeights.fillHalo();
+
+    currentHeights.swap(previousHeights);
+}
+
+void WaterSolver::createRaindrop(int substep) {
+    if (distProb(rng) < raindropProbability) {
+        int r = distN(rng);
+        int c = distN(rng);
+
+        r = std::max(1, std::min(N - 2, r));
+        c = std::max(1, std::min(N - 2, c));
+
+        applyImpulse(r, c, raindropMagnitude, substep);
+    }
+}
+
+void WaterSolver::applyImpulse(int r, int c, float magnitude, int substep) {
+    substep = std::max(0, substep);
+    if (isAsync()) {
+        std::lock_guard<std::mutex> lock(asyncMutex);
+        pendingImpulses.push_back({r, c, magnitude, asyncQueuedSteps + substep});
+        return;
+    }
+    if (substep > 0) {
+        pendingImpulses.push_back({r, c, magnitude, substep});
+        return;
+    }
+    addHeight(r, c, magnitude);
+}
+
+void WaterSolver::runSubsteps(int substeps, std::vector<PendingImpulse>& impulses) {
+    std::stable_sort(impulses.begin(), impulses.end(),
+                     [](const PendingImpulse& a, const PendingImpulse& b) { return a.substep < b.substep; });
+    int done = 0;
+    for (size_t i = 0; i < impulses.size();) {
+        int substep = static_cast<int>(std::min<long long>(impulses[i].substep, substeps - 1));
+        step(substep - done);
+        done = substep;
+        for (; i < impulses.size() && std::min<long long>(impulses[i].substep, substeps - 1) == substep; ++i) {
+            addHeight(impulses[i].r, impulses[i].c, impulses[i].magnitude);
+        }
+    }
+    impulses.clear();
+    step(substeps - 1 - done);
+    stepWithNormals();
+}
+
+void WaterSolver::startAsync(int maxBatchSteps) {
+    if (isAsync()) return;
+    asyncMaxBatch = std::max(1, maxBatchSteps);
+    asyncStopping = false;
+    asyncPendingSteps = 0;
+    asyncQueuedSteps = 0;
+    // Every slot starts as the current state, so the render side always has a complete frame.
+    for (int i = 0; i < 3; ++i) {
+        publishFrame(frames.slot(i));
+    }
+    simThread = std::thread(&WaterSolver::simulationLoop, this);
+}
+
+void WaterSolver::stopAsync() {
+    if (!isAsync()) return;
+    {
+        std::lock_guard<std::mutex> lock(asyncMutex);
+        asyncStopping = true;
+    }
+    asyncCondition.notify_all();
+    simThread.join();
+
+    for (const PendingImpulse& impulse : pendingImpulses) {
+        addHeight(impulse.r, impulse.c, impulse.magnitude);
+    }
+    pendingImpulses.clear();
+    stepSplats.insert(stepSplats.end(), pendingSplats.begin(), pendingSplats.end());
+    pendingSplats.clear();
+    asyncPendingSteps = 0;
+}
+
+void WaterSolver::simulationLoop() {
+    DUCK_TRACE_THREAD_NAME("water sim");
+    std::vector<PendingImpulse> impulses;
+    // Steps queued before the current batch, dropped ones included.
+    long long batchStart = 0;
+    for (;;) {
+        int steps;
+        {
+            std::unique_lock<std::mutex> lock(asyncMutex);
+            asyncCondition.wait(lock, [this] { return asyncStopping || asyncPendingSteps > 0; });
+            if (asyncStopping) return;
+            steps = std::min(asyncPendingSteps, asyncMaxBatch);
+            long long batchEnd = batchStart + asyncPendingSteps;
+            asyncPendingSteps = 0;
+            // Impulses for the advance() call that has not queued its steps yet wait for it.
+            auto later = std::stable_partition(pendingImpulses.begin(), pendingImpulses.end(),
+                                               [&](const PendingImpulse& i) { return i.substep < batchEnd; });
+            impulses.assign(pendingImpulses.begin(), later);
+            pendingImpulses.erase(pendingImpulses.begin(), later);
+            stepSplats.insert(stepSplats.end(), pendingSplats.begin(), pendingSplats.end());
+            pendingSplats.clear();
+            for (PendingImpulse& impulse : impulses) impulse.substep = std::max(0LL, impulse.substep - batchStart);
+            batchStart = batchEnd;
+        }
+
+        DUCK_TRACE_SCOPE("async batch");
+        runSubsteps(steps, impulses);
+
+        publishFrame(frames.writeBuffer());
+        frames.publish();
+    }
+}
+
+void WaterSolver::publishFrame(Frame& frame) const {
+    if (precision == HeightPrecision::Float32) {
+        // The whole padded grid, so frames have the same layout and halo.
+        frame.heights.assign(currentHeights.storage().begin(), currentHeights.storage().end());
+    } else {
+        frame.packedHeights.assign(packedCurrentHeights.begin(), packedCurrentHeights.end());
+    }
+    frame.normalmap.assign(normalmapData.begin(), normalmapData.end());
+    frame.movingTiles.assign(tileMoving.begin(), tileMoving.end());
+}
+
+
+bool WaterSolver::advance(int substeps) {
+    if (isAsync()) {
+        if (substeps > 0) {
+            {
+                std::lock_guard<std::mutex> lock(asyncMutex);
+                asyncPendingSteps += substeps;
+                asyncQueuedSteps += substeps;
+            }
+            asyncCondition.notify_one();
+        }
+        return frames.acquire();
+    }
+
+    if (substeps <= 0) return false;
+    // The last substep is fused with the normal pass; its output is the same
+    // as simulateWaterSurface() followed by calculateNormals().
+    runSubsteps(substeps, pendingImpulses);
+    return true;
+}
+
+const float* WaterSolver::frameHeights(const Frame& frame) const {
+    return frame.heights.empty() ? nullptr : frame.heights.data() + heightOriginOffset;
+}
+
+WaterSolverFrame WaterSolver::getFrame() const {
+    WaterSolverFrame view;
+    view.heightStride = heightStride;
+    if (isAsync()) {
+        const Frame& frame = frames.readBuffer();
+        view.heights = frameHeights(frame);
+        view.packedHeights = frame.packedHeights.data();
+        view.normalmap = frame.normalmap.empty() ? nullptr : frame.normalmap.data();
+        view.movingTiles = frame.movingTiles.data();
+        return view;
+    }
+    view.heights = precision == HeightPrecision::Float32 ? currentHeights.row(0) : nullptr;
+    view.packedHeights = packedCurrentHeights.data();
+    view.normalmap = normalmapData.empty() ? nullptr : normalmapData.data();
+    view.movingTiles = tileMoving.data();
+    return view;
+}
+
+void WaterSolver::reset() {
+    initializeGrid();
+    {
+        std::lock_guard<std::mutex> lock(asyncMutex);
+        pendingImpulses.clear();
+        pendingSplats.clear();
+    }
+    stepSplats.clear();
+    implicitStepsOwed = 0;
+    // Like a fresh setSparseSimulation(): flat tiles fall asleep on their own.
+    std::fill(tileActive.begin(), tileActive.end(), 1);
+    std::fill(tileChanged.begin(), tileChanged.end(), 1);
+    std::fill(tileMoving.begin(), tileMoving.end(), 0);
+}
+
+const float* WaterSolver::heightRowAsFloat(const WaterSolverFrame& frame, int r, int c, int count, float* scratch) const {
+    size_t offset = static_cast<size_t>(r) * frame.heightStride + c;
+    if (precision == HeightPrecision::Float32) {
+        return frame.heights + offset;
+    }
+    if (precision == HeightPrecision::Float16) {
+        kernels->halfToFloatRow(frame.packedHeights + offset, scratch, count);
+    } else {
+        kernels->int16ToFloatRow(reinterpret_cast<const short*>(frame.packedHeights + offset), scratch, count,
+                                 packedHeightRange / 32767.0f);
+    }
+    return scratch;
+}
+
+void WaterSolver::createDisturbance(float worldX, float worldZ, float magnitude, int substep) {
+    float normX = (worldX + size / 2.0f) / size;
+    float normZ = (worldZ + size / 2.0f) / size;
+
+    int c = static_cast<int>(normX * (N - 1));
+    int r = static_cast<int>(normZ * (N - 1));
+
+    r = std::max(1, std::min(N - 2, r));
+    c = std::max(1, std::min(N - 2, c));
+
+    if (r >= 0 && r < N && c >= 0 && c < N) {
+        applyImpulse(r, c, magnitude, substep);
+    }
+}
+
+void WaterSolver::applyDisturbances(const Disturbance* disturbances, size_t count) {
+    std::vector<PendingSplat> queued;
+    std::vector<PendingSplat>& splats = isAsync() ? queued : stepSplats;
+    float cellsPerMetre = (N - 1) / size;
+
+    for (size_t i = 0; i < count; ++i) {
+        const Disturbance& d = disturbances[i];
+        float c_float = (d.worldX + size / 2.0f) / size * (N - 1);
+        float r_float = (d.worldZ + size / 2.0f) / size * (N - 1);
+        int radius = std::min(static_cast<int>(std::lround(d.radius * cellsPerMetre)), splatMaxRadius);
+
+        int r, c;
+        int phaseR = 0, phaseC = 0;
+        if (radius <= 0) {
+            // Same cell as createDisturbance().
+            radius = 0;
+            r = static_cast<int>(r_float);
+            c = static_cast<int>(c_float);
+        } else {
+            r = static_cast<int>(std::floor(r_float));
+            c = static_cast<int>(std::floor(c_float));
+            phaseR = static_cast<int>(std::lround((r_float - r) * splatPhases));
+            phaseC = static_cast<int>(std::lround((c_float - c) * splatPhases));
+            if (phaseR == splatPhases) { ++r; phaseR = 0; }
+            if (phaseC == splatPhases) { ++c; phaseC = 0; }
+        }
+        r = std::max(1, std::min(N - 2, r));
+        c = std::max(1, std::min(N - 2, c));
+
+        splats.push_back({r, c, splatKernelIndex(d.shape, radius, phaseR), splatKernelIndex(d.shape, radius, phaseC),
+                          radius, d.magnitude});
+    }
+
+    if (isAsync()) {
+        std::lock_guard<std::mutex> lock(asyncMutex);
+        pendingSplats.insert(pendingSplats.end(), queued.begin(), queued.end());
+    }
+}
+
+void WaterSolver::applySplats() {
+    if (stepSplats.empty()) return;
+
+    // Counting sort by the tile holding each kernel's centre. It is stable,
+    // so the splats of one tile keep their queue order.
+    size_t tileCount = static_cast<size_t>(tilesPerSide) * tilesPerSide;
+    auto tileOf = [this](const PendingSplat& splat) {
+        return (splat.r / tileSize) * tilesPerSide + splat.c / tileSize;
+    };
+    splatTileStart.assign(tileCount + 1, 0);
+    for (const PendingSplat& splat : stepSplats) {
+        ++splatTileStart[tileOf(splat) + 1];
+    }
+    for (size_t t = 0; t < tileCount; ++t) {
+        splatTileStart[t + 1] += splatTileStart[t];
+    }
+    splatOrder.resize(stepSplats.size());
+    for (size_t i = 0; i < stepSplats.size(); ++i) {
+        splatOrder[splatTileStart[tileOf(stepSplats[i])]++] = static_cast<int>(i);
+    }
+    for (size_t t = tileCount; t > 0; --t) {
+        splatTileStart[t] = splatTileStart[t - 1];
+    }
+    splatTileStart[0] = 0;
+
+    // Every tile a kernel covers wakes up and is moving.
+    for (const PendingSplat& splat : stepSplats) {
+        int rowTileEnd = std::min(splat.r + splat.radius + 1, N - 1) / tileSize;
+        int colTileEnd = std::min(splat.c + splat.radius + 1, N - 1) / tileSize;
+        for (int tr = std::max(splat.r - splat.radius, 0) / tileSize; tr <= rowTileEnd; ++tr) {
+            for (int tc = std::max(splat.c - splat.radius, 0) / tileSize; tc <= colTileEnd; ++tc) {
+                if (sparseSimulation) tileActive[tr * tilesPerSide + tc] = 1;
+                tileMoving[tr * tilesPerSide + tc] = 1;
+            }
+        }
+    }
+    if (precision != HeightPrecision::Float32) {
+        allocateRowScratch();
+    }
+
+    // A kernel reaches at most one tile beyond its own, so tiles three apart
+    // never write the same cell. The nine colours of that 3x3 pattern run one
+    // after another and the tiles of each colour in parallel, which keeps the
+    // result independent of the thread count.
+    bool parallel = stepSplats.size() >= parallelSplatThreshold && threadPool.getThreadCount() > 1;
+    auto stampTile = [this](int task, int worker) {
+        int tile = splatColorTiles[task];
+        for (int i = splatTileStart[tile]; i < splatTileStart[tile + 1]; ++i) {
+            stampSplat(stepSplats[splatOrder[i]], worker);
+        }
+    };
+    for (int color = 0; color < 9; ++color) {
+        splatColorTiles.clear();
+        for (int tr = color / 3; tr < tilesPerSide; tr += 3) {
+            for (int tc = color % 3; tc < tilesPerSide; tc += 3) {
+                int tile = tr * tilesPerSide + tc;
+                if (splatTileStart[tile] != splatTileStart[tile + 1]) splatColorTiles.push_back(tile);
+            }
+        }
+        if (parallel) {
+            threadPool.run(static_cast<int>(splatColorTiles.size()), stampTile);
+        } else {
+            for (int task = 0; task < static_cast<int>(splatColorTiles.size()); ++task) {
+                stampTile(task, 0);
+            }
+        }
+    }
+    stepSplats.clear();
+}
+
+void WaterSolver::stampSplat(const PendingSplat& splat, int worker) {
+    // Boundary cells are never disturbed, as in createDisturbance().
+    int firstRow = splat.r - splat.radius;
+    int firstCol = splat.c - splat.radius;
+    int rowBegin = std::max(firstRow, 1);
+    int rowEnd = std::min(splat.r + splat.radius + 2, N - 1);
+    int colBegin = std::max(firstCol, 1);
+    int count = std::min(splat.c + splat.radius + 2, N - 1) - colBegin;
+    const float* rowWeights = &splatKernels[splat.kernelRow];
+    const float* colWeights = &splatKernels[splat.kernelCol + (colBegin - firstCol)];
+
+    // A footprint clipped by the boundary is scaled up by the weight it lost,
+    // so the splat still adds its whole magnitude.
+    float magnitude = splat.magnitude;
+    int length = 2 * splat.radius + 2;
+    if (rowEnd - rowBegin < length || count < length) {
+        float rowKept = 0.0f;
+        float colKept = 0.0f;
+        for (int r = rowBegin; r < rowEnd; ++r) rowKept += rowWeights[r - firstRow];
+        for (int k = 0; k < count; ++k) colKept += colWeights[k];
+        if (rowKept > 0.0f && colKept > 0.0f) magnitude /= rowKept * colKept;
+    }
+
+    for (int r = rowBegin; r < rowEnd; ++r) {
+        float scale = magnitude * rowWeights[r - firstRow];
+        if (scale == 0.0f) continue;
+        if (precision == HeightPrecision::Float32) {
+            kernels->splatRow(&getHeight(currentHeights, r, colBegin), colWeights, scale, count);
+            // Same velocity correction as addHeight().
+            if (integrator == WaterIntegrator::ImplicitADI) {
+                kernels->splatRow(&getHeight(previousHeights, r, colBegin), colWeights,
+                                  -static_cast<float>(implicitMultiple - 1) * scale, count);
+            }
+            continue;
+        }
+        float* row = rowScratch[worker].data();
+        unsigned short* packed = &packedCurrentHeights[r * N + colBegin];
+        if (precision == HeightPrecision::Float16) {
+            kernels->halfToFloatRow(packed, row, count);
+            kernels->splatRow(row, colWeights, scale, count);
+            kernels->floatToHalfRow(row, packed, count);
+        } else {
+            short* fixed = reinterpret_cast<short*>(packed);
+            kernels->int16ToFloatRow(fixed, row, count, packedHeightRange / 32767.0f);
+            kernels->splatRow(row, colWeights, scale, count);
+            kernels->floatToInt16Row(row, fixed, count, 32767.0f / packedHeightRange);
+        }
+    }
+}
+
+float WaterSolver::getHeightAt(float worldX, float worldZ) const {
+    float normX = (worldX + size / 2.0f) / size;
+    float normZ = (worldZ + size / 2.0f) / size;
+
+    float c_float = normX * (N - 1);
+    float r_float = normZ * (N - 1);
+
+    int r0 = static_cast<int>(floor(r_float));
+    int c0 = static_cast<int>(floor(c_float));
+
+    r0 = std::max(0, std::min(N - 2, r0));
+    c0 = std::max(0, std::min(N - 2, c0));
+
+    int r1 = r0 + 1;
+    int c1 = c0 + 1;
+
+    float tx = c_float - c0;
+    float ty = r_float - r0;
+
+    const float* heights;
+    const unsigned short* packed;
+    if (isAsync()) {
+        heights = frameHeights(frames.readBuffer());
+        packed = frames.readBuffer().packedHeights.data();
+    } else {
+        heights = currentHeights.row(0);
+        packed = packedCurrentHeights.data();
+    }
+
+    float h00 = heightAt(heights, packed, r0, c0);
+    float h10 = heightAt(heights, packed, r0, c1);
+    float h01 = heightAt(heights, packed, r1, c0);
+    float h11 = heightAt(heights, packed, r1, c1);
+
+    float height = (1 - tx) * (1 - ty) * h00 +
+                   tx * (1 - ty) * h10 +
+                   (1 - tx) * ty * h01 +
+                   tx * ty * h11;
+    return height;
+}
+
+glm::vec3 WaterSolver::getNormalAt(float worldX, float worldZ) const {
+    float normX = (worldX + size / 2.0f) / size;
+    float normZ = (worldZ + size / 2.0f) / size;
+
+    float c_float = normX * (N - 1);
+    float r_float = normZ * (N - 1);
+
+    int r0 = static_cast<int>(floor(r_float));
+    int c0 = static_cast<int>(floor(c_float));
+
+    r0 = std::max(0, std::min(N - 2, r0));
+    c0 = std::max(0, std::min(N - 2, c0));
+
+    int r1 = r0 + 1;
+    int c1 = c0 + 1;
+
+    float tx = c_float - c0;
+    float ty = r_float - r0;
+
+    // Computed on demand from the heights; same values the normal pass would produce.
+    const float* heights;
+    const unsigned short* packed;
+    if (isAsync()) {
+        heights = frameHeights(frames.readBuffer());
+        packed = frames.readBuffer().packedHeights.data();
+    } else {
+        heights = currentHeights.row(0);
+        packed = packedCurrentHeights.data();
+    }
+    glm::vec3 n00 = normalAt(heights, packed, r0, c0);
+    glm::vec3 n10 = normalAt(heights, packed, r0, c1);
+    glm::vec3 n01 = normalAt(heights, packed, r1, c0);
+    glm::vec3 n11 = normalAt(heights, packed, r1, c1);
+
+    glm::vec3 interpolatedNormal;
+    interpolatedNormal.x = (1 - tx) * (1 - ty) * n00.x +
+                           tx * (1 - ty) * n10.x +
+                           (1 - tx) * ty * n01.x +
+                           tx * ty * n11.x;
+
+    interpolatedNormal.y = (1 - tx) * (1 - ty) * n00.y +
+                           tx * (1 - ty) * n10.y +
+                           (1 - tx) * ty * n01.y +
+                           tx * ty * n11.y;
+
+    interpolatedNormal.z = (1 - tx) * (1 - ty) * n00.z +
+                           tx * (1 - ty) * n10.z +
+                           (1 - tx) * ty * n01.z +
+                           tx * ty * n11.z;
+
+    return glm::normalize(interpolatedNormal);
+}
+
+void WaterSolver::sampleBatch(const glm::vec2* xz, size_t count, float* heights, glm::vec3* normals,
+                                 bool sortByCell) const {
+    static_assert(sizeof(glm::vec2) == 2 * sizeof(float) && sizeof(glm::vec3) == 3 * sizeof(float),
+                  "sampleBatch passes glm vectors to the kernels as plain floats");
+    if (count == 0) return;
+
+    if (precision != HeightPrecision::Float32) {
+        // The 16-bit grids are decoded point by point.
+        for (size_t i = 0; i < count; ++i) {
+            if (heights) heights[i] = getHeightAt(xz[i].x, xz[i].y);
+            if (normals) normals[i] = getNormalAt(xz[i].x, xz[i].y);
+        }
+        return;
+    }
+
+    const float* grid = isAsync() ? frameHeights(frames.readBuffer()) : currentHeights.row(0);
+    const int stride = heightStride;
+    if (!sortByCell) {
+        kernels->samplePoints(grid, N, stride, size, 2.0f * h, &xz[0].x, static_cast<int>(count), heights,
+                              normals ? &normals[0].x : nullptr);
+        return;
+    }
+
+    // Counting sort of the points by the tile of their cell.
+    std::vector<int> tileOf(count);
+    std::vector<int> tileStart(static_cast<size_t>(tilesPerSide) * tilesPerSide + 1, 0);
+    for (size_t i = 0; i < count; ++i) {
+        int c = static_cast<int>((xz[i].x + size / 2.0f) / size * (N - 1));
+        int r = static_cast<int>((xz[i].y + size / 2.0f) / size * (N - 1));
+        c = std::max(0, std::min(N - 1, c));
+        r = std::max(0, std::min(N - 1, r));
+        tileOf[i] = (r / tileSize) * tilesPerSide + c / tileSize;
+        ++tileStart[tileOf[i] + 1];
+    }
+    for (size_t t = 1; t < tileStart.size(); ++t) {
+        tileStart[t] += tileStart[t - 1];
+    }
+    std::vector<int> order(count);
+    std::vector<glm::vec2> sortedPoints(count);
+    for (size_t i = 0; i < count; ++i) {
+        int slot = tileStart[tileOf[i]]++;
+        order[slot] = static_cast<int>(i);
+        sortedPoints[slot] = xz[i];
+    }
+
+    std::vector<float> sortedHeights(heights ? count : 0);
+    std::vector<glm::vec3> sortedNormals(normals ? count : 0);
+    kernels->samplePoints(grid, N, stride, size, 2.0f * h, &sortedPoints[0].x, static_cast<int>(count),
+                          heights ? sortedHeights.data() : nullptr, normals ? &sortedNormals[0].x : nullptr);
+    for (size_t i = 0; i < count; ++i) {
+        if (heights) heights[order[i]] = sortedHeights[i];
+        if (normals) normals[order[i]] = sortedNormals[i];
+    }
+}
+
+glm::vec3 WaterSolver::normalAt(const float* heights, const unsigned short* packed, int r, int c) const {
+    // Same differences and rounding as normalSpanScalar().
+    float twoH = 2.0f * h;
+
+    float grad_x = (heightAt(heights, packed, r, std::min(c + 1, N - 1)) -
+                    heightAt(heights, packed, r, std::max(c - 1, 0))) / twoH;
+    float grad_z = (heightAt(heights, packed, std::min(r + 1, N - 1), c) -
+                    heightAt(heights, packed, std::max(r - 1, 0), c)) / twoH;
+
+    float x = -grad_x;
+    float z = -grad_z;
+    float inv_len = 1.0f / std::sqrt(x * x + 1.0f + z * z);
+    return glm::vec3(x * inv_len, inv_len, z * inv_len);
+}
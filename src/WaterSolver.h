@@ -0,0 +1,371 @@
+#ifndef WATERSOLVER_H
+#define WATERSOLVER_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <string>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "ThreadPool.h"
+#include "TripleBuffer.h"
+#include "PaddedGrid.h"
+
+struct WaterKernels;
+
+// Storage format of the two height time levels. Arithmetic is always fp32;
+// Float16 and Int16 halve the grid memory and upload the heightmap as
+// GL_R16F / GL_R16_SNORM. See README.md for the accuracy against Float32.
+enum class HeightPrecision {
+    Float32,
+    Float16,
+    Int16
+};
+
+// Time integrator of the Float32 solver. ImplicitADI takes one
+// alternating-direction implicit step in place of several explicit ones, see
+// WaterSolver::setIntegrator().
+enum class WaterIntegrator {
+    Explicit,
+    ImplicitADI
+};
+
+// Footprint of a batched disturbance, see WaterSolver::applyDisturbances().
+enum class DisturbanceShape {
+    Gaussian,
+    Cosine
+};
+
+struct Disturbance {
+    float worldX;
+    float worldZ;
+    // Total height added over the footprint, so a wide disturbance displaces
+    // as much water as a single-cell one of the same magnitude. A footprint
+    // crossing the boundary puts all of it on the cells inside.
+    float magnitude;
+    // Footprint radius in metres. Below half a cell the disturbance hits a
+    // single cell exactly like createDisturbance().
+    float radius = 0.0f;
+    DisturbanceShape shape = DisturbanceShape::Gaussian;
+};
+
+// The newest state as a renderer reads it, see WaterSolver::getFrame().
+// Heights are set for Float32 grids, packedHeights for the 16-bit ones.
+struct WaterSolverFrame {
+    const float* heights = nullptr;
+    const unsigned short* packedHeights = nullptr;
+    // Elements from one row of heights or packedHeights to the next: N for
+    // the 16-bit grids, more for Float32, whose rows are padded (see PaddedGrid).
+    int heightStride = 0;
+    // RGBA8, null until the normal map has been requested.
+    const unsigned char* normalmap = nullptr;
+    // One flag per tile of getTileSize() cells, set when a height on the tile
+    // may be getTileMovingEpsilon() or more from flat. A tile left unset is
+    // flat to within that, whatever happened before the frame.
+    const unsigned char* movingTiles = nullptr;
+};
+
+// The CPU wave equation solver: grid state, stepping, disturbances and
+// sampling, with no OpenGL dependency. WaterSimulator puts it on screen;
+// headless tools use it directly (the duck_water_core library).
+class WaterSolver {
+public:
+    // threadCount <= 0 uses every hardware thread; results do not depend on it.
+    WaterSolver(int gridN = 256, float physicalSize = 2.0f, int threadCount = 0,
+                HeightPrecision precision = HeightPrecision::Float32);
+    ~WaterSolver();
+
+    // Advances the surface by `substeps` timesteps, the last one fused with
+    // the normal pass. While async it only queues them and picks up the
+    // newest finished frame. Returns true if getFrame() has a new frame.
+    bool advance(int substeps = 1);
+    WaterSolverFrame getFrame() const;
+
+    // Advances the height field by k timesteps. For k > 1 on grids larger than
+    // the cache budget the steps are temporally blocked: each tile is advanced
+    // k steps while it stays in L2. The result is identical to k single steps.
+    void step(int k);
+    // Raindrops and createDisturbance() land before substep `substep` of the
+    // next advance() call, counted from 0; substeps past its last one fall on
+    // the last. Substep 0 is applied right away unless async.
+    void createRaindrop(int substep = 0);
+    // Flat water again: zeroes both levels and drops queued disturbances. The
+    // normal map catches up at the next step. Not to be called while async.
+    void reset();
+
+    // Moves the solver onto its own thread. advance(k) then only queues k
+    // steps and picks up the newest frame the thread has finished, so the
+    // steps overlap rendering. Disturbances are queued and applied before
+    // their substep of the batch; queued steps beyond maxBatchSteps are dropped.
+    // step() must not be called while the thread is running.
+    void startAsync(int maxBatchSteps = 8);
+    void stopAsync();
+    bool isAsync() const { return simThread.joinable(); }
+
+    // Thread-safe while async.
+    void createDisturbance(float worldX, float worldZ, float magnitude, int substep = 0);
+    // Queues a batch of disturbances for the start of the next step. Each one
+    // is stamped from a precomputed kernel placed with 1/8 cell accuracy; the
+    // stamps are sorted by tile and applied in parallel. Thread-safe while async.
+    void applyDisturbances(const Disturbance* disturbances, size_t count);
+    void applyDisturbances(const std::vector<Disturbance>& disturbances) {
+        applyDisturbances(disturbances.data(), disturbances.size());
+    }
+    // Stamps the queued batch now instead of at the next step. Not while async.
+    void flushDisturbances() { applySplats(); }
+    // While async these sample the frame last picked up by advance().
+    float getHeightAt(float worldX, float worldZ) const;
+
+    // The normal map is only built once somebody asks for it: the normal pass
+    // is on from the next step. water.vert derives its own normals, so by
+    // default none are computed.
+    void requestNormalMap() { normalMapRequested = true; }
+    // The normal pass on its own: recomputes the whole normal map from the
+    // current heights, requesting it first if needed. Float32 only, not while async.
+    void calculateNormals();
+
+    // Computed from the heights around the point, independent of the normal map.
+    glm::vec3 getNormalAt(float worldX, float worldZ) const;
+
+    // getHeightAt / getNormalAt for `count` (x, z) points at once, with the
+    // same results. Float32 grids are sampled 8 or 16 points at a time with
+    // SIMD gathers. `heights` or `normals` may be null. sortByCell visits the
+    // points tile by tile, which helps when they are scattered over a large grid.
+    void sampleBatch(const glm::vec2* xz, size_t count, float* heights, glm::vec3* normals,
+                     bool sortByCell = false) const;
+
+    // Int16 heights are stored as height / range in SNORM units.
+    float getPackedHeightRange() const { return packedHeightRange; }
+    HeightPrecision getHeightPrecision() const { return precision; }
+    // Row r, columns c .. c + count of a frame in fp32. Returns the frame's
+    // own row for Float32 grids, `scratch` filled with the converted values otherwise.
+    const float* heightRowAsFloat(const WaterSolverFrame& frame, int r, int c, int count, float* scratch) const;
+
+    int getGridN() const { return N; }
+    float getPhysicalSize() const { return size; }
+    int getThreadCount() const { return threadPool.getThreadCount(); }
+
+    // Sparse mode (Float32 only) steps only the tiles that are moving and
+    // their neighbours. A tile falls asleep, and is zeroed, once its heights
+    // and velocities stay below epsilon; disturbances and waves from active
+    // neighbours wake it up again. Not to be called while async.
+    void setSparseSimulation(bool enabled, float epsilon = 1e-6f);
+    bool isSparseSimulation() const { return sparseSimulation; }
+    int getActiveTileCount() const;
+    static int getTileSize() { return tileSize; }
+    int getTilesPerSide() const { return tilesPerSide; }
+    static float getTileMovingEpsilon() { return tileMovingEpsilon; }
+
+    // ImplicitADI (Float32 only) replaces every `timestepMultiple` explicit
+    // steps with one implicit step of that length: a tridiagonal solve along
+    // every row, then along every column, each split across the pool. It is
+    // stable for any multiple. Waves only a few cells long travel slower than
+    // with the explicit scheme, and the surface only changes once per implicit
+    // step. Sparse tiles and temporal blocking are not used while it is on.
+    // Not to be called while async.
+    void setIntegrator(WaterIntegrator integrator, int timestepMultiple = 4);
+    WaterIntegrator getIntegrator() const { return integrator; }
+
+    // Per-row (and per-column) damping of an N x N grid spanning physicalSize.
+    static std::vector<float> edgeDampingProfile(int gridN, float physicalSize);
+
+private:
+    // `substep` counts from the next advance() call; while async it is
+    // absolute, in steps queued since startAsync().
+    struct PendingImpulse {
+        int r;
+        int c;
+        float magnitude;
+        long long substep;
+    };
+
+    // A disturbance resolved to grid cells: the kernel covers rows
+    // r - radius .. r + radius + 1 and the same columns around c.
+    struct PendingSplat {
+        int r;
+        int c;
+        int kernelRow;
+        int kernelCol;
+        int radius;
+        float magnitude;
+    };
+
+    // One finished step as published by the simulation thread.
+    struct Frame {
+        AlignedFloatVector heights;
+        std::vector<unsigned short> packedHeights;
+        std::vector<unsigned char> normalmap;
+        std::vector<unsigned char> movingTiles;
+    };
+
+    int N;
+    float size;
+    float h;
+    float dt_sim;
+    float C_const;
+    float A_const;
+    float B_const;
+    HeightPrecision precision;
+    // Layout of a height snapshot: floats between rows (N for the 16-bit
+    // formats) and the offset of cell (0, 0) in a Float32 one. Fixed at
+    // construction, so the main thread can read them while the simulation
+    // thread swaps the grids.
+    const int heightStride;
+    const size_t heightOriginOffset;
+
+    // Float32 state. The damping field is separable: damping(r, c) is
+    // min(edgeDamping[r], edgeDamping[c]) away from the border, and zero in
+    // the halo and padding. Every step leaves the halo of the new level
+    // filled; disturbances never reach the boundary cells, so it stays valid.
+    PaddedGrid currentHeights;
+    PaddedGrid previousHeights;
+    PaddedGrid dampingFactors;
+    std::vector<float> edgeDamping;
+    // Float16 / Int16 state, used instead of the three grids above.
+    std::vector<unsigned short> packedCurrentHeights;
+    std::vector<unsigned short> packedPreviousHeights;
+    std::vector<std::vector<float>> rowScratch;
+    PaddedGrid blockedCurrentHeights;
+    PaddedGrid blockedPreviousHeights;
+    std::vector<std::vector<float>> tileScratch;
+    // Allocated once the normal map is requested.
+    std::vector<glm::vec3> normals;
+    std::vector<unsigned char> normalmapData;
+    std::atomic<bool> normalMapRequested{false};
+
+    const WaterKernels* kernels;
+    ThreadPool threadPool;
+
+    std::thread simThread;
+    std::mutex asyncMutex;
+    std::condition_variable asyncCondition;
+    bool asyncStopping = false;
+    int asyncPendingSteps = 0;
+    long long asyncQueuedSteps = 0;
+    int asyncMaxBatch = 8;
+    std::vector<PendingImpulse> pendingImpulses;
+    std::vector<PendingSplat> pendingSplats;
+    TripleBuffer<Frame> frames;
+
+    // Sparse stepping and change tracking work on tileSize x tileSize blocks.
+    static constexpr int tileSize = 32;
+    static constexpr float tileMovingEpsilon = 5e-6f;
+    int tilesPerSide;
+    // Moving tiles of the current level, refreshed by the last step of every
+    // advance(). Dense Float32 steps gather tile peaks into rowTilePeaks (N
+    // rows of tilesPerSide) while they integrate, with N column peaks per worker.
+    std::vector<unsigned char> tileMoving;
+    std::vector<float> rowTilePeaks;
+    std::vector<std::vector<float>> peakScratch;
+
+    bool sparseSimulation = false;
+    float sleepEpsilon = 1e-6f;
+    std::vector<unsigned char> tileActive;
+    // Tiles stepped since the last normal pass.
+    std::vector<unsigned char> tileChanged;
+    std::vector<int> sparseTiles;
+
+    // Implicit integrator state. The row and column systems share one constant
+    // tridiagonal matrix, so its Thomas coefficients are computed once.
+    WaterIntegrator integrator = WaterIntegrator::Explicit;
+    int implicitMultiple = 1;
+    int implicitStepsOwed = 0;
+    float implicitCoupling = 0.0f;
+    float implicitLaplacianScale = 0.0f;
+    std::vector<float> implicitForward;
+    std::vector<float> implicitPivotInverse;
+    // Damping of one implicit step per edgeDamping entry, see setIntegrator().
+    std::vector<float> implicitEdgeSum;
+    std::vector<float> implicitEdgeProduct;
+    std::vector<float> implicitIncrement;
+    // Per worker: N rows of implicitRowGroup lanes for the transposed x sweep.
+    std::vector<std::vector<float>> implicitScratch;
+    const float implicitTheta = 0.25f;
+    static const int implicitRowGroup = 16;
+
+    // Splat kernel library: 1D weights for every shape, radius in cells and
+    // sub-cell phase. A stamp is the outer product of a row and a column
+    // kernel, each normalized to sum to one.
+    static constexpr int splatMaxRadius = 16;
+    static const int splatPhases = 8;
+    static const int splatKernelLength = 2 * splatMaxRadius + 2;
+    std::vector<float> splatKernels;
+    // Splats queued for the next step (owned by the stepping thread), and
+    // their tile-sorted order.
+    std::vector<PendingSplat> stepSplats;
+    std::vector<int> splatOrder;
+    std::vector<int> splatTileStart;
+    std::vector<int> splatColorTiles;
+    const size_t parallelSplatThreshold = 256;
+
+    std::mt19937 rng;
+    std::uniform_int_distribution<int> distN;
+    std::uniform_real_distribution<float> distProb;
+    const float raindropProbability = 0.05f;
+    const float raindropMagnitude = 1.1f;
+    const size_t temporalBlockBytes = 512 * 1024;
+    const float packedHeightRange = 8.0f;
+
+    void initializeGrid();
+    void initializeDampingFactors();
+    void initializeSplatKernels();
+    int splatKernelIndex(DisturbanceShape shape, int radius, int phase) const;
+    void applySplats();
+    void stampSplat(const PendingSplat& splat, int worker);
+    void integrateRow(int r);
+    void normalRow(const PaddedGrid& heights, int r);
+    void normalRow(const float* up, const float* mid, const float* down, int r);
+    void simulateWaterSurface(bool trackTiles);
+    void simulateWaterSurfaceWithNormals();
+    void simulateWaterSurfaceBlocked(int k);
+    void simulateWaterSurfaceImplicit();
+    // Runs the implicit steps that `k` more explicit steps pay for. Returns true if the surface changed.
+    bool advanceImplicit(int k);
+    void advanceTile(int k, int rowBegin, int rowEnd, int colBegin, int colEnd, std::vector<float>& scratch);
+    void simulatePackedWaterSurface(bool withNormals);
+    void stepWithNormals();
+    // Returns false if the normal buffers already existed.
+    bool allocateNormals();
+    void normalPass();
+    // Adds row r of the new and the old level to rowTilePeaks. Every band
+    // must pass its rows in order.
+    void trackRowPeaks(const float* next, const float* current, int r, int bandBegin, int bandEnd, int worker);
+    // tileMoving from rowTilePeaks, once every row has been tracked.
+    void finishMovingTiles();
+    void trackPackedMovingTiles();
+    void simulateSparseWaterSurface(bool withNormals);
+    void sparseNormals();
+    void dilateTiles(const std::vector<unsigned char>& mask, std::vector<int>& tiles) const;
+    void loadPackedRow(const std::vector<unsigned short>& packed, int r, float* dst) const;
+    // Per worker: 8 rows of N + 2 floats, see simulatePackedWaterSurface().
+    void allocateRowScratch();
+    void storePackedRow(const float* src, std::vector<unsigned short>& packed, int r) const;
+    float heightAt(int r, int c) const;
+    float heightAt(const float* heights, const unsigned short* packed, int r, int c) const;
+    void addHeight(int r, int c, float delta);
+    void applyImpulse(int r, int c, float magnitude, int substep);
+    // `substeps` steps, the last fused with the normal pass, with every
+    // impulse added before its substep. Empties `impulses`.
+    void runSubsteps(int substeps, std::vector<PendingImpulse>& impulses);
+    void simulationLoop();
+    void publishFrame(Frame& frame) const;
+    // Cell (0, 0) of a published Float32 frame, null for the 16-bit grids.
+    const float* frameHeights(const Frame& frame) const;
+    glm::vec3 normalAt(const float* heights, const unsigned short* packed, int r, int c) const;
+
+    float& getHeight(PaddedGrid& heights, int r, int c) {
+        return heights.at(r, c);
+    }
+
+    const float& getHeight(const PaddedGrid& heights, int r, int c) const {
+        return heights.at(r, c);
+    }
+
+    float& getDamping(int r, int c) {
+        return dampingFactors.at(r, c);
+    }
+};
+
+#endif // WATERSOLVER_H
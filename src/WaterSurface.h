@@ -0,0 +1,68 @@
+#ifndef WATERSURFACE_H
+#define WATERSURFACE_H
+
+#include <glad.h>
+#include <glm/glm.hpp>
+
+// Texture upload counters, see WaterSurface::getUploadStats().
+struct TextureUploadStats {
+    unsigned long long uploads = 0;
+    // Uploads that found their PBO still in use by the GPU and had to wait on its fence.
+    unsigned long long fenceStalls = 0;
+    double fenceWaitSeconds = 0.0;
+    double lastFenceWaitSeconds = 0.0;
+    // Uploads that sent the whole surface, and tiles sent by the partial ones.
+    unsigned long long fullUploads = 0;
+    unsigned long long tilesUploaded = 0;
+};
+
+// Virtual heightmap of AdaptiveWaterSimulator, see sampleHeight() in water.vert.
+struct WaterPageTable {
+    GLuint texture = 0;
+    int pagesPerSide = 0;
+    int rootBlocks = 0;
+    int blockSize = 0;
+};
+
+// A water solver as the frame loop sees it: stepped, disturbed, sampled and
+// drawn from its textures. WaterSimulator, GpuWaterSimulator,
+// AdaptiveWaterSimulator and FftOceanSimulator implement it, and
+// createWaterSurface() (WaterSurfaceFactory.h) picks one at startup.
+class WaterSurface {
+public:
+    virtual ~WaterSurface() {}
+
+    // Backend name as accepted by parseWaterBackend().
+    virtual const char* getBackendName() const = 0;
+
+    // Advances the surface by `substeps` timesteps and uploads what changed.
+    virtual void updateSimulation(int substeps = 1) = 0;
+    // Both land before substep `substep` of the next updateSimulation() call,
+    // counted from 0; substeps past its last one fall on the last.
+    virtual void createRaindrop(int substep = 0) = 0;
+    virtual void createDisturbance(float worldX, float worldZ, float magnitude, int substep = 0) = 0;
+    // Point the backend should keep its finest detail around, usually the camera.
+    virtual void setFocus(float, float, float) {}
+
+    virtual float getHeightAt(float worldX, float worldZ) const = 0;
+    virtual glm::vec3 getNormalAt(float worldX, float worldZ) const = 0;
+
+    virtual GLuint getHeightmapTextureID() const = 0;
+    // Factor that turns a heightmap texel into metres.
+    virtual float getHeightmapScale() const = 0;
+    // Wave equation heights are impulse responses and are drawn scaled down;
+    // backends returning true produce real metres.
+    virtual bool hasMetricHeights() const { return false; }
+    // Texels per side of the heightmap as water.vert samples it.
+    virtual int getGridN() const = 0;
+    // The first call may switch on the backend's normal pass. 0 if it has none.
+    virtual GLuint getNormalmapTextureID() { return 0; }
+    // RG32F horizontal (x, z) displacement in metres, 0 if the surface only moves vertically.
+    virtual GLuint getDisplacementTextureID() const { return 0; }
+    // A texture of 0 means the heightmap is a plain grid.
+    virtual WaterPageTable getPageTable() const { return WaterPageTable(); }
+    // Null if the backend does not stream its textures from the CPU.
+    virtual const TextureUploadStats* getUploadStats() const { return nullptr; }
+};
+
+#endif // WATERSURFACE_H
@@ -0,0 +1,60 @@
+#include "WaterSurfaceFactory.h"
+#include "GpuWaterSimulator.h"
+#include "AdaptiveWaterSimulator.h"
+#include <cstring>
+#include <iostream>
+
+static const WaterBackend allBackends[] = {
+    WaterBackend::Cpu, WaterBackend::Gpu, WaterBackend::Adaptive, WaterBackend::Fft
+};
+
+const char* getWaterBackendName(WaterBackend backend) {
+    switch (backend) {
+        case WaterBackend::Gpu: return "gpu";
+        case WaterBackend::Adaptive: return "adaptive";
+        case WaterBackend::Fft: return "fft";
+        default: return "cpu";
+    }
+}
+
+bool parseWaterBackend(const char* name, WaterBackend& backend) {
+    for (WaterBackend candidate : allBackends) {
+        if (std::strcmp(name, getWaterBackendName(candidate)) == 0) {
+            backend = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::unique_ptr<WaterSurface> createWaterSurface(const WaterSurfaceConfig& config) {
+    std::cout << "Water backend: " << getWaterBackendName(config.backend) << std::endl;
+
+    switch (config.backend) {
+        case WaterBackend::Gpu:
+            return std::make_unique<GpuWaterSimulator>(config.gridN, config.physicalSize);
+
+        case WaterBackend::Adaptive: {
+            // Two root blocks per side, refined until the finest level has at least gridN cells.
+            const int rootBlocks = 2;
+            int maxLevel = 0;
+            while ((rootBlocks * AdaptiveWaterSimulator::getBlockSize()) << maxLevel < config.gridN) ++maxLevel;
+            return std::make_unique<AdaptiveWaterSimulator>(config.physicalSize, rootBlocks, maxLevel,
+                                                            config.threadCount);
+        }
+
+        case WaterBackend::Fft:
+            return std::make_unique<FftOceanSimulator>(config.gridN, config.physicalSize, config.threadCount,
+                                                       config.ocean, config.stepSeconds);
+
+        default: {
+            auto water = std::make_unique<WaterSimulator>(config.gridN, config.physicalSize, config.threadCount,
+                                                          config.precision);
+            WaterSolver& solver = water->getSolver();
+            solver.setSparseSimulation(config.sparse);
+            solver.setIntegrator(config.integrator, config.implicitStepMultiple);
+            if (config.asyncMaxBatchSteps > 0) solver.startAsync(config.asyncMaxBatchSteps);
+            return water;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef WATERSURFACEFACTORY_H
+#define WATERSURFACEFACTORY_H
+
+#include <memory>
+#include "WaterSurface.h"
+#include "WaterSimulator.h"
+#include "FftOceanSimulator.h"
+
+enum class WaterBackend {
+    // WaterSimulator: wave equation on a uniform CPU grid.
+    Cpu,
+    // GpuWaterSimulator: the same grid in compute shaders.
+    Gpu,
+    // AdaptiveWaterSimulator: quadtree whose finest level matches gridN.
+    Adaptive,
+    // FftOceanSimulator: spectral ocean.
+    Fft
+};
+
+// Startup settings of the water surface. Fields a backend has no use for are ignored.
+struct WaterSurfaceConfig {
+    WaterBackend backend = WaterBackend::Cpu;
+    int gridN = 256;
+    float physicalSize = 2.0f;
+    // <= 0 uses every hardware thread.
+    int threadCount = 0;
+
+    // Cpu
+    HeightPrecision precision = HeightPrecision::Float32;
+    bool sparse = false;
+    WaterIntegrator integrator = WaterIntegrator::Explicit;
+    int implicitStepMultiple = 4;
+    // Solver thread queueing at most this many steps, 0 to step on the caller.
+    int asyncMaxBatchSteps = 0;
+
+    // Fft
+    OceanSpectrumParameters ocean;
+    float stepSeconds = 1.0f / 60.0f;
+};
+
+// Names are "cpu", "gpu", "adaptive" and "fft".
+const char* getWaterBackendName(WaterBackend backend);
+bool parseWaterBackend(const char* name, WaterBackend& backend);
+
+// Needs a current GL context. The gpu backend needs GL 4.3 compute shaders.
+std::unique_ptr<WaterSurface> createWaterSurface(const WaterSurfaceConfig& config);
+
+#endif // WATERSURFACEFACTORY_H
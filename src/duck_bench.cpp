@@ -0,0 +1,416 @@
+// Headless microbenchmark of the CPU water solvers (duck_water_core). Times
+// the solver passes, the upload copy, point sampling and disturbances for
+// every grid size, kernel variant and thread count, and a tiled ocean flight
+// for every kernel variant and thread count, prints a table and writes the
+// results as JSON. See README.md for the options.
+#include "WaterSolver.h"
+#include "TiledOceanSolver.h"
+#include "WaterKernels.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct BenchOptions {
+    std::vector<int> sizes = {128, 256, 512, 1024, 2048, 4096, 8192};
+    std::vector<WaterKernelISA> kernels;
+    std::vector<int> threads;
+    int warmup = 3;
+    int repeats = 21;
+    // A sample batches calls until it covers this many units, up to
+    // maxCallsPerSample calls. The count depends only on the case, so runs
+    // time the same work.
+    double sampleUnits = 1 << 22;
+    int points = 65536;
+    int disturbances = 4096;
+    std::string output = "duck_bench.json";
+};
+
+// One case at one configuration. `units` is what a call processes: grid
+// cells, sample points or disturbances.
+struct BenchResult {
+    std::string name;
+    const char* unit;
+    int gridN;
+    const char* kernels;
+    int threads;
+    double unitsPerCall;
+    // Bytes a call moves per unit, 0 where that is not meaningful.
+    double bytesPerUnit;
+    int iterationsPerSample;
+    std::vector<double> secondsPerCall;
+    // Case-specific figures other than time, printed below the row.
+    std::vector<std::pair<std::string, double>> counters;
+};
+
+static const float benchSurfaceSize = 2.0f;
+static const int maxCallsPerSample = 256;
+// The interior damps the surface by 0.95 per step, so after about 1600
+// steps the seeded waves are denormal and a step gets many times slower.
+// The step case seeds again well before that.
+static const int maxStepsPerSeed = 512;
+
+#ifndef DUCK_BENCH_BUILD_TYPE
+#define DUCK_BENCH_BUILD_TYPE ""
+#endif
+
+static double percentile(std::vector<double> values, double p) {
+    // Nearest rank.
+    std::sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+    return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+static double mean(const std::vector<double>& values) {
+    double sum = 0.0;
+    for (double v : values) sum += v;
+    return sum / values.size();
+}
+
+// `prepare`, if set, runs untimed before the warmup and before every sample
+// with the number of calls that follow.
+static void measure(BenchResult& result, const BenchOptions& options, const std::function<void()>& call,
+                    const std::function<void(int)>& prepare) {
+    using Clock = std::chrono::steady_clock;
+    result.iterationsPerSample = static_cast<int>(
+        std::min<double>(maxCallsPerSample, std::max(1.0, std::ceil(options.sampleUnits / result.unitsPerCall))));
+
+    if (prepare) prepare(options.warmup);
+    for (int i = 0; i < options.warmup; ++i) call();
+
+    result.secondsPerCall.clear();
+    for (int s = 0; s < options.repeats; ++s) {
+        if (prepare) prepare(result.iterationsPerSample);
+        auto start = Clock::now();
+        for (int i = 0; i < result.iterationsPerSample; ++i) call();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        result.secondsPerCall.push_back(seconds / result.iterationsPerSample);
+    }
+}
+
+static void printResult(const BenchResult& result) {
+    double median = percentile(result.secondsPerCall, 0.5);
+    double p99 = percentile(result.secondsPerCall, 0.99);
+    double nsPerUnit = median * 1e9 / result.unitsPerCall;
+    std::cout << std::left << std::setw(18) << result.name << std::right
+              << std::setw(6) << result.gridN << std::setw(8) << result.kernels << std::setw(4) << result.threads
+              << std::fixed << std::setprecision(3)
+              << std::setw(12) << nsPerUnit << std::setw(12) << p99 * 1e9 / result.unitsPerCall
+              << std::setw(10) << std::setprecision(2) << result.unitsPerCall / median / 1e6;
+    if (result.bytesPerUnit > 0.0) {
+        std::cout << std::setw(9) << result.bytesPerUnit * result.unitsPerCall / median / 1e9;
+    }
+    std::cout << std::defaultfloat << std::endl;
+    if (!result.counters.empty()) {
+        std::cout << "    " << std::setprecision(4);
+        for (const auto& counter : result.counters) std::cout << " " << counter.first << " " << counter.second;
+        std::cout << std::endl;
+    }
+}
+
+static void writeJson(const std::vector<BenchResult>& results, const BenchOptions& options) {
+    std::ofstream out(options.output);
+    if (!out) {
+        std::cerr << "duck_bench: cannot write " << options.output << std::endl;
+        return;
+    }
+    out << std::setprecision(9);
+    out << "{\n";
+    out << "  \"benchmark\": \"duck_bench\",\n";
+    out << "  \"build_type\": \"" << DUCK_BENCH_BUILD_TYPE << "\",\n";
+    out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    out << "  \"surface_size_m\": " << benchSurfaceSize << ",\n";
+    out << "  \"warmup\": " << options.warmup << ",\n";
+    out << "  \"repeats\": " << options.repeats << ",\n";
+    out << "  \"sample_units\": " << options.sampleUnits << ",\n";
+    out << "  \"max_calls_per_sample\": " << maxCallsPerSample << ",\n";
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        double median = percentile(r.secondsPerCall, 0.5);
+        out << (i ? "," : "") << "\n    {";
+        out << "\"case\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\", \"grid_n\": " << r.gridN
+            << ", \"kernels\": \"" << r.kernels << "\", \"threads\": " << r.threads
+            << ", \"units_per_call\": " << r.unitsPerCall << ", \"iterations_per_sample\": " << r.iterationsPerSample;
+        out << ", \"seconds_per_call\": {\"median\": " << median
+            << ", \"p99\": " << percentile(r.secondsPerCall, 0.99)
+            << ", \"min\": " << percentile(r.secondsPerCall, 0.0)
+            << ", \"mean\": " << mean(r.secondsPerCall) << "}";
+        out << ", \"ns_per_unit\": {\"median\": " << median * 1e9 / r.unitsPerCall
+            << ", \"p99\": " << percentile(r.secondsPerCall, 0.99) * 1e9 / r.unitsPerCall << "}";
+        out << ", \"units_per_second\": " << r.unitsPerCall / median;
+        if (r.bytesPerUnit > 0.0) {
+            out << ", \"bytes_per_unit\": " << r.bytesPerUnit
+                << ", \"gb_per_second\": " << r.bytesPerUnit * r.unitsPerCall / median / 1e9;
+        }
+        if (!r.counters.empty()) {
+            out << ", \"counters\": {";
+            for (size_t c = 0; c < r.counters.size(); ++c) {
+                out << (c ? ", " : "") << "\"" << r.counters[c].first << "\": " << r.counters[c].second;
+            }
+            out << "}";
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+    std::cout << "Results written to " << options.output << std::endl;
+}
+
+// Runs every case on one solver. Cases that do not use the thread pool only
+// run for the first thread count.
+static void runConfiguration(int gridN, WaterKernelISA isa, int threads, bool serialCases,
+                             const BenchOptions& options, std::vector<BenchResult>& results) {
+    overrideWaterKernels(isa);
+    const char* kernelName = getWaterKernels(isa).name;
+
+    // The solver logs its setup on std::cout; keep the table readable.
+    std::streambuf* coutBuffer = std::cout.rdbuf(nullptr);
+    WaterSolver solver(gridN, benchSurfaceSize, threads);
+    std::cout.rdbuf(coutBuffer);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> position(-0.45f * benchSurfaceSize, 0.45f * benchSurfaceSize);
+    // Every case starts from the same moving surface rather than flat water.
+    std::vector<glm::vec2> seedPoints(64);
+    for (glm::vec2& p : seedPoints) p = glm::vec2(position(rng), position(rng));
+    int stepsSinceSeed = 0;
+    auto seed = [&] {
+        solver.reset();
+        for (const glm::vec2& p : seedPoints) solver.createDisturbance(p.x, p.y, 0.05f);
+        solver.step(8);
+        stepsSinceSeed = 0;
+    };
+    seed();
+
+    double cells = static_cast<double>(gridN) * gridN;
+    auto addCase = [&](const char* name, const char* unit, double units, double bytesPerUnit,
+                       const std::function<void()>& call, const std::function<void(int)>& prepare = nullptr) {
+        BenchResult result{name, unit, gridN, kernelName, threads, units, bytesPerUnit, 1, {}, {}};
+        measure(result, options, call, prepare);
+        printResult(result);
+        results.push_back(result);
+    };
+
+    // simulateWaterSurface: reads both levels and the damping, writes the oldest level.
+    addCase("step", "cell", cells, 16.0, [&] { solver.step(1); }, [&](int steps) {
+        if (stepsSinceSeed + steps > maxStepsPerSeed) seed();
+        stepsSinceSeed += steps;
+    });
+    // calculateNormals: reads the heights, writes fp32 normals and RGBA8.
+    seed();
+    addCase("normals", "cell", cells, 20.0, [&] { solver.calculateNormals(); });
+
+    std::vector<Disturbance> disturbances(options.disturbances);
+    for (Disturbance& d : disturbances) {
+        d.worldX = position(rng);
+        d.worldZ = position(rng);
+        d.magnitude = 1e-4f;
+    }
+    // Gaussian stamps four cells wide, sorted by tile and applied in parallel.
+    std::vector<Disturbance> stamps = disturbances;
+    for (Disturbance& d : stamps) d.radius = 4.0f * benchSurfaceSize / gridN;
+    addCase("disturbance_batch", "disturbance", stamps.size(), 0.0, [&] {
+        solver.applyDisturbances(stamps);
+        solver.flushDisturbances();
+    });
+    if (!serialCases) return;
+
+    // What a full upload copies into the PBO ring: the heights and the normal map.
+    std::vector<unsigned char> staging(static_cast<size_t>(cells) * 8);
+    addCase("upload_copy", "cell", cells, 16.0, [&] {
+        WaterSolverFrame frame = solver.getFrame();
+        // The fp32 rows are padded, so the heights are packed row by row.
+        size_t rowBytes = static_cast<size_t>(gridN) * sizeof(float);
+        for (int r = 0; r < gridN; ++r) {
+            std::memcpy(staging.data() + r * rowBytes, frame.heights + static_cast<size_t>(r) * frame.heightStride,
+                        rowBytes);
+        }
+        std::memcpy(staging.data() + gridN * rowBytes, frame.normalmap, static_cast<size_t>(cells) * 4);
+    });
+
+    std::vector<glm::vec2> points(options.points);
+    for (glm::vec2& p : points) p = glm::vec2(position(rng), position(rng));
+    std::vector<float> heights(points.size());
+    std::vector<glm::vec3> normals(points.size());
+    volatile float sink = 0.0f;
+    addCase("height_at", "point", points.size(), 0.0, [&] {
+        float sum = 0.0f;
+        for (const glm::vec2& p : points) sum += solver.getHeightAt(p.x, p.y);
+        sink = sum;
+    });
+    addCase("normal_at", "point", points.size(), 0.0, [&] {
+        float sum = 0.0f;
+        for (const glm::vec2& p : points) sum += solver.getNormalAt(p.x, p.y).x;
+        sink = sum;
+    });
+    addCase("sample_batch", "point", points.size(), 0.0, [&] {
+        solver.sampleBatch(points.data(), points.size(), heights.data(), normals.data());
+    });
+
+    // createDisturbance: one cell each, applied immediately.
+    addCase("disturbance", "disturbance", disturbances.size(), 0.0, [&] {
+        for (const Disturbance& d : disturbances) solver.createDisturbance(d.worldX, d.worldZ, d.magnitude);
+    });
+    (void)sink;
+}
+
+// A camera flying across a TiledOceanSolver with a wake behind it, timed per
+// step. The view crosses a tile every 80 steps, so tiles are paged in, stored
+// and dropped all the time. Reports the most tiles and bytes held at once,
+// which must stay within the budgets.
+static void runTiledOcean(WaterKernelISA isa, int threads, const BenchOptions& options,
+                          std::vector<BenchResult>& results) {
+    overrideWaterKernels(isa);
+    const int residentBudget = 40;
+    const int storedBudget = 100;
+    std::streambuf* coutBuffer = std::cout.rdbuf(nullptr);
+    TiledOceanSolver ocean(4.0f, 64, 2, residentBudget, storedBudget, threads);
+    std::cout.rdbuf(coutBuffer);
+
+    int frame = 0;
+    int maxResident = 0;
+    int maxStored = 0;
+    size_t maxBytes = 0;
+    BenchResult result{"tiled_ocean", "step", ocean.getTileCells(), getWaterKernels(isa).name, threads, 1.0, 0.0, 1,
+                       {}, {}};
+    measure(result, options, [&] {
+        float x = static_cast<float>(frame) * 0.05f;
+        float z = 10.0f * std::sin(static_cast<float>(frame) * 0.003f);
+        ++frame;
+        ocean.setView(x, z);
+        ocean.createDisturbance(x, z, 0.25f);
+        ocean.advance(1);
+        maxResident = std::max(maxResident, ocean.getResidentTileCount());
+        maxStored = std::max(maxStored, ocean.getStoredTileCount());
+        maxBytes = std::max(maxBytes, ocean.getResidentBytes() + ocean.getStoredBytes());
+    }, nullptr);
+    result.counters = {{"distance_m", 0.05 * frame},
+                       {"max_resident_tiles", static_cast<double>(maxResident)},
+                       {"max_stored_tiles", static_cast<double>(maxStored)},
+                       {"max_mb", maxBytes / 1e6}};
+    printResult(result);
+    if (maxResident > residentBudget || maxStored > storedBudget) {
+        std::cerr << "duck_bench: tiled_ocean exceeded its tile budgets" << std::endl;
+    }
+    results.push_back(result);
+}
+
+static bool parseIntList(const char* text, std::vector<int>& values) {
+    values.clear();
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        int value = std::atoi(item.c_str());
+        if (value <= 0) return false;
+        values.push_back(value);
+    }
+    return !values.empty();
+}
+
+static void printUsage() {
+    std::cout << "Usage: duck_bench [options]\n"
+                 "  --sizes N,N,...        grid sizes (default 128,256,...,8192)\n"
+                 "  --kernels name,...     scalar, sse4.2, avx2, avx512 (default: all the CPU supports)\n"
+                 "  --threads T,T,...      thread counts (default 1, 2, 4, ... up to the hardware threads)\n"
+                 "  --warmup K             untimed calls before each case (default 3)\n"
+                 "  --repeats K            timed samples per case (default 21)\n"
+                 "  --sample-units U       batch calls until a sample covers U cells, points or\n"
+                 "                         disturbances, at most 256 calls (default 4194304)\n"
+                 "  --points P             sample points per call (default 65536)\n"
+                 "  --disturbances D       disturbances per call (default 4096)\n"
+                 "  --out FILE             JSON output (default duck_bench.json)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        const char* value = hasValue ? argv[i + 1] : "";
+        bool ok = true;
+        if (std::strcmp(argv[i], "--help") == 0) {
+            printUsage();
+            return 0;
+        } else if (std::strcmp(argv[i], "--sizes") == 0 && hasValue) {
+            ok = parseIntList(value, options.sizes);
+        } else if (std::strcmp(argv[i], "--threads") == 0 && hasValue) {
+            ok = parseIntList(value, options.threads);
+        } else if (std::strcmp(argv[i], "--kernels") == 0 && hasValue) {
+            std::stringstream stream(value);
+            std::string name;
+            while (ok && std::getline(stream, name, ',')) {
+                WaterKernelISA isa;
+                ok = parseWaterKernelISA(name.c_str(), isa) && isWaterKernelISASupported(isa);
+                if (ok) options.kernels.push_back(isa);
+            }
+        } else if (std::strcmp(argv[i], "--warmup") == 0 && hasValue) {
+            options.warmup = std::max(0, std::atoi(value));
+        } else if (std::strcmp(argv[i], "--repeats") == 0 && hasValue) {
+            options.repeats = std::max(1, std::atoi(value));
+        } else if (std::strcmp(argv[i], "--sample-units") == 0 && hasValue) {
+            options.sampleUnits = std::max(1.0, std::atof(value));
+        } else if (std::strcmp(argv[i], "--points") == 0 && hasValue) {
+            options.points = std::max(1, std::atoi(value));
+        } else if (std::strcmp(argv[i], "--disturbances") == 0 && hasValue) {
+            options.disturbances = std::max(1, std::atoi(value));
+        } else if (std::strcmp(argv[i], "--out") == 0 && hasValue) {
+            options.output = value;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "duck_bench: bad option " << argv[i] << (hasValue ? " " : "") << value << std::endl;
+            printUsage();
+            return -1;
+        }
+        ++i;
+    }
+
+    if (options.kernels.empty()) {
+        for (WaterKernelISA isa : {WaterKernelISA::Scalar, WaterKernelISA::SSE42, WaterKernelISA::AVX2,
+                                   WaterKernelISA::AVX512}) {
+            if (isWaterKernelISASupported(isa)) options.kernels.push_back(isa);
+        }
+    }
+    if (options.threads.empty()) {
+        int hardwareThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        for (int t = 1; t < hardwareThreads; t *= 2) options.threads.push_back(t);
+        options.threads.push_back(hardwareThreads);
+    }
+
+    std::cout << std::left << std::setw(18) << "case" << std::right << std::setw(6) << "N" << std::setw(8) << "kernels"
+              << std::setw(4) << "thr" << std::setw(12) << "ns/unit" << std::setw(12) << "p99" << std::setw(10)
+              << "Munit/s" << std::setw(9) << "GB/s" << std::endl;
+
+    std::vector<BenchResult> results;
+    for (int gridN : options.sizes) {
+        for (WaterKernelISA isa : options.kernels) {
+            for (size_t t = 0; t < options.threads.size(); ++t) {
+                try {
+                    runConfiguration(gridN, isa, options.threads[t], t == 0, options, results);
+                } catch (const std::bad_alloc&) {
+                    std::cerr << "duck_bench: not enough memory for N=" << gridN << ", skipped" << std::endl;
+                }
+            }
+        }
+    }
+    for (WaterKernelISA isa : options.kernels) {
+        for (int threads : options.threads) {
+            runTiledOcean(isa, threads, options, results);
+        }
+    }
+
+    writeJson(results, options);
+    return 0;
+}
@@ -10,14 +10,21 @@
 
 #include "Shader.h"
 #include "Camera.h"
-#include "WaterSimulator.h"
+#include "WaterSurfaceFactory.h"
+#include "WaterKernels.h"
 #include "Model.h"
 #include "DuckAnimator.h"
+#include "SimulationClock.h"
+#include "FrameProfiler.h"
+#include "TraceRecorder.h"
 
 #include <iostream>
 #include <vector>
 #include <string>
 #include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
@@ -31,8 +38,17 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 unsigned int SCR_WIDTH = 1280;
 unsigned int SCR_HEIGHT = 720;
 
+const WaterBackend WATER_BACKEND = WaterBackend::Cpu; // --water <name> overrides it
 const int WATER_GRID_N = 256;
 const float WATER_SURFACE_SIZE = 4.0f;
+const int WATER_SIM_THREADS = 0; // 0 = all hardware threads, --water-threads <n> overrides it
+const HeightPrecision WATER_HEIGHT_PRECISION = HeightPrecision::Float32;
+const double WATER_STEPS_PER_SECOND = 60.0;
+const int WATER_MAX_STEPS_PER_FRAME = 4;
+const bool WATER_SIM_SPARSE = true; // skip tiles of calm water (Float32 only)
+const bool WATER_SIM_ASYNC = true; // CPU solver on its own thread, overlapping rendering
+const WaterIntegrator WATER_INTEGRATOR = WaterIntegrator::Explicit;
+const int WATER_IMPLICIT_STEP_MULTIPLE = 4; // explicit steps per ADI step (ImplicitADI only)
 const unsigned int HEIGHT_MAP_RESOLUTION = WATER_GRID_N;
 
 Camera camera(glm::vec3(0.0f, 0.5f, 0.0f), 3.0f);
@@ -53,7 +69,62 @@ unsigned int sceneColorTextureOutput;
 unsigned int sceneDepthTextureOutput;
 
 
-int main() {
+int main(int argc, char** argv) {
+    WaterSurfaceConfig waterConfig;
+    waterConfig.backend = WATER_BACKEND;
+    waterConfig.gridN = WATER_GRID_N;
+    waterConfig.physicalSize = WATER_SURFACE_SIZE;
+    waterConfig.threadCount = WATER_SIM_THREADS;
+    waterConfig.precision = WATER_HEIGHT_PRECISION;
+    waterConfig.sparse = WATER_SIM_SPARSE;
+    waterConfig.integrator = WATER_INTEGRATOR;
+    waterConfig.implicitStepMultiple = WATER_IMPLICIT_STEP_MULTIPLE;
+    waterConfig.asyncMaxBatchSteps = WATER_SIM_ASYNC ? 2 * WATER_MAX_STEPS_PER_FRAME : 0;
+    waterConfig.stepSeconds = static_cast<float>(1.0 / WATER_STEPS_PER_SECOND);
+    std::string tracePath;
+    double traceSeconds = 30.0;
+
+    // --water cpu|gpu|adaptive|fft picks the solver, --water-kernels
+    // scalar|sse4.2|avx2|avx512 its SIMD variant and --water-threads its pool
+    // size. --gpu-water, --adaptive-water and --fft-ocean are short for --water.
+    // --trace FILE records a timeline for --trace-seconds (profiler builds only).
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--gpu-water") == 0) {
+            waterConfig.backend = WaterBackend::Gpu;
+        } else if (std::strcmp(argv[i], "--adaptive-water") == 0) {
+            waterConfig.backend = WaterBackend::Adaptive;
+        } else if (std::strcmp(argv[i], "--fft-ocean") == 0) {
+            waterConfig.backend = WaterBackend::Fft;
+        } else if (std::strcmp(argv[i], "--water") == 0 && hasValue) {
+            if (!parseWaterBackend(argv[++i], waterConfig.backend)) {
+                std::cerr << "Unknown water backend: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (std::strcmp(argv[i], "--water-kernels") == 0 && hasValue) {
+            WaterKernelISA isa;
+            if (!parseWaterKernelISA(argv[++i], isa) || !overrideWaterKernels(isa)) {
+                std::cerr << "Water kernels not available: " << argv[i] << std::endl;
+                return -1;
+            }
+        } else if (std::strcmp(argv[i], "--water-threads") == 0 && hasValue) {
+            waterConfig.threadCount = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--trace") == 0 && hasValue) {
+            tracePath = argv[++i];
+        } else if (std::strcmp(argv[i], "--trace-seconds") == 0 && hasValue) {
+            traceSeconds = std::atof(argv[++i]);
+        } else {
+            std::cerr << "Unknown option: " << argv[i] << std::endl;
+            return -1;
+        }
+    }
+#ifndef DUCK_PROFILE
+    if (!tracePath.empty()) {
+        std::cerr << "--trace needs a build with -DDUCK_FRAME_PROFILER=ON" << std::endl;
+        return -1;
+    }
+#endif
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
@@ -89,7 +160,7 @@ int main() {
     Shader duckShader("shaders/duck.vert", "shaders/duck.frag");
     Shader wallShader("shaders/wall.vert", "shaders/wall.frag");
 
-    WaterSimulator waterSimulator(WATER_GRID_N, WATER_SURFACE_SIZE);
+    std::unique_ptr<WaterSurface> water = createWaterSurface(waterConfig);
 
     std::vector<float> waterVertices;
     std::vector<unsigned int> waterIndices;
@@ -192,154 +263,211 @@ int main() {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     float heightScale = 0.1f;
+    SimulationClock simulationClock(WATER_STEPS_PER_SECOND, WATER_MAX_STEPS_PER_FRAME);
+
+    DUCK_TRACE_THREAD_NAME("main");
+    DUCK_TRACE_START(tracePath, traceSeconds);
 
     while (!glfwWindowShouldClose(window)) {
         float currentFrame = static_cast<float>(glfwGetTime());
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        processInput(window);
-
-        waterSimulator.createRaindrop();
-        waterSimulator.updateSimulation();
+        {
+            DUCK_PROFILE_CPU("input");
+            processInput(window);
+        }
 
-        duckAnimator.update(deltaTime);
+        {
+            DUCK_PROFILE_CPU("animation");
+            duckAnimator.update(deltaTime);
+        }
         glm::vec3 currentDuckSplinePos = duckAnimator.getCurrentPositionXZ();
 
         glm::mat4 duckTransform = duckAnimator.getDuckTransform(-0.075f, glm::vec3(0.0f, 1.0f, 0.0f));
 
         float currentSplineSpeed = duckAnimator.getCurrentSplineAdvancementSpeed();
         float actualWakeMagnitude = currentSplineSpeed;
-        waterSimulator.createDisturbance(currentDuckSplinePos.x, currentDuckSplinePos.z, actualWakeMagnitude);
+
+        // Raindrops and the wake are per simulation step, so their rate does not follow the FPS.
+        int simSteps = simulationClock.advance(deltaTime);
+        {
+            DUCK_PROFILE_CPU("disturbances");
+            for (int s = 0; s < simSteps; ++s) {
+                water->createRaindrop(s);
+                water->createDisturbance(currentDuckSplinePos.x, currentDuckSplinePos.z, actualWakeMagnitude, s);
+            }
+            water->setFocus(camera.Position.x, camera.Position.z, WATER_SURFACE_SIZE / 4.0f);
+        }
+        water->updateSimulation(simSteps);
 
         glm::mat4 projection = camera.GetProjectionMatrix((float)SCR_WIDTH / (float)SCR_HEIGHT);
         glm::mat4 view = camera.GetViewMatrix();
         glm::mat4 identityModel = glm::mat4(1.0f);
 
-        glEnable(GL_DEPTH_TEST);
-        glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
-        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glCullFace(GL_BACK);
-
-        wallShader.use();
-        wallShader.setMat4("model", identityModel);
-        wallShader.setMat4("view", view);
-        wallShader.setMat4("projection", projection);
-        wallShader.setVec3("wallColor", glm::vec3(0.5f, 0.5f, 0.5f));
-        wallShader.setVec3("lightPos", lightPos);
-        wallShader.setVec3("lightColor", glm::vec3(1.0f, 1.0f, 1.0f));
-        wallShader.setVec3("viewPos", camera.Position);
-        glBindVertexArray(sceneWallVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-
-        duckShader.use();
-        duckShader.setMat4("model", duckTransform);
-        duckShader.setMat4("view", view);
-        duckShader.setMat4("projection", projection);
-        duckShader.setVec3("lightPos", lightPos);
-        duckShader.setVec3("lightColor", glm::vec3(1.0f, 1.0f, 0.9f));
-        duckShader.setVec3("viewPos", camera.Position);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, duckTexture);
-        duckShader.setInt("texture_diffuse1", 0);
-        duckModel.Draw();
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glDepthFunc(GL_LEQUAL);
-        skyboxShader.use();
-        skyboxShader.setMat4("view", glm::mat4(glm::mat3(view)));
-        skyboxShader.setMat4("projection", projection);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        skyboxShader.setInt("skybox", 0);
-        glBindVertexArray(skyboxVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glDepthFunc(GL_LESS);
-
-        wallShader.use();
-        wallShader.setMat4("model", identityModel);
-        wallShader.setMat4("view", view);
-        wallShader.setMat4("projection", projection);
-        wallShader.setVec3("wallColor", glm::vec3(0.5f, 0.5f, 0.5f));
-        wallShader.setVec3("lightPos", lightPos);
-        wallShader.setVec3("lightColor", glm::vec3(1.0f, 1.0f, 1.0f));
-        wallShader.setVec3("viewPos", camera.Position);
-        glBindVertexArray(sceneWallVAO);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-
-        glDisable(GL_CULL_FACE);
-
-        duckShader.use();
-        duckShader.setMat4("model", duckTransform);
-        duckShader.setMat4("view", view);
-        duckShader.setMat4("projection", projection);
-        duckShader.setVec3("lightPos", lightPos);
-        duckShader.setVec3("lightColor", glm::vec3(1.0f, 1.0f, 0.9f));
-        duckShader.setVec3("viewPos", camera.Position);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, duckTexture);
-        duckShader.setInt("texture_diffuse1", 0);
-        duckModel.Draw();
-
-
-
-        waterShader.use();
-        waterShader.setMat4("model", identityModel);
-        waterShader.setMat4("view", view);
-        waterShader.setMat4("projection", projection);
-
-        glm::mat4 invView = glm::inverse(view);
-        glm::mat4 invProjection = glm::inverse(projection);
-        waterShader.setMat4("invView", invView);
-        waterShader.setMat4("invProjection", invProjection);
-
-        waterShader.setVec3("viewPos_world", camera.Position);
-        waterShader.setVec2("uScreenSize", glm::vec2((float)SCR_WIDTH, (float)SCR_HEIGHT));
-
-        waterShader.setFloat("uRefractionStrength", 1.0f);
-        waterShader.setFloat("uReflectionStrength", 1.0f);
-        waterShader.setFloat("uFresnelPower", 5.0f);
-        waterShader.setFloat("uWaterIOR", 1.33f);
-        waterShader.setFloat("uWaterTurbidity", 0.0f);
-
-        waterShader.setInt("uMaxSteps", 64);
-        waterShader.setFloat("uStepSize", 0.01f);
-        waterShader.setFloat("uMaxDistance", 5.0f);
-        waterShader.setFloat("uThickness", 0.05f);
-        waterShader.setFloat("uRayBias", 0.0f);
-
-        waterShader.setFloat("uWaterLevel", 0.5f);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, sceneColorTextureOutput);
-        waterShader.setInt("uSceneColor", 0);
-
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, sceneDepthTextureOutput);
-        waterShader.setInt("uSceneDepth", 1);
+        {
+            DUCK_PROFILE_GPU("scene FBO");
+            glEnable(GL_DEPTH_TEST);
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+            glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+            glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glCullFace(GL_BACK);
+
+            wallShader.use();
+            wallShader.setMat4("model", identityModel);
+            wallShader.setMat4("view", view);
+            wallShader.setMat4("projection", projection);
+            wallShader.setVec3("wallColor", glm::vec3(0.5f, 0.5f, 0.5f));
+            wallShader.setVec3("lightPos", lightPos);
+            wallShader.setVec3("lightColor", glm::vec3(1.0f, 1.0f, 1.0f));
+            wallShader.setVec3("viewPos", camera.Position);
+            glBindVertexArray(sceneWallVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+
+            duckShader.use();
+            duckShader.setMat4("model", duckTransform);
+            duckShader.setMat4("view", view);
+            duckShader.setMat4("projection", projection);
+            duckShader.setVec3("lightPos", lightPos);
+            duckShader.setVec3("lightColor", glm::vec3(1.0f, 1.0f, 0.9f));
+            duckShader.setVec3("viewPos", camera.Position);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, duckTexture);
+            duckShader.setInt("texture_diffuse1", 0);
+            duckModel.Draw();
+        }
 
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, waterSimulator.getHeightmapTextureID());
-        waterShader.setInt("uHeightMap", 3);
+        {
+            DUCK_PROFILE_GPU("skybox");
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+            glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            glDepthFunc(GL_LEQUAL);
+            skyboxShader.use();
+            skyboxShader.setMat4("view", glm::mat4(glm::mat3(view)));
+            skyboxShader.setMat4("projection", projection);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+            skyboxShader.setInt("skybox", 0);
+            glBindVertexArray(skyboxVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glDepthFunc(GL_LESS);
+        }
 
-        waterShader.setFloat("uHeightScale", heightScale);
-        waterShader.setFloat("uWaterSurfaceSize", WATER_SURFACE_SIZE);
-        waterShader.setVec2("uTexelSize", 1.0f / (float)waterSimulator.getGridN(), 1.0f / (float)waterSimulator.getGridN());
+        {
+            DUCK_PROFILE_GPU("walls");
+            wallShader.use();
+            wallShader.setMat4("model", identityModel);
+            wallShader.setMat4("view", view);
+            wallShader.setMat4("projection", projection);
+            wallShader.setVec3("wallColor", glm::vec3(0.5f, 0.5f, 0.5f));
+            wallShader.setVec3("lightPos", lightPos);
+            wallShader.setVec3("lightColor", glm::vec3(1.0f, 1.0f, 1.0f));
+            wallShader.setVec3("viewPos", camera.Position);
+            glBindVertexArray(sceneWallVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+        }
 
-        glBindVertexArray(waterVAO);
-        glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(waterIndices.size()), GL_UNSIGNED_INT, 0);
+        {
+            DUCK_PROFILE_GPU("duck");
+            glDisable(GL_CULL_FACE);
+
+            duckShader.use();
+            duckShader.setMat4("model", duckTransform);
+            duckShader.setMat4("view", view);
+            duckShader.setMat4("projection", projection);
+            duckShader.setVec3("lightPos", lightPos);
+            duckShader.setVec3("lightColor", glm::vec3(1.0f, 1.0f, 0.9f));
+            duckShader.setVec3("viewPos", camera.Position);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, duckTexture);
+            duckShader.setInt("texture_diffuse1", 0);
+            duckModel.Draw();
+        }
 
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
+        {
+            DUCK_PROFILE_GPU("water");
+            waterShader.use();
+            waterShader.setMat4("model", identityModel);
+            waterShader.setMat4("view", view);
+            waterShader.setMat4("projection", projection);
+
+            glm::mat4 invView = glm::inverse(view);
+            glm::mat4 invProjection = glm::inverse(projection);
+            waterShader.setMat4("invView", invView);
+            waterShader.setMat4("invProjection", invProjection);
+
+            waterShader.setVec3("viewPos_world", camera.Position);
+            waterShader.setVec2("uScreenSize", glm::vec2((float)SCR_WIDTH, (float)SCR_HEIGHT));
+
+            waterShader.setFloat("uRefractionStrength", 1.0f);
+            waterShader.setFloat("uReflectionStrength", 1.0f);
+            waterShader.setFloat("uFresnelPower", 5.0f);
+            waterShader.setFloat("uWaterIOR", 1.33f);
+            waterShader.setFloat("uWaterTurbidity", 0.0f);
+
+            waterShader.setInt("uMaxSteps", 64);
+            waterShader.setFloat("uStepSize", 0.01f);
+            waterShader.setFloat("uMaxDistance", 5.0f);
+            waterShader.setFloat("uThickness", 0.05f);
+            waterShader.setFloat("uRayBias", 0.0f);
+
+            waterShader.setFloat("uWaterLevel", 0.5f);
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, sceneColorTextureOutput);
+            waterShader.setInt("uSceneColor", 0);
+
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, sceneDepthTextureOutput);
+            waterShader.setInt("uSceneDepth", 1);
+
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_2D, water->getHeightmapTextureID());
+            waterShader.setInt("uHeightMap", 3);
+
+            // The page table sampler is unsigned, so it always gets a unit of its own.
+            WaterPageTable pageTable = water->getPageTable();
+            glActiveTexture(GL_TEXTURE4);
+            glBindTexture(GL_TEXTURE_2D, pageTable.texture);
+            waterShader.setInt("uPageTable", 4);
+            waterShader.setBool("uAdaptive", pageTable.texture != 0);
+            waterShader.setInt("uPagesPerSide", pageTable.pagesPerSide);
+            waterShader.setInt("uRootBlocks", pageTable.rootBlocks);
+            waterShader.setInt("uBlockSize", pageTable.blockSize);
+
+            GLuint displacementTexture = water->getDisplacementTextureID();
+            glActiveTexture(GL_TEXTURE5);
+            glBindTexture(GL_TEXTURE_2D, displacementTexture);
+            waterShader.setInt("uDisplacementMap", 5);
+            waterShader.setBool("uDisplaced", displacementTexture != 0);
+            int gridN = water->getGridN();
+
+            // Metric heights (the ocean) are drawn unscaled.
+            float drawnScale = water->hasMetricHeights() ? 1.0f : heightScale;
+            waterShader.setFloat("uHeightScale", drawnScale * water->getHeightmapScale());
+            waterShader.setFloat("uWaterSurfaceSize", WATER_SURFACE_SIZE);
+            waterShader.setVec2("uTexelSize", 1.0f / (float)gridN, 1.0f / (float)gridN);
+
+            glBindVertexArray(waterVAO);
+            glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(waterIndices.size()), GL_UNSIGNED_INT, 0);
+
+            glEnable(GL_CULL_FACE);
+            glCullFace(GL_BACK);
+        }
 
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        {
+            DUCK_PROFILE_CPU("swap");
+            glfwSwapBuffers(window);
+        }
+        {
+            DUCK_PROFILE_CPU("input");
+            glfwPollEvents();
+        }
+        DUCK_PROFILE_END_FRAME();
     }
 
     glDeleteVertexArrays(1, &waterVAO);
@@ -355,6 +483,16 @@ int main() {
     glDeleteTextures(1, &sceneColorTextureOutput);
     glDeleteTextures(1, &sceneDepthTextureOutput);
 
+    if (const TextureUploadStats* uploads = water->getUploadStats()) {
+        std::cout << "WaterSim uploads: " << uploads->uploads << ", fence stalls: " << uploads->fenceStalls
+                  << ", fence wait: " << uploads->fenceWaitSeconds * 1000.0 << " ms" << std::endl;
+    }
+    DUCK_TRACE_STOP();
+    DUCK_PROFILE_REPORT();
+    // The simulators and the profiler own GL objects, release them while the context is still alive.
+    water.reset();
+    DUCK_PROFILE_SHUTDOWN();
+
     glfwTerminate();
     return 0;
 }